@@ -7,6 +7,7 @@
  * the Free Software Foundation, either version 3 of the License, or
  * (at your option) any later version.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -18,8 +19,11 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/errno.h>
+#include <sys/epoll.h>
 #include <signal.h>
 
 #include <pwd.h>
@@ -35,6 +39,22 @@
 #include "cli.h"
 #include "cli_cmd.h"
 #include "cli_wrapper.h"
+#include "cli_reactor.h"
+#include "cli_ring.h"
+#include "cli_writer.h"
+#include "cli_pool.h"
+#include "cli_store.h"
+#include "cli_flush.h"
+#include "cli_seg.h"
+#include "cli_cap.h"
+#include "cli_inflate.h"
+#include "cli_fmt.h"
+#include "cli_view.h"
+#include "cli_search.h"
+#include "cli_bloom.h"
+#include "cli_pcap.h"
+#include "cli_send.h"
+#include "cli_replay.h"
 
 int find_free_if_spot(cli_ctx *ctx)
 {
@@ -94,70 +114,72 @@ void cli_print_model(cli_if_mode mode)
 	}
 }
 
-void cli_print_format_mode(cli_if_mode mode, const char *buffer, size_t len)
+void cli_print_overload(cli_overload overload)
 {
-	int i;
-	int s = 0;
+	switch (overload) {
+	case CLI_OVERLOAD_BLOCK: printw("block"); break;
+	case CLI_OVERLOAD_DROP_NEWEST: printw("drop-newest"); break;
+	case CLI_OVERLOAD_DROP_OLDEST: printw("drop-oldest"); break;
+	}
+}
 
-	for (i = 0; i < len; i++) {
-		switch (mode) {
-		case CLI_MODE_PLAINTEXT:
-			if ((isprint(buffer[i])) || (buffer[i] == '\n')) addch(buffer[i]);
-			break;
-		case CLI_MODE_Z:
-		case CLI_MODE_HEX:
-			printw("%02x ", buffer[i]);
-			if (((i + 1) % 24) == 0) { printw("\n"); }
-			break;
-		case CLI_MODE_OCTAL:
-			printw("%s ", cli_format(mode, buffer[i], &s));
-			if (((i + 1) % 20) == 0) { printw("\n"); }
-			break;
-		case CLI_MODE_BINARY:
-			printw("%s ", cli_format(mode, buffer[i], &s));
-			if (((i + 1) % 8) == 0) { printw("\n"); }
-			break;
-		}
+void cli_print_durable(cli_durable *d)
+{
+	switch (d->mode) {
+	case CLI_DURABLE_NONE: printw("none"); break;
+	case CLI_DURABLE_RECORD: printw("record"); break;
+	case CLI_DURABLE_PERIODIC:
+		printw("periodic");
+		if (d->ms > 0) { printw(" %ums", d->ms); }
+		if (d->records > 0) { printw(" %urec", d->records); }
+		break;
 	}
+}
 
-// fflush(stdout);
-	refresh();
+void cli_print_limits(unsigned long bytes, unsigned long secs)
+{
+	if ((bytes == 0) && (secs == 0)) { printw("none"); }
+
+	if ((bytes > 0) && ((bytes % (1UL << 30)) == 0)) { printw("%luGB", bytes >> 30); }
+	else if ((bytes > 0) && ((bytes % (1UL << 20)) == 0)) { printw("%luMB", bytes >> 20); }
+	else if ((bytes > 0) && ((bytes % (1UL << 10)) == 0)) { printw("%luKB", bytes >> 10); }
+	else if (bytes > 0) { printw("%luB", bytes); }
+
+	if ((bytes > 0) && (secs > 0)) { printw("/"); }
+
+	if ((secs >= 3600) && ((secs % 3600) == 0)) { printw("%luh", secs / 3600); }
+	else if ((secs >= 60) && ((secs % 60) == 0)) { printw("%lumin", secs / 60); }
+	else if (secs > 0) { printw("%lus", secs); }
 }
 
-char *cli_format(cli_if_mode mode, char byte, int *size)
+void cli_print_time(unsigned long ts)
 {
-	static char ret[8];
-	memset(ret, 0, 8);
+	time_t t = ts / 1000000000UL;
+	struct tm tm;
+	char tmp[CLI_DEFAULT_BUFFER];
 
-	*size = 1;
+	localtime_r(&t, &tm);
+	strftime(tmp, CLI_DEFAULT_BUFFER, "%Y-%m-%d %H:%M:%S", &tm);
+	printw("%s.%06lu", tmp, (ts % 1000000000UL) / 1000);
+}
 
-	switch (mode) {
-	case CLI_MODE_PLAINTEXT:
-		ret[0] = byte;
-		break;
-	case CLI_MODE_Z:
-	case CLI_MODE_HEX:
-		sprintf(ret, "%02x", byte);
-		*size = 2;
-		break;
-	case CLI_MODE_OCTAL:
-		sprintf(ret, "%03o", byte);
-		*size = 3;
-		break;
-	case CLI_MODE_BINARY:
-		ret[0] = '0' + ((byte >> 7) & 0x01);
-		ret[0] = '0' + ((byte >> 6) & 0x01);
-		ret[0] = '0' + ((byte >> 5) & 0x01);
-		ret[0] = '0' + ((byte >> 4) & 0x01);
-		ret[0] = '0' + ((byte >> 3) & 0x01);
-		ret[0] = '0' + ((byte >> 2) & 0x01);
-		ret[0] = '0' + ((byte >> 1) & 0x01);
-		ret[0] = '0' + (byte & 0x01);
-		*size = 8;
-		break;
+/**
+ * Prints a record as mode shows it, a line at a time.
+ */
+void cli_print_format_mode(cli_if_mode mode, const char *buffer, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)buffer;
+	char line[CLI_FMT_LINE];
+	size_t i, n, w = cli_fmt_width(mode);
+
+	// rxmode zlib records hold what was inflated, which is shown as text
+	for (i = 0; i < len; i += n) {
+		n = (len - i > w ? w : len - i);
+		addnstr(line, cli_fmt_line(mode, p + i, n, line));
 	}
 
-	return ret;
+// fflush(stdout);
+	refresh();
 }
 
 void cli_print_error(const char *caller)
@@ -186,35 +208,49 @@ void cli_cmd_add(cli_ctx *ctx)
 	iface->header = 'i';
 	iface->active = 1;
 	iface->buffer_size = CLI_DEFAULT_BUFFER;
+	iface->rx_batch = CLI_RX_BATCH;
+	iface->rotate_bytes = CLI_SEG_BYTES;
 	iface->rxdev.fp = stdout;
+	iface->rxq = cli_ring_new(CLI_RING_SLOTS);
+	pthread_mutex_init(&iface->lock, NULL);
+	pthread_mutex_init(&iface->txlock, NULL);
 	iface->type = CLI_TYPE_FILE;
 	memset(iface->devname, 0, CLI_DEFAULT_BUFFER);
 	memcpy(iface->devname, fname, 6);
 	
 	if ((i = find_free_if_spot(ctx)) < CLI_DEFAULT_BUFFER) {
-		sprintf(tmp, "%s/%08x/if%02x-offset", ctx->pwd, ctx->pid, i);
-		iface->offset = fopen(tmp, "wb+");
+		sprintf(tmp, "%s/%08x/if%02x-header", ctx->pwd, ctx->pid, i);
+		if ((iface->offset = cli_store_open(tmp, CLI_STORE_CREATE)) == NULL) {
+			cli_print_error("add");
+			i = CLI_DEFAULT_BUFFER;
+		}
+	}
+
+	if (i < CLI_DEFAULT_BUFFER) {
 		// eventually, we will need to make sure that these are unique  in the
 		// event we allow moving of ifaces (at present however I don't see a need
 		// for this and it adds extra unncessary complexity)
 		iface->id = i;
 		iface->link = (void *)iface;
 
-		fwrite(iface, 1, sizeof(cli_if), iface->offset);
-		// write initial offset
-		iface->rx_offsetpos = 0;
-		fwrite(&iface->rx_offsetpos, 1, sizeof(unsigned int), iface->offset);
+		cli_write_if(iface);
 
-		sprintf(tmp, "%s/%08x/if%02x-buffer", ctx->pwd, ctx->pid, i);
-		iface->buffer = fopen(tmp, "ab+");
+		// records go to segments of offset, buffer and peer files
+		sprintf(tmp, "%s/%08x", ctx->pwd, ctx->pid);
+		cli_seg_new(iface, tmp);
 
-		// aquire mutex
-		pthread_mutex_lock(&ctx->mutex);
+		// aquire lock
+		pthread_rwlock_wrlock(&ctx->iflock);
 		ctx->ifs[i] = iface;
 		ctx->ifsel = i;
-		// release mutex
-		pthread_mutex_unlock(&ctx->mutex);
+		// release lock
+		pthread_rwlock_unlock(&ctx->iflock);
+
+		cli_write_manifest(ctx);
 	} else {
+		pthread_mutex_destroy(&iface->lock);
+		pthread_mutex_destroy(&iface->txlock);
+		cli_ring_free(iface->rxq);
 		free(iface);
 	}
 }
@@ -235,11 +271,11 @@ int cli_add_line(cli_ctx *ctx, cli_line *l)
 			memset(iface, 0, sizeof(cli_if));
 			memcpy(iface, l, sizeof(cli_line));
 
-			// aquire mutex
-			pthread_mutex_lock(&ctx->mutex);
+			// aquire lock
+			pthread_rwlock_wrlock(&ctx->iflock);
 			ctx->ifs[i] = iface;
-			// release mutex
-			pthread_mutex_unlock(&ctx->mutex);
+			// release lock
+			pthread_rwlock_unlock(&ctx->iflock);
 			
 			ret = 1;
 		} else {
@@ -282,100 +318,346 @@ void cli_cmd_tie(cli_ctx *ctx)
 	}
 }
 
-void cli_handle_rx(cli_ctx *ctx, cli_if *iface, char *buffer)
+/**
+ * Reserves room for a len byte record at the tail of the interface's rx
+ * queue and returns the positions in the active segment that the offset
+ * entry and the record (header first) belong at.  Writers use positioned
+ * writes, so several records may be in flight at once.  Must be called with
+ * iface->lock held.
+ */
+void cli_rx_reserve(cli_if *iface, unsigned int len, long *ipos, long *dpos)
 {
-	int i;
-	
-	// add to offset file
-	fseek(iface->offset, 0, SEEK_END);
-	iface->rx_offsetpos += iface->read_size;
-	fwrite(&iface->rx_offsetpos, 1, sizeof(unsigned int), iface->offset);
-	
-	// add to buffer file
-	fwrite(buffer, 1, iface->read_size, iface->buffer);
-	iface->rx_count++;	
-	iface->rx_size += iface->read_size;
+	cli_seg *seg = cli_seg_active(iface);
 
-	// perform interface specific actions
+	*dpos = iface->rx_offsetpos;
+	*ipos = seg->base + ((iface->rx_count - seg->first) * sizeof(uint64_t));
+
+	seg->count++;
+	seg->bytes += sizeof(cli_rechdr) + len;
+
+	iface->read_size = len;
+	iface->rx_offsetpos += sizeof(cli_rechdr) + len;
+	iface->rx_count++;
+	iface->rx_size += len;
+}
+
+/**
+ * Mode a record of iface is shown in.  What rxmode zlib could not inflate is
+ * shown as it came, in hex.
+ */
+cli_if_mode cli_rx_mode(cli_if *iface, unsigned char flags)
+{
+	return (flags & CLI_REC_RAW ? CLI_MODE_HEX : iface->rxmode);
+}
+
+/**
+ * Displays a freshly received record on asynchronous interfaces.
+ */
+void cli_rx_display(cli_ctx *ctx, cli_if *iface, char *buffer, unsigned int len,
+	unsigned char flags)
+{
 	if ((iface->flags & CLI_FLAG_ASYNC) && (buffer)) {
-		addch('\n');
-		cli_print_format_mode(iface->rxmode, buffer, iface->read_size);
-		refresh();
+		pthread_mutex_lock(&ctx->ui.mutex);
+		// the pager has the screen; the record is in the store for later
+		if (!ctx->ui.paging) {
+			// update interrupt counter since we are redrawing the screen
+			ctx->ui.irq++;
+			addch('\n');
+			cli_print_format_mode(cli_rx_mode(iface, flags), buffer, len);
+			refresh();
+		}
+		pthread_mutex_unlock(&ctx->ui.mutex);
 	}
-	
-	// update exchange line (if we have one selected and it applies to us)
-	i = ctx->ifsel;
+}
+
+/**
+ * Forwards a received record over the selected exchange line, if there is
+ * one and it applies to iface.  The record is relayed as is, straight out of
+ * its rx buffer.
+ */
+void cli_rx_forward(cli_ctx *ctx, cli_if *iface, char *buffer, unsigned int len)
+{
+	int i = ctx->ifsel;
+
 	if ((ctx->ifs[i] != NULL) && (ctx->ifs[i]->header == 'e')) {
 		cli_line *t = (cli_line *)ctx->ifs[i];
 
 		if (t->rx == iface) {
-			cli_if_tx(ctx, t->tx, buffer);
+			cli_if_send(ctx, t->tx, buffer, len);
 		}
 	}
 }
 
-void *cli_rx_interrupt(void *pvctx)
+/**
+ * Accounts for n records the capture files could not take.  Their buffers
+ * stay with the caller.
+ */
+static void cli_rx_lost(cli_if *iface, cli_rec *recs, unsigned int n)
+{
+	unsigned long bytes = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) { bytes += recs[i].len; }
+
+	__atomic_add_fetch(&iface->rx_dropped, n, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&iface->rx_dropped_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Appends n records to the interface's rx queue as a single commit: the
+ * records, each behind its header, are copied into the buffer store first
+ * and the offset entries (and, on udp interfaces, the source addresses) are
+ * only published after them, time and search index entries last, so readers
+ * never see an entry whose data is missing.  n must not exceed CLI_RX_BATCH.
+ * If the segment is due to roll over and cannot, or the files cannot take
+ * the records, they are counted as dropped.  May be called concurrently for
+ * different interfaces; iface->lock serializes the capture writers and
+ * ctx->ui.mutex is only taken when records are displayed.
+ */
+void cli_handle_rx_batch(cli_ctx *ctx, cli_if *iface, cli_rec *recs,
+	unsigned int n)
 {
-	cli_ctx *ctx = (cli_ctx *)pvctx;
+	unsigned int i, first;
+	uint64_t idx[CLI_RX_BATCH];
+	cli_rechdr hdrs[CLI_RX_BATCH];
+	struct iovec iov[2 * CLI_RX_BATCH];
+	struct sockaddr_in peers[CLI_RX_BATCH];
+	unsigned long now = 0, count, bytes, pos, size;
+	long ipos, dpos, ip, dp;
+	int ret;
+	cli_seg *seg;
+
+	if (n == 0) { return; }
+
+	pthread_mutex_lock(&iface->lock);
+
+	// a batch never straddles two segments
+	if ((cli_seg_rotate(iface, time(NULL)) == -1) ||
+		((seg = cli_seg_active(iface)) == NULL)) {
+		pthread_mutex_unlock(&iface->lock);
+		cli_rx_lost(iface, recs, n);
+		return;
+	}
+	first = iface->rx_count - seg->first;
+
+	// what the reservations below are undone to if the batch cannot be written
+	count = seg->count;
+	bytes = seg->bytes;
+	pos = iface->rx_offsetpos;
+	size = iface->rx_size;
+
+	for (i = 0; i < n; i++) {
+		cli_rx_reserve(iface, recs[i].len, &ip, &dp);
+		if (i == 0) {
+			ipos = ip;
+			dpos = dp;
+		}
+
+		if ((recs[i].ts == 0) && (now == 0)) { now = cli_cap_now(); }
+
+		memset(&hdrs[i], 0, sizeof(cli_rechdr));
+		hdrs[i].ts = (recs[i].ts != 0 ? recs[i].ts : now);
+		hdrs[i].len = recs[i].len;
+		hdrs[i].dir = recs[i].dir;
+		hdrs[i].flags = recs[i].flags;
+
+		idx[i] = dp;
+		iov[2 * i].iov_base = &hdrs[i];
+		iov[2 * i].iov_len = sizeof(cli_rechdr);
+		iov[2 * i + 1].iov_base = recs[i].data;
+		iov[2 * i + 1].iov_len = recs[i].len;
+		peers[i] = recs[i].peer;
+	}
+
+	// add to buffer file, then publish the offsets
+	ret = cli_store_writev(seg->buffer, dpos, iov, 2 * n);
+
+	if ((ret == 0) && (iface->type == CLI_TYPE_UDP)) {
+		ret = cli_store_write(seg->peer, first * sizeof(struct sockaddr_in),
+			peers, n * sizeof(struct sockaddr_in));
+	}
+
+	if (ret == 0) {
+		ret = cli_store_write(seg->offset, ipos, idx, n * sizeof(uint64_t));
+	}
+
+	if (ret == -1) {
+		seg->count = count;
+		seg->bytes = bytes;
+		iface->rx_offsetpos = pos;
+		iface->rx_count = seg->first + first;
+		iface->rx_size = size;
+		pthread_mutex_unlock(&iface->lock);
+		cli_rx_lost(iface, recs, n);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		cli_seg_index(seg, seg->first + first + i, hdrs[i].ts);
+	}
+
+	if (iface->index == CLI_INDEX_BLOOM) {
+		cli_bloom_batch(iface, seg, seg->first + first, recs, n);
+	}
+
+	// perform interface specific actions
+	for (i = 0; i < n; i++) {
+		cli_rx_display(ctx, iface, recs[i].data, recs[i].len, recs[i].flags);
+	}
+	pthread_mutex_unlock(&iface->lock);
 	
-	int fdmax;
-	int i, ret;
+	// update exchange line (if we have one selected and it applies to us)
+	for (i = 0; i < n; i++) {
+		cli_rx_forward(ctx, iface, recs[i].data, recs[i].len);
+	}
+}
 
-	fd_set rxset;
-	static char rx_buffer[CLI_MAX_BUFFER];
-	struct timeval t;
+/**
+ * Appends len bytes from buffer to the interface's rx queue as one record.
+ */
+void cli_handle_rx(cli_ctx *ctx, cli_if *iface, char *buffer, unsigned int len)
+{
+	cli_rec rec;
 
-	while (ctx->state == CLI_NORMAL) {
-		fdmax = 0;
-		FD_ZERO(&rxset);
-
-		memset(&t, 0, sizeof(struct timeval));
-
-		// aquire mutex
-		pthread_mutex_lock(&ctx->mutex);
-		for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
-			if ((ctx->ifs[i] != NULL) && (ctx->ifs[i]->type & CLI_FD_TYPES) &&
-				(ctx->ifs[i]->active != 0)) {
-				FD_SET(ctx->ifs[i]->rxdev.fd, &rxset);
-				if (ctx->ifs[i]->rxdev.fd > fdmax) {
-					fdmax = ctx->ifs[i]->rxdev.fd;
+	memset(&rec, 0, sizeof(cli_rec));
+	rec.data = buffer;
+	rec.len = len;
+
+	cli_handle_rx_batch(ctx, iface, &rec, 1);
+}
+
+/**
+ * Drains up to iface->rx_batch datagrams from a udp interface with a single
+ * recvmmsg and queues them for the capture writer, which commits them
+ * together.  Each slot receives straight into a pool buffer that is handed
+ * off with its record; slots left unfilled keep theirs for the next call.
+ * Slots the overload policy could not give a buffer receive into the
+ * reactor's discard area and are counted as dropped.  Returns what recvmmsg
+ * returned.
+ */
+int cli_rx_udp(cli_reactor *r, cli_if *iface)
+{
+	unsigned int i, n = iface->rx_batch;
+	int ret, lossy = 0;
+
+	if ((n == 0) || (n > CLI_RX_BATCH)) { n = CLI_RX_BATCH; }
+
+	for (i = 0; i < n; i++) {
+		if (r->recs[i].buf == NULL) {
+			r->recs[i].buf = cli_reactor_buf(r, iface);
+			r->recs[i].data = (r->recs[i].buf != NULL ?
+				r->recs[i].buf->data : r->discard);
+			r->iov[i].iov_base = r->recs[i].data;
+		}
+		if (r->recs[i].buf == NULL) { lossy = 1; }
+
+		r->iov[i].iov_len = iface->buffer_size;
+		r->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	}
+
+	ret = recvmmsg(iface->rxdev.fd, r->msgs, n, MSG_DONTWAIT, NULL);
+
+	if (ret > 0) {
+		for (i = 0; i < ret; i++) {
+			r->recs[i].len = r->msgs[i].msg_len;
+			r->recs[i].flags = CLI_REC_PEER;
+			if (r->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				r->recs[i].flags |= CLI_REC_TRUNC;
+			}
+		}
+
+		if (!lossy) {
+			cli_rx_push(r->ctx, iface, r->recs, ret);
+		} else {
+			for (i = 0; i < ret; i++) {
+				if (r->recs[i].buf != NULL) {
+					cli_rx_push(r->ctx, iface, &r->recs[i], 1);
+				} else {
+					cli_rx_drop(iface, &r->recs[i]);
 				}
 			}
 		}
-		// release mutex
-		pthread_mutex_unlock(&ctx->mutex);
 
-		ret = select(fdmax + 1, &rxset, NULL, NULL, &t);
+		// the writer owns those buffers now
+		for (i = 0; i < ret; i++) {
+			r->recs[i].buf = NULL;
+			r->recs[i].ts = 0;
+		}
+	}
+
+	return ret;
+}
 
-		if (ret == -1) {
-			perror("cli_rx_interrupt: ");
-		} else if (ret) {
-			for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
-				if ((ctx->ifs[i] != NULL) &&
-					(ctx->ifs[i]->type & CLI_FD_TYPES) &&
-					(ctx->ifs[i]->active != 0) &&
-					(FD_ISSET(ctx->ifs[i]->rxdev.fd, &rxset))) {
+/**
+ * rx thread body; one runs per reactor and only services the interfaces that
+ * were sharded onto it, reading into buffers from the reactor's pool and
+ * handing records to the capture writer.
+ */
+void *cli_rx_interrupt(void *pvr)
+{
+	cli_reactor *r = (cli_reactor *)pvr;
+	cli_ctx *ctx = r->ctx;
+	cli_if *iface;
+	cli_rec rec;
+	
+	int i, n, ret;
+
+	struct epoll_event ev[CLI_REACTOR_EVENTS];
+
+	while (ctx->state == CLI_NORMAL) {
+		// sleep until an interface is readable or the loop is woken up
+		n = epoll_wait(r->epfd, ev, CLI_REACTOR_EVENTS, -1);
+
+		if (n == -1) {
+			if (errno != EINTR) { perror("cli_rx_interrupt: "); }
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (ev[i].data.u32 == CLI_REACTOR_WAKE) {
+				cli_reactor_drain(r);
+				continue;
+			}
+
+			pthread_rwlock_rdlock(&ctx->iflock);
+
+			// the interface may have been closed or freed since epoll_wait
+			// harvested the event
+			iface = ctx->ifs[ev[i].data.u32];
+			if ((iface != NULL) && (iface->header == 'i') &&
+				(iface->rxreg) && (iface->shard == r->id)) {
+				if (iface->type == CLI_TYPE_UDP) {
+					// datagrams are drained in batches
+					ret = cli_rx_udp(r, iface);
+				} else {
 					// read the socket
-					ret = read(ctx->ifs[i]->rxdev.fd, rx_buffer,
-						ctx->ifs[i]->buffer_size);
-
-					if (ret > 0) {
-						pthread_mutex_lock(&ctx->ui.mutex);
-						pthread_mutex_lock(&ctx->mutex);
-
-						// update interrupt counter only if we are planning to redraw
-						// the screen
-						if (ctx->ifs[i]->flags & CLI_FLAG_ASYNC) { ctx->ui.irq++; }
-						
-						// handle rx
-						ctx->ifs[i]->read_size = ret;
-						cli_handle_rx(ctx, ctx->ifs[i], rx_buffer);
-						
-						pthread_mutex_unlock(&ctx->mutex);
-						pthread_mutex_unlock(&ctx->ui.mutex);
+					memset(&rec, 0, sizeof(cli_rec));
+					rec.buf = cli_reactor_buf(r, iface);
+					rec.data = (rec.buf != NULL ? rec.buf->data : r->discard);
+					ret = read(iface->rxdev.fd, rec.data, iface->buffer_size);
+
+					if ((ret > 0) && (rec.buf != NULL)) {
+						rec.len = ret;
+						cli_rx_push(ctx, iface, &rec, 1);
+					} else if (ret > 0) {
+						rec.len = ret;
+						cli_rx_drop(iface, &rec);
+					} else {
+						cli_buf_unref(rec.buf);
 					}
 				}
+
+				if ((ret <= 0) &&
+					(((ret == 0) && (iface->type == CLI_TYPE_TCP)) ||
+					((ret == -1) && (errno != EAGAIN) && (errno != EINTR)) ||
+					(ev[i].events & (EPOLLHUP | EPOLLERR)))) {
+					// peer went away, stop watching until reconnected
+					iface->active = 0;
+					cli_reactor_update(ctx, iface);
+				}
 			}
+
+			pthread_rwlock_unlock(&ctx->iflock);
 		}
 	}
 
@@ -403,8 +685,8 @@ void cli_cmd_cd(cli_ctx *ctx)
 
 void cli_rx_modify(cli_if *iface, int newrx)
 {
-	if (newrx < 0) {
-		newrx = 0;
+	if (newrx < (int)iface->rx_first) {
+		newrx = iface->rx_first;
 	} else if (newrx > iface->rx_count) {
 		newrx = iface->rx_count;
 	}
@@ -413,6 +695,113 @@ void cli_rx_modify(cli_if *iface, int newrx)
 	iface->rx = newrx;
 }
 
+/**
+ * Prints a stored record of iface: its direction, source and data.
+ */
+void cli_rx_show(cli_if *iface, cli_rechdr *rh, struct sockaddr_in *peer,
+	char *buffer, unsigned int len)
+{
+	char addr[INET_ADDRSTRLEN];
+
+	if (rh->dir == CLI_DIR_TX) { printw("[tx] "); }
+
+	if (peer->sin_family == AF_INET) {
+		inet_ntop(AF_INET, &peer->sin_addr, addr, INET_ADDRSTRLEN);
+		printw("[%s:%d] ", addr, ntohs(peer->sin_port));
+	}
+
+	// print in formatted mode
+	cli_print_format_mode(cli_rx_mode(iface, rh->flags), buffer, len);
+	addch('\n');
+}
+
+/**
+ * Prints records a..b of iface (see cli_cap_parse_range), numbered, and moves
+ * the rx pointer past them.  Records are read a run at a time, straight from
+ * the segment files.
+ */
+void cli_rx_range(cli_ctx *ctx, cli_if *iface, const char *arg)
+{
+	cli_seg *seg = NULL;
+	cli_rechdr rh;
+	struct sockaddr_in peer;
+	unsigned int from, to, rec, shown = 0;
+	unsigned long len, pos;
+	char *run;
+	int i, n;
+
+	if (cli_cap_parse_range(iface, arg, &from, &to) == -1) {
+		printw("Error: `rx a..b' takes record numbers, ^, $ or @time (rx 10..$,\n");
+		printw("       rx @-5min..$).\n");
+		return;
+	}
+
+	if ((run = (char *)malloc(CLI_BLOCK_MAX)) == NULL) {
+		cli_print_error("rx");
+		return;
+	}
+
+	for (rec = from; rec < to; ) {
+		if ((seg = cli_seg_walk(iface, seg, rec)) == NULL) {
+			rec++;
+			continue;
+		}
+
+		if ((n = cli_seg_run(seg, rec, to - rec, run, CLI_BLOCK_MAX, &len)) < 0) {
+			// version 1 segments are read a record at a time
+			if ((n = cli_seg_copy(seg, rec, run, CLI_MAX_BUFFER, &rh, &peer)) >= 0) {
+				printw("%u ", rec);
+				cli_rx_show(iface, &rh, &peer, run, n);
+				shown++;
+			}
+			rec++;
+			continue;
+		}
+
+		for (i = 0, pos = 0; i < n; i++, rec++) {
+			memcpy(&rh, run + pos, sizeof(cli_rechdr));
+			cli_seg_peer(seg, rec, &rh, &peer);
+			printw("%u ", rec);
+			cli_rx_show(iface, &rh, &peer, run + pos + sizeof(cli_rechdr), rh.len);
+			pos += sizeof(cli_rechdr) + rh.len;
+			shown++;
+		}
+	}
+
+	cli_seg_drop(seg);
+	cli_seg_put(seg);
+	free(run);
+
+	// records retention has removed are not counted
+	printw("  %u record(s)\n", shown);
+	refresh();
+
+	cli_rx_modify(iface, to);
+}
+
+/**
+ * rx view [a..b]: pages through the current record of iface, or records a..b
+ * taken as one stream, as a hex dump.
+ */
+void cli_rx_view(cli_ctx *ctx, cli_if *iface, const char *arg)
+{
+	unsigned int from = iface->rx, to = iface->rx + 1;
+
+	while (*arg == ' ') { arg++; }
+
+	if ((*arg != 0) && (cli_cap_parse_range(iface, arg, &from, &to) == -1)) {
+		printw("Error: `rx view' takes a range of records as `rx a..b' does.\n");
+		return;
+	}
+	if (to > iface->rx_count) { to = iface->rx_count; }
+	if (from >= to) {
+		printw("Error: Nothing to read!\n");
+		return;
+	}
+
+	cli_view_run(ctx, iface, from, to);
+}
+
 /**
  * Outputs msg at current pointer location and then shifts pointer accordingly.
  */
@@ -420,10 +809,15 @@ void cli_cmd_rx(cli_ctx *ctx)
 {
 	int pos = 2;
 	int x;
-	unsigned int start = 0, size;
+	unsigned int size;
 	cli_if *iface = ctx->ifs[ctx->ifsel];
 
-	static char rx_buffer[CLI_MAX_BUFFER];
+	char *rx_buffer;
+	cli_buf *buf;
+	struct sockaddr_in peer;
+	cli_rechdr rh;
+	unsigned long ts, bytes, skipped, usec;
+	long hit = -1;
 	
 	if (iface != NULL) {
 		if ((iface->header == 't') ||
@@ -432,10 +826,16 @@ void cli_cmd_rx(cli_ctx *ctx)
 		}
 
 		if (ctx->buffer[pos] == '?') {
-			printw("  %d / %d  %d byte(s)\n",
+			printw("  %u / %u  %lu byte(s)",
 				iface->rx,
 				iface->rx_count,
 				iface->rx_size);
+			if ((cli_seg_read(iface, iface->rx, NULL, 0, &rh, NULL) >= 0) &&
+				(rh.ts != 0)) {
+				printw("  @ ");
+				cli_print_time(rh.ts);
+			}
+			printw("\n");
 		} else if (iface->rx_count > 0) {
 			/** try to read an argument:
 				rx     = move to next entry
@@ -445,33 +845,112 @@ void cli_cmd_rx(cli_ctx *ctx)
 				rx +x  = move x queue entries forward
 				rx $   = move to last queue entry
 				rx ^   = move to first queue entry
+				rx @t  = move to the first entry received at time t or later
+				rx @-d = move to the first entry of the last duration d
+				rx a..b = show entries a to b (numbers, ^, $ or @t) and move
+				          past them
+				rx view [a..b] = page through the current entry (or entries a
+				          to b) as a hex dump
+				rx /text/   = move to the next entry holding text
+				rx x/hex/   = move to the next entry holding the bytes
+				rx n   = move to the next entry the last search found
+				rx N   = move to the previous entry the last search found
 			 */
 			while ((ctx->buffer[pos]) && (ctx->buffer[pos] == ' ')) { pos++; }
 
-			if ((ctx->buffer[pos] != '>') && (iface->rx < iface->rx_count)) {
+			// retention may have removed the records we were looking at
+			if (iface->rx < iface->rx_first) { iface->rx = iface->rx_first; }
+
+			if (strncmp(ctx->buffer + pos, "view", 4) == 0) {
+				cli_rx_view(ctx, iface, ctx->buffer + pos + 4);
+				return;
+			}
+
+			if (strstr(ctx->buffer + pos, "..") != NULL) {
+				cli_rx_range(ctx, iface, ctx->buffer + pos);
+				return;
+			}
+
+			if (ctx->buffer[pos] == '@') {
+				if ((ts = cli_cap_parse_time(ctx->buffer + pos + 1)) == 0) {
+					printw("Error: `rx @' takes a time (14:03:12, 2026-10-18 14:03:12)\n");
+					printw("       or a duration back from now (-5min, -90s, -1h30min).\n");
+				} else {
+					cli_rx_modify(iface, cli_seg_seek(iface, ts));
+					printw("  %u / %u", iface->rx, iface->rx_count);
+					if ((cli_seg_read(iface, iface->rx, NULL, 0, &rh, NULL) >= 0) &&
+						(rh.ts != 0)) {
+						printw("  @ ");
+						cli_print_time(rh.ts);
+					}
+					printw("\n");
+				}
+				return;
+			}
+
+			if ((ctx->buffer[pos] == '/') ||
+				((ctx->buffer[pos] == 'x') && (ctx->buffer[pos + 1] == '/'))) {
+				if ((x = cli_search(iface, ctx->buffer + pos, &bytes, &skipped,
+					&usec)) < 0) {
+					printw("Error: `rx /' takes text (rx /GET \\/index/) or bytes in\n");
+					printw("       hex (rx x/de ad be ef/) to search for.\n");
+					return;
+				}
+				printw("  %d hit(s) in %lu byte(s), %lu.%03lus", x, bytes,
+					usec / 1000000, (usec / 1000) % 1000);
+				if (skipped > 0) { printw("  %lu byte(s) ruled out by index", skipped); }
+				printw("\n");
+				if (x == 0) { return; }
+
+				// from where we are, or over again from the start
+				if ((hit = cli_search_move(iface, iface->rx, 1)) < 0) {
+					hit = cli_search_move(iface, 0, 1);
+				}
+			} else if ((ctx->buffer[pos] == 'n') || (ctx->buffer[pos] == 'N')) {
+				if (iface->nhits == 0) {
+					printw("Error: Nothing found, search with `rx /text/' first.\n");
+					return;
+				}
+				hit = (ctx->buffer[pos] == 'n' ?
+					cli_search_move(iface, iface->hits[iface->hit] + 1, 1) :
+					cli_search_move(iface, iface->hits[iface->hit], -1));
+				if (hit < 0) {
+					printw("Error: No %s hit.\n",
+						(ctx->buffer[pos] == 'n' ? "further" : "earlier"));
+					return;
+				}
+			}
+
+			if (hit >= 0) {
+				// shown (and moved past) like any other entry
+				cli_rx_modify(iface, hit);
+				printw("  hit %u / %u  %u / %u\n", iface->hit + 1, iface->nhits,
+					iface->rx, iface->rx_count);
+				pos += strlen(ctx->buffer + pos);
+			}
+
+			if ((ctx->buffer[pos] != '>') && (iface->rx < iface->rx_count) &&
+				((buf = cli_buf_alloc(&ctx->pool)) != NULL)) {
+				rx_buffer = buf->data;
 				memset(rx_buffer, 0, CLI_MAX_BUFFER);
 				// if rx is specified with a '>' character, we just move the
 				// rx pointer and do not read anything
 
-				// get the offset
-				if (iface->rx != 0) {
-					fseek(iface->offset,
-						sizeof(cli_if) + (iface->rx * sizeof(unsigned int)),
-						SEEK_SET);
-				} else {
-					fseek(iface->offset, sizeof(cli_if), SEEK_SET);
+				// find the record in whichever segment holds it; the
+				// capture writer may still be publishing it, in which case
+				// there is nothing yet
+				x = cli_seg_read(iface, iface->rx, rx_buffer, CLI_MAX_BUFFER,
+					&rh, &peer);
+				size = (x > 0 ? x : 0);
+				if (x < 0) {
+					memset(&rh, 0, sizeof(cli_rechdr));
+					memset(&peer, 0, sizeof(struct sockaddr_in));
 				}
-				fread(&start, 1, sizeof(unsigned int), iface->offset);
-				fread(&size, 1, sizeof(unsigned int), iface->offset);
-				
-				// move in and read
-				fseek(iface->buffer, start, SEEK_SET);
-				size = fread(rx_buffer, 1, size - start, iface->buffer);
-				
-				// print in formatted mode
-				cli_print_format_mode(iface->rxmode, rx_buffer, size);
-				addch('\n');
+
+				cli_rx_show(iface, &rh, &peer, rx_buffer, size);
 				refresh();
+
+				cli_buf_unref(buf);
 			} else if (ctx->buffer[pos] == '>') { pos++; }
 			
 
@@ -490,7 +969,7 @@ void cli_cmd_rx(cli_ctx *ctx)
 				cli_rx_modify(iface, iface->rx + x);
 				break;
 			case '$': iface->rx = iface->rx_count; break;
-			case '^': iface->rx = 0; break;
+			case '^': iface->rx = iface->rx_first; break;
 			default:
 				cli_rx_modify(iface, iface->rx + 1);
 				break;
@@ -504,23 +983,51 @@ void cli_cmd_rx(cli_ctx *ctx)
 void cli_cmd_tx(cli_ctx *ctx)
 {
 	cli_if *iface = ctx->ifs[ctx->ifsel];
+	cli_line *t = NULL;
 	int ret = 0;
 
 	if (iface != NULL) {
 		if ((iface->header == 't') ||
 			(iface->header == 'e')) {
-			iface = ((cli_line *)iface)->tx;
+			t = (cli_line *)iface;
+			iface = t->tx;
 		}
 
 		ret = cli_if_tx(ctx, iface, ctx->cmd);
 		
-		if (iface->header == 't') {
-			ctx->ifs[i]->read_size = ret;
-			cli_handle_rx(ctx, iface, ctx->cmd);
+		// tie lines also queue what was sent on the rx side
+		if ((t != NULL) && (t->header == 't')) {
+			cli_handle_rx(ctx, t->rx, ctx->cmd, ret);
 		}
 	}
 }
 
+/**
+ * tx<file streams a file of any size out of the selected interface; it is
+ * never loaded into ctx->cmd.
+ */
+void cli_cmd_tx_file(cli_ctx *ctx)
+{
+	char tmp[CLI_DEFAULT_BUFFER];
+	cli_if *iface = ctx->ifs[ctx->ifsel];
+	cli_line *t = NULL;
+
+	if (iface == NULL) { return; }
+	if ((iface->header == 't') || (iface->header == 'e')) {
+		t = (cli_line *)iface;
+		iface = t->tx;
+	}
+
+	memset(tmp, 0, CLI_DEFAULT_BUFFER);
+	if (sscanf(ctx->buffer + 3, " %255s", tmp) < 1) {
+		printw("Error: `tx<' must specify a file (tx<firmware.bin).\n");
+		return;
+	}
+
+	cli_send_file(ctx, iface, ((t != NULL) && (t->header == 't') ? t->rx : NULL),
+		tmp);
+}
+
 int cli_strlen(const char *buffer, int cursize)
 {
 	int i;
@@ -531,10 +1038,52 @@ int cli_strlen(const char *buffer, int cursize)
 	return i;
 }
 
+/**
+ * Puts len bytes on the wire (or into the file) of iface as they are.
+ */
+int cli_if_send(cli_ctx *ctx, cli_if *iface, char *buffer, int len)
+{
+	char *out;
+	cli_rec rec;
+
+	switch (iface->type) {
+	case CLI_TYPE_FILE:
+		// for files, rxmode is preserved when writing (as opposed to just
+		// being used to decipher the user input), unless they are raw; the
+		// whole tx is encoded first and written at once
+		if (iface->flags & CLI_FLAG_RAW) {
+			fwrite(buffer, 1, len, iface->rxdev.fp);
+		} else if (len > 0) {
+			if ((out = (char *)malloc((size_t)len * CLI_FMT_MAX)) == NULL) {
+				return -1;
+			}
+			fwrite(out, 1, cli_fmt_bytes(iface->rxmode,
+				(const unsigned char *)buffer, len, out), iface->rxdev.fp);
+			free(out);
+		}
+
+		fflush(iface->rxdev.fp);
+		// queue what was written immediately, as sent
+		memset(&rec, 0, sizeof(cli_rec));
+		rec.data = buffer;
+		rec.len = len;
+		rec.dir = CLI_DIR_TX;
+		cli_handle_rx_batch(ctx, iface, &rec, 1);
+		break;
+	case CLI_TYPE_TCP:
+	case CLI_TYPE_UDP:
+	case CLI_TYPE_SERIAL: 
+		len = write(iface->rxdev.fd, buffer, len);
+		break;
+	default:
+		break;
+	}
+
+	return len;
+}
+
 int cli_if_tx(cli_ctx *ctx, cli_if *iface, char *buffer)
 {
-	char *tmp;
-	int s, i;
 	int trunc = iface->buffer_size;
 
 	if (iface->header == 'i') {
@@ -553,28 +1102,7 @@ int cli_if_tx(cli_ctx *ctx, cli_if *iface, char *buffer)
 			trunc++;
 		}
 
-		switch (iface->type) {
-		case CLI_TYPE_FILE:
-			// for files, txmode is preserved when writing (as opposed to just
-			// being used to decipher the user input)
-			for (i = 0; i < trunc; i++) {
-				tmp = cli_format(iface->rxmode, buffer[i], &s);
-				fwrite(tmp, 1, s, iface->rxdev.fp);
-			}
-
-			fflush(iface->rxdev.fp);
-			// add to rx queue records immediately
-			iface->read_size = trunc;
-			cli_handle_rx(ctx, iface, buffer);
-			break;
-		case CLI_TYPE_TCP:
-		case CLI_TYPE_UDP:
-		case CLI_TYPE_SERIAL: 
-			write(iface->rxdev.fd, buffer, trunc);
-			break;
-		default:
-			break;
-		}
+		cli_if_send(ctx, iface, buffer, trunc);
 	} else {
 			
 	}
@@ -582,6 +1110,108 @@ int cli_if_tx(cli_ctx *ctx, cli_if *iface, char *buffer)
 	return trunc;
 }
 
+void cli_print_if(cli_if *iface)
+{
+	cli_durable d;
+	cli_zstat zs;
+	cli_seg **segs;
+	unsigned int i, n, packed = 0;
+	unsigned long disk = 0, raw = 0, z = 0, index = 0, filters = 0, ns, bytes;
+
+	if ((iface == NULL) || (iface->header != 'i')) { return; }
+
+	printw("  type: ");
+	cli_print_typel(iface->type);
+	printw("  rxmode: ");
+	cli_print_model(iface->rxmode);
+	printw("  txmode: ");
+	cli_print_model(iface->txmode);
+	printw("\n");
+
+	printw("  rx: %u record(s)  %lu byte(s)  %u queued\n",
+		iface->rx_count, iface->rx_size,
+		(iface->rxq != NULL ? cli_ring_avail(iface->rxq) : 0));
+	printw("  overload: ");
+	cli_print_overload(iface->overload);
+	printw("  dropped: %lu record(s)  %lu byte(s)\n",
+		__atomic_load_n(&iface->rx_dropped, __ATOMIC_RELAXED),
+		__atomic_load_n(&iface->rx_dropped_bytes, __ATOMIC_RELAXED));
+
+	segs = cli_seg_snapshot(iface, &n);
+	for (i = 0; i < n; i++) {
+		disk += cli_seg_size(segs[i]);
+		if (segs[i]->bloom != NULL) {
+			index += cli_store_size(segs[i]->bloom);
+			filters += cli_store_size(segs[i]->bloom) /
+				(sizeof(cli_bloomhdr) + (CLI_BLOOM_BITS / 8));
+		}
+		if (segs[i]->packed) {
+			packed++;
+			raw += segs[i]->bytes;
+			z += cli_store_size(segs[i]->zdata) + cli_store_size(segs[i]->block);
+		}
+	}
+	printw("  segments: %u  records %u..%u  %lu byte(s) on disk\n",
+		n, iface->rx_first, iface->rx_count, disk);
+	cli_seg_release(segs, n);
+
+	printw("  rotate: ");
+	cli_print_limits(iface->rotate_bytes, iface->rotate_secs);
+	printw("  retain: ");
+	cli_print_limits(iface->retain_bytes, iface->retain_secs);
+	printw("\n");
+
+	printw("  compress: ");
+	if (iface->compress == 0) { printw("none"); }
+	else { printw("zlib:%u", iface->compress); }
+	if (packed > 0) {
+		printw("  %u segment(s) %lu -> %lu byte(s)  %lu.%lux", packed, raw, z,
+			raw / z, (raw * 10 / z) % 10);
+	}
+	printw("\n");
+
+	if ((iface->rxmode == CLI_MODE_Z) || (iface->zin != NULL)) {
+		zs.in = __atomic_load_n(&iface->zstat.in, __ATOMIC_RELAXED);
+		zs.out = __atomic_load_n(&iface->zstat.out, __ATOMIC_RELAXED);
+		zs.nsec = __atomic_load_n(&iface->zstat.nsec, __ATOMIC_RELAXED);
+		printw("  inflate: %lu -> %lu byte(s)", zs.in, zs.out);
+		if (zs.in > 0) {
+			printw("  %lu.%lux", zs.out / zs.in, (zs.out * 10 / zs.in) % 10);
+		}
+		if (zs.nsec > 0) {
+			printw("  %lu MB/s", (zs.out * 1000) / zs.nsec);
+		}
+		printw("  %u stream(s)  %u error(s)\n",
+			__atomic_load_n(&iface->zstat.streams, __ATOMIC_RELAXED),
+			__atomic_load_n(&iface->zstat.errors, __ATOMIC_RELAXED));
+	}
+
+	printw("  index: %s", (iface->index == CLI_INDEX_BLOOM ? "bloom" : "none"));
+	if (filters > 0) {
+		printw("  %lu filter(s)  %lu byte(s)", filters, index);
+		if (iface->rx_size > 0) {
+			printw("  %lu.%lu%% of data", (index * 100) / iface->rx_size,
+				((index * 1000) / iface->rx_size) % 10);
+		}
+	}
+	ns = __atomic_load_n(&iface->index_nsec, __ATOMIC_RELAXED);
+	bytes = __atomic_load_n(&iface->index_bytes, __ATOMIC_RELAXED);
+	if (bytes > 0) {
+		printw("  build %lums  %luns/KB", ns / 1000000, ns / ((bytes + 1023) / 1024));
+	}
+	printw("\n");
+
+	d = iface->durable;
+	printw("  durability: ");
+	cli_print_durable(&d);
+	printw("  synced: %u / %u record(s)\n", d.synced, iface->rx_count);
+	if (d.commits > 0) {
+		printw("  commits: %lu  batch avg %lu max %lu  latency avg %luus max %luus\n",
+			d.commits, d.batch_total / d.commits, d.batch_max,
+			d.usec_total / d.commits, d.usec_max);
+	}
+}
+
 void cli_cmd_if(cli_ctx *ctx)
 {
 	int pos = 2;
@@ -595,7 +1225,7 @@ void cli_cmd_if(cli_ctx *ctx)
 		}
 	} else {
 		printw("Interface %d status\n", ctx->ifsel);
-		// show interface stats
+		cli_print_if(ctx->ifs[ctx->ifsel]);
 	}
 }
 
@@ -612,7 +1242,10 @@ void cli_cmd_ip_connect(cli_ctx *ctx)
 			cli_print_error("cli_connect");
 		} else {
 			printw("Connected to attached socket.\n");
+			pthread_rwlock_wrlock(&ctx->iflock);
 			iface->active = 1;
+			cli_reactor_update(ctx, iface);
+			pthread_rwlock_unlock(&ctx->iflock);
 		}
 	}
 }
@@ -622,10 +1255,16 @@ void cli_cmd_ip_close(cli_ctx *ctx)
 	cli_if *iface = ctx->ifs[ctx->ifsel];
 
 	if (iface != NULL) {
+		pthread_rwlock_wrlock(&ctx->iflock);
+		pthread_mutex_lock(&iface->txlock);
+		cli_reactor_remove(ctx, iface);
 		if (close(iface->rxdev.fd) == -1) {
 			cli_print_error("cli_close");
 		}
 		iface->active = 0;
+		iface->rxopen = 0;
+		pthread_mutex_unlock(&iface->txlock);
+		pthread_rwlock_unlock(&ctx->iflock);
 	}
 }
 
@@ -650,6 +1289,7 @@ void cli_ctx_init(cli_ctx *ctx)
 	for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
 		ctx->ifs[i] = NULL;
 	}
+	memset(&ctx->replay, 0, sizeof(cli_replay));
 
 	ctx->uid = geteuid();
 	ctx->pw = getpwuid(ctx->uid);
@@ -679,8 +1319,18 @@ void cli_ctx_init(cli_ctx *ctx)
 	ctx->context = fopen(tmp, "wb");
 
 	// create threads
-	pthread_mutex_init(&ctx->mutex, NULL);
-	pthread_create(&ctx->thread, NULL, cli_rx_interrupt, (void *)ctx);
+	pthread_rwlock_init(&ctx->iflock, NULL);
+	pthread_mutex_init(&ctx->mflock, NULL);
+	cli_pool_init(&ctx->pool, "cli", CLI_POOL_MAX);
+	if (cli_flusher_start(ctx) == -1) {
+		cli_print_error("cli_flusher_start");
+	}
+	if (cli_writer_start(ctx) == -1) {
+		cli_print_error("cli_writer_start");
+	}
+	if (cli_reactor_start(ctx) == -1) {
+		cli_print_error("cli_reactor_start");
+	}
 	
 	cli_cmd_add(ctx);
 	ctx->ifsel = 0;
@@ -691,12 +1341,50 @@ void cli_ctx_init(cli_ctx *ctx)
 	cli_write_ctx(ctx);
 }
 
+/**
+ * Rewrites the session manifest from the interfaces there are.  The flusher
+ * rewrites it too, so whichever snapshot is taken last is written last.
+ */
+void cli_write_manifest(cli_ctx *ctx)
+{
+	cli_manifestent ents[CLI_DEFAULT_BUFFER];
+	char tmp[CLI_DEFAULT_BUFFER];
+	unsigned int n;
+
+	if (snprintf(tmp, CLI_DEFAULT_BUFFER, "%s/%08x", ctx->pwd, ctx->pid) >=
+		CLI_DEFAULT_BUFFER) {
+		return;
+	}
+
+	pthread_rwlock_rdlock(&ctx->iflock);
+	pthread_mutex_lock(&ctx->mflock);
+	n = cli_cap_manifest(ctx->ifs, CLI_DEFAULT_BUFFER, ents);
+	cli_cap_write_manifest(tmp, ents, n);
+	pthread_mutex_unlock(&ctx->mflock);
+	pthread_rwlock_unlock(&ctx->iflock);
+}
+
 void cli_write_ctx(cli_ctx *ctx)
 {
 	fseek(ctx->context, 0, SEEK_SET);
 	fwrite(ctx, 1, sizeof(ctx), ctx->context);
 }
 
+/**
+ * Rewrites the interface header file.
+ */
+void cli_write_if(cli_if *iface)
+{
+	cli_ifhdr hdr;
+
+	if ((iface == NULL) || (iface->header != 'i')) { return; }
+
+	pthread_mutex_lock(&iface->lock);
+	cli_cap_ifhdr(iface, &hdr);
+	cli_store_write(iface->offset, 0, &hdr, sizeof(cli_ifhdr));
+	pthread_mutex_unlock(&iface->lock);
+}
+
 void cli_cmd_history(cli_ctx *ctx)
 {
 	printw("histfile: %s/history\n", ctx->pwd);
@@ -720,6 +1408,7 @@ void cli_cmd_ls(cli_ctx *ctx)
 				printw(" m:");
 				cli_print_mode(ctx->ifs[i]->rxmode);
 				cli_print_mode(ctx->ifs[i]->txmode);
+				printw(" d:%lu", ctx->ifs[i]->rx_dropped);
 				switch (ctx->ifs[i]->type) {
 				case CLI_TYPE_TCP:
 				case CLI_TYPE_UDP:
@@ -753,8 +1442,22 @@ void cli_cmd_ls(cli_ctx *ctx)
 	printw("\n");
 }
 
+/**
+ * Prints the occupancy of a buffer pool; fails counts allocations that found
+ * the pool at its limit.
+ */
+static void cli_print_pool(cli_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	printw("    %-4s %u/%u in use (%u max)  hwm %u  allocs %lu  fails %lu\n",
+		pool->name, pool->inuse, pool->total, pool->max, pool->hwm,
+		pool->allocs, pool->fails);
+	pthread_mutex_unlock(&pool->lock);
+}
+
 void cli_cmd_session(cli_ctx *ctx)
 {
+	int i;
 /*
 	struct dirent *dp;
 	DIR *dir = opendir(ctx->pwd);
@@ -785,45 +1488,86 @@ void cli_cmd_session(cli_ctx *ctx)
 	closedir(dir);
 */
 	printw("  sessionid: 0x%08x\n", ctx->pid);
+	printw("  rx threads: %d", ctx->nreactors);
+	for (i = 0; i < ctx->nreactors; i++) {
+		printw(" %s",
+			(ctx->reactor[i].engine == CLI_ENGINE_URING ? "uring" : "epoll"));
+	}
+	printw("\n");
+
+	printw("  buffer pools:\n");
+	for (i = 0; i < ctx->nreactors; i++) {
+		cli_print_pool(&ctx->reactor[i].pool);
+	}
+	cli_print_pool(&ctx->pool);
 }
 
 void cli_ctx_free_ifaces(cli_ctx *ctx)
 {
 	int i;
 	
+	// the replay thread sends from and to these, and its counts refer to them
+	cli_replay_stop(ctx);
+	memset(&ctx->replay, 0, sizeof(cli_replay));
+
+	pthread_rwlock_wrlock(&ctx->iflock);
 	for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
 		if (ctx->ifs[i] != NULL) {
 			if (ctx->ifs[i]->header == 'i') {
 				ctx->ifs[i]->active = 0;
-				fclose(ctx->ifs[i]->offset);
-				fclose(ctx->ifs[i]->buffer);
+				cli_reactor_remove(ctx, ctx->ifs[i]);
+				cli_store_close(ctx->ifs[i]->offset);
+				cli_seg_free_all(ctx->ifs[i]);
 
 				if (ctx->ifs[i]->rxopen) {
 					switch (ctx->ifs[i]->type) {
 					case CLI_TYPE_FILE:
 						fclose(ctx->ifs[i]->rxdev.fp);
 						break;
+					case CLI_TYPE_TCP:
+					case CLI_TYPE_UDP:
+						close(ctx->ifs[i]->rxdev.fd);
+						break;
 					default: break;
 					}
 				}
+
+				pthread_mutex_destroy(&ctx->ifs[i]->lock);
+				pthread_mutex_destroy(&ctx->ifs[i]->txlock);
+				cli_ring_free(ctx->ifs[i]->rxq);
+				cli_inflate_free(ctx->ifs[i]);
+				cli_search_free(ctx->ifs[i]);
 			}
 			
 			free(ctx->ifs[i]);
 			ctx->ifs[i] = NULL;
 		}
 	}
+	pthread_rwlock_unlock(&ctx->iflock);
 }
 
+/**
+ * Reloads the interfaces of the session from its directory: those the
+ * manifest lists, with the segments it names, or whatever the directory
+ * holds for sessions from before the manifest.  Capture data is only ever
+ * opened, never rewritten.
+ */
 void cli_ctx_reload(cli_ctx *ctx, const char *ctxfile)
 {
 	char tmp[CLI_DEFAULT_BUFFER];
+	char name[CLI_DEFAULT_BUFFER];
+	cli_manifestent ents[CLI_DEFAULT_BUFFER];
+	cli_manifestent *hint[CLI_DEFAULT_BUFFER];
+	cli_if *ifs[CLI_DEFAULT_BUFFER];
 	int tf;
 	DIR *dir;
 	struct dirent *dp;
 	cli_if *iface;
-	int i = 0;
+	int i = 0, n;
 
 	memset(tmp, 0, CLI_DEFAULT_BUFFER);
+	memset(hint, 0, sizeof(hint));
+	memset(ifs, 0, sizeof(ifs));
 	sprintf(tmp, "%s/%08x", ctx->pwd, ctx->pid);
 
 	// clear ifaces
@@ -832,73 +1576,136 @@ void cli_ctx_reload(cli_ctx *ctx, const char *ctxfile)
 	printw("done.\n"); refresh();
 	
 	printf("reloading interfaces from filesystem... "); refresh();
-	dir = opendir(tmp);
-	while ((dp = readdir(dir)) != NULL) {
-		if (dp->d_name[0] != '.') {
-			cli_ctx_reload_iface(ctx, dp->d_name);
+	if ((n = cli_cap_read_manifest(tmp, ents)) >= 0) {
+		for (i = 0; i < n; i++) {
+			if (ents[i].id >= CLI_DEFAULT_BUFFER) { continue; }
+			hint[ents[i].id] = &ents[i];
+
+			// version 1 sessions have no header until they are reloaded
+			sprintf(name, "%s/if%02x-header", tmp, ents[i].id);
+			if (access(name, F_OK) == 0) {
+				sprintf(name, "if%02x-header", ents[i].id);
+			} else {
+				sprintf(name, "if%02x-offset", ents[i].id);
+			}
+			cli_ctx_reload_iface(ctx, ifs, name);
+		}
+	} else if ((dir = opendir(tmp)) != NULL) {
+		while ((dp = readdir(dir)) != NULL) {
+			if (dp->d_name[0] != '.') {
+				cli_ctx_reload_iface(ctx, ifs, dp->d_name);
+			}
 		}
+		closedir(dir);
 	}
-	closedir(dir);
 	printw("done.\n"); refresh();
 	
+	// the interfaces are built in ifs and only then handed to the rx, writer
+	// and flusher threads
 	printw("restoring settings... "); refresh();
 	for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
-		iface = ctx->ifs[i];
+		iface = ifs[i];
 		if (iface != NULL) {
 			printw("  restoring %d\n", i);
-			ctx->ifsel = i;
-			sprintf(tmp, "%s/%08x/if%02x-offset", ctx->pwd, ctx->pid, i);
-			iface->offset = fopen(tmp, "wb+");
-			fseek(iface->offset, 0, SEEK_END);
-			
+			sprintf(tmp, "%s/%08x/if%02x-header", ctx->pwd, ctx->pid, i);
+			if (((iface->offset = cli_store_open(tmp, 0)) == NULL) &&
+				((iface->offset = cli_store_open(tmp, CLI_STORE_CREATE)) == NULL)) {
+				// no header to keep its settings in, leave it out
+				cli_print_error("reload");
+				pthread_mutex_destroy(&iface->lock);
+				pthread_mutex_destroy(&iface->txlock);
+				cli_ring_free(iface->rxq);
+				free(iface);
+				ifs[i] = NULL;
+				continue;
+			}
+
 			iface->id = i;
 			iface->link = (void *)iface;
 
-			sprintf(tmp, "%s/%08x/if%02x-buffer", ctx->pwd, ctx->pid, i);
-			iface->buffer = fopen(tmp, "ab+");
+			sprintf(tmp, "%s/%08x", ctx->pwd, ctx->pid);
+			if ((hint[i] != NULL) && (hint[i]->next > 0)) {
+				cli_seg_load_range(iface, tmp, 0, hint[i]->first, hint[i]->next);
+			} else {
+				cli_seg_load(iface, tmp, 0);
+			}
+			iface->durable.synced = iface->rx_count;
+			cli_write_if(iface);
 
 			switch (iface->type) {
 			case CLI_TYPE_TCP:
-			tf = socket(AF_INET, SOCK_DGRAM, 0);
-			if (tf >= 0) {
-				iface->rxdev.fd = tf;
+			case CLI_TYPE_UDP:
+				tf = socket(AF_INET, (iface->type == CLI_TYPE_TCP ?
+					SOCK_STREAM : SOCK_DGRAM), 0);
+				if (tf >= 0) {
+					iface->rxdev.fd = tf;
 					iface->rxopen = 1;
+					// tcp is not readable until `connect'
+					iface->active = (iface->type == CLI_TYPE_UDP);
 				}
 				break;
 			default: break;
 			}
 		}
 	}
+
+	pthread_rwlock_wrlock(&ctx->iflock);
+	for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
+		if (ifs[i] != NULL) {
+			ctx->ifs[i] = ifs[i];
+			ctx->ifsel = i;
+			cli_reactor_update(ctx, ifs[i]);
+		}
+	}
+	pthread_rwlock_unlock(&ctx->iflock);
+
+	cli_write_manifest(ctx);
 	printw("done.\n"); refresh();
 }
 
-void cli_ctx_reload_iface(cli_ctx *ctx, const char *ifacefile)
+/**
+ * Rebuilds an interface into ifs from its header file: if%02x-header, or the
+ * if%02x-offset of a version 1 session.  When a version 1 session has been
+ * reloaded before, both exist and the version 2 header has the settings.
+ */
+void cli_ctx_reload_iface(cli_ctx *ctx, cli_if **ifs, const char *ifacefile)
 {
-	int x;
-	FILE *fp;
+	int x, v1;
 	cli_if *iface;
 	char tmp[CLI_DEFAULT_BUFFER];
 	
 	memset(tmp, 0, CLI_DEFAULT_BUFFER);
 
 	if (sscanf(ifacefile, "if%02x-%s", &x, tmp) == 2) {
-		if ((x >= 0) && (x < CLI_DEFAULT_BUFFER) &&
-			 (tmp[0] != 'b')) {
-			iface = ctx->ifs[x];
-			if (iface == NULL) { iface = (cli_if *)malloc(sizeof(cli_if)); }
-
-			sprintf(tmp, "%s/%08x/%s", ctx->pwd, ctx->pid, ifacefile);
-			fp = fopen(tmp, "rb");
-			rewind(fp);
-			fread(iface, 1, sizeof(cli_if), fp);
-			iface->rx = 0;
-			iface->active = 0;
-
-			ctx->ifs[x] = iface;
-		} else if (tmp[0] == 'b') { // nothing
-		} else {
+		v1 = (strcmp(tmp, "offset") == 0);
+		if ((!v1) && (strcmp(tmp, "header") != 0)) { // segment files, nothing
+		} else if ((x < 0) || (x >= CLI_DEFAULT_BUFFER)) {
 			// TODO:
 			printw("Error: interface file out-of-bounds at %d.\n", x);
+		} else if ((!v1) || (ifs[x] == NULL)) {
+			iface = ifs[x];
+			if (iface == NULL) {
+				iface = (cli_if *)malloc(sizeof(cli_if));
+				memset(iface, 0, sizeof(cli_if));
+				iface->rxq = cli_ring_new(CLI_RING_SLOTS);
+				pthread_mutex_init(&iface->lock, NULL);
+				pthread_mutex_init(&iface->txlock, NULL);
+			}
+
+			sprintf(tmp, "%s/%08x/%s", ctx->pwd, ctx->pid, ifacefile);
+			if (cli_cap_read_if(iface, tmp) == -1) {
+				printw("Error: `%s' is not an interface header.\n", ifacefile);
+				if (ifs[x] == NULL) {
+					pthread_mutex_destroy(&iface->lock);
+					pthread_mutex_destroy(&iface->txlock);
+					cli_ring_free(iface->rxq);
+					free(iface);
+				}
+				return;
+			}
+			iface->id = x;
+
+			ifs[x] = iface;
 		}
 	}
 }
@@ -935,10 +1742,8 @@ void cli_cmd_save(cli_ctx *ctx)
 	char buf[13];
 	
 	cli_write_ctx(ctx);
-	fseek(ctx->ifs[ctx->ifsel]->offset, 0, SEEK_SET);
-	fwrite(ctx->ifs[ctx->ifsel], 1,
-		sizeof(cli_if), ctx->ifs[ctx->ifsel]->offset);
-	fseek(ctx->ifs[ctx->ifsel]->offset, 0, SEEK_END);
+	cli_write_if(ctx->ifs[ctx->ifsel]);
+	cli_write_manifest(ctx);
 
 	memset(buf, 0, 13);
 	sprintf(buf, "%08x.tgz", ctx->pid);
@@ -947,6 +1752,161 @@ void cli_cmd_save(cli_ctx *ctx)
 #endif
 }
 
+/**
+ * export <file> [a..b]: writes records a to b of the selected interface (all
+ * of them by default) to file as pcapng, for tcp and udp interfaces.
+ */
+void cli_cmd_export(cli_ctx *ctx)
+{
+	char tmp[CLI_DEFAULT_BUFFER];
+	cli_if *iface = ctx->ifs[ctx->ifsel];
+	struct sockaddr_in local;
+	struct timespec t0, t1;
+	socklen_t slen = sizeof(local);
+	unsigned int from, to;
+	unsigned long bytes, usec;
+	int pos = 6, len, fd;
+	long n;
+
+	if (iface == NULL) { return; }
+	if ((iface->header == 't') || (iface->header == 'e')) {
+		iface = ((cli_line *)iface)->rx;
+	}
+
+	memset(tmp, 0, CLI_DEFAULT_BUFFER);
+	if (sscanf(ctx->buffer + pos, "%255s%n", tmp, &len) < 1) {
+		printw("Error: `export' must specify a file (export if01.pcapng 0..$).\n");
+		return;
+	}
+	pos += len;
+	while (ctx->buffer[pos] == ' ') { pos++; }
+
+	from = iface->rx_first;
+	to = iface->rx_count;
+	if ((ctx->buffer[pos]) &&
+		(cli_cap_parse_range(iface, ctx->buffer + pos, &from, &to) == -1)) {
+		printw("Error: `export' takes records a..b: numbers, ^, $ or @time.\n");
+		return;
+	}
+
+	if ((iface->type != CLI_TYPE_TCP) && (iface->type != CLI_TYPE_UDP)) {
+		printw("Error: only tcp and udp interfaces can be exported.\n");
+		return;
+	}
+
+	// the local end of the connection, while there is one
+	memset(&local, 0, sizeof(local));
+	if ((iface->rxopen) &&
+		(getsockname(iface->rxdev.fd, (struct sockaddr *)&local, &slen) == -1)) {
+		memset(&local, 0, sizeof(local));
+	}
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+		cli_print_error("export");
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	n = cli_pcap_export(iface, from, to, fd, &local, &bytes);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if ((close(fd) == -1) || (n < 0)) {
+		cli_print_error("export");
+		return;
+	}
+
+	usec = (t1.tv_sec - t0.tv_sec) * 1000000UL + (t1.tv_nsec - t0.tv_nsec) / 1000;
+	printw("  %ld record(s), %lu byte(s) to `%s', %lu.%03lus\n", n, bytes, tmp,
+		usec / 1000000, (usec / 1000) % 1000);
+}
+
+/**
+ * replay <src> <dst> [a..b] [xN | fast] sends records of interface src out
+ * of dst in the background, paced as they were captured, N times as fast, or
+ * as fast as they go.  `replay?' shows how it is doing, `replay stop' ends it.
+ */
+void cli_cmd_replay(cli_ctx *ctx)
+{
+	char tmp[CLI_DEFAULT_BUFFER], *end;
+	cli_if *src, *dst;
+	unsigned int from, to, speed = 1000;
+	int pos = 6, len, s, d;
+	double x;
+
+	if (ctx->buffer[pos] == '?') {
+		if (ctx->replay.ctx == NULL) {
+			printw("  nothing replayed yet\n");
+		} else {
+			cli_replay_print(&ctx->replay);
+		}
+		return;
+	}
+
+	while (ctx->buffer[pos] == ' ') { pos++; }
+	if (strncmp(ctx->buffer + pos, "stop", 4) == 0) {
+		cli_replay_stop(ctx);
+		if (ctx->replay.ctx != NULL) { cli_replay_print(&ctx->replay); }
+		return;
+	}
+
+	if ((sscanf(ctx->buffer + pos, "%d %d%n", &s, &d, &len) < 2) ||
+		(s < 0) || (s >= CLI_DEFAULT_BUFFER) || (d < 0) || (d >= CLI_DEFAULT_BUFFER)) {
+		printw("Error: malformed `replay' command (replay 1 2 0..$ x2).\n");
+		return;
+	}
+	pos += len;
+
+	src = ctx->ifs[s];
+	dst = ctx->ifs[d];
+	if ((dst != NULL) && ((dst->header == 't') || (dst->header == 'e'))) {
+		dst = ((cli_line *)dst)->tx;
+	}
+	if ((src == NULL) || (src->header != 'i') ||
+		(dst == NULL) || (dst->header != 'i')) {
+		printw("Error: `replay' must specify valid source and target interfaces.\n");
+		return;
+	}
+
+	from = src->rx_first;
+	to = src->rx_count;
+	memset(tmp, 0, CLI_DEFAULT_BUFFER);
+	while (sscanf(ctx->buffer + pos, "%255s%n", tmp, &len) == 1) {
+		pos += len;
+
+		if (strncmp(tmp, "fast", 4) == 0) {
+			speed = 0;
+		} else if (tmp[0] == 'x') {
+			x = strtod(tmp + 1, &end);
+			if ((end == tmp + 1) || (x < 0.001) || (x > 1000000.0)) {
+				printw("Error: `replay' speed is x and a factor (x2, x0.5) or fast.\n");
+				return;
+			}
+			speed = (unsigned int)((x * 1000.0) + 0.5);
+		} else if (cli_cap_parse_range(src, tmp, &from, &to) == -1) {
+			printw("Error: `replay' takes records a..b: numbers, ^, $ or @time.\n");
+			return;
+		}
+	}
+
+	if (from >= to) {
+		printw("Error: `replay' has no records to send.\n");
+		return;
+	}
+	if ((dst->type != CLI_TYPE_FILE) &&
+		(!(dst->type & CLI_FD_TYPES) || !dst->rxopen)) {
+		printw("Error: `replay' target interface is not connected.\n");
+		return;
+	}
+
+	if (cli_replay_start(ctx, src, dst, from, to, speed) == -1) {
+		cli_print_error("replay");
+		return;
+	}
+
+	printw("  replaying %u record(s) of if%02x out of if%02x\n", to - from,
+		src->id, dst->id);
+}
+
 void cli_cmd_load(cli_ctx *ctx)
 {
 	char tmp[CLI_DEFAULT_BUFFER];
@@ -995,8 +1955,10 @@ int cli_interpret(cli_ctx *ctx)
 		{"cwd", cli_cmd_cwd, 0, "cwd"},
 		{"history", cli_cmd_history, 0, "history"},
 		{"tie", cli_cmd_tie, CLI_CMD_UPDATE_CTX, "tie"},
+		{"export", cli_cmd_export, 0, "export"},
 		{"ex", cli_cmd_ex, CLI_CMD_UPDATE_CTX, "ex"},
 		{"sess", cli_cmd_session, 0, "session"},
+		{"replay", cli_cmd_replay, 0, "replay"},
 		{"rx", cli_cmd_rx, 0, "rx"},
 		{"flush", cli_cmd_flush, 0, "flush"},
 		{"clear", cli_cmd_clear, 0, "clear"},
@@ -1020,7 +1982,8 @@ int cli_interpret(cli_ctx *ctx)
 		memcpy(ctx->cmd, ctx->buffer + pos, CLI_MAX_BUFFER - pos);
 		cli_cmd_tx(ctx);
 	} else if (strncmp(ctx->buffer, "tx<", 3) == 0) {
-		// load a file and send it over tx
+		// stream a file out over tx
+		cli_cmd_tx_file(ctx);
 	} else if (strncmp(ctx->buffer, "tx", 2) == 0) {
 		pos += 2;
 		while ((ctx->buffer[pos]) && (ctx->buffer[pos] == ' ')) { pos++; }
@@ -1103,6 +2066,12 @@ void cli_interpret_if(cli_ctx *ctx)
 			}
 			printw("cli auto carriage return is %s\n",
 				(iface->flags & CLI_FLAG_ACR ? "ON" : "OFF"));
+		} else if (strncmp(ctx->buffer, "raw", 3) == 0) {
+			if (ctx->buffer[3] != '?') {
+				iface->flags ^= CLI_FLAG_RAW;
+			}
+			printw("cli raw file writes are %s\n",
+				(iface->flags & CLI_FLAG_RAW ? "ON" : "OFF"));
 
 		} else {
 			switch (iface->type) {
@@ -1147,16 +2116,32 @@ void cli_readcmd(cli_ctx *ctx)
 
 void cli_ctx_exit(cli_ctx *ctx)
 {
+	int i;
 	char tmp[CLI_DEFAULT_BUFFER];
 	memset(tmp, 0, CLI_DEFAULT_BUFFER);
 
 	refresh();
+
+	// let the rx threads see CLI_EXITING and leave epoll_wait, then let the
+	// writer flush what they queued and the flusher make it durable
+	ctx->state = CLI_EXITING;
+	cli_replay_stop(ctx);
+	cli_reactor_stop(ctx);
+	cli_writer_stop(ctx);
+	cli_flusher_stop(ctx);
+
 	cli_ui_exit(&ctx->ui);
 
+	cli_write_manifest(ctx);
 	cli_ctx_free_ifaces(ctx);
 
-	pthread_mutex_destroy(&ctx->mutex);
-	pthread_cancel(ctx->thread);
+	// nothing references rx buffers any more
+	for (i = 0; i < ctx->nreactors; i++) {
+		cli_pool_exit(&ctx->reactor[i].pool);
+	}
+	cli_pool_exit(&ctx->pool);
+
+	pthread_rwlock_destroy(&ctx->iflock);
 }
 
 void cli_ctx_display_info()
@@ -1171,7 +2156,40 @@ void cli_ctx_display_info()
 int main(int argc, char **argv)
 {
 	cli_ctx ctx;
+	int c;
+
+	// number of rx threads, 0 picks one per online cpu
+	ctx.nreactors = 0;
+	ctx.engine = CLI_ENGINE_EPOLL;
+
+	while ((c = getopt(argc, argv, "r:e:")) != -1) {
+		switch (c) {
+		case 'r':
+			ctx.nreactors = atoi(optarg);
+			break;
+		case 'e':
+			if (strncmp(optarg, "uring", 5) == 0) {
+#ifdef HAVE_LIBURING
+				ctx.engine = CLI_ENGINE_URING;
+#else
+				fprintf(stderr, "%s: built without io_uring, using epoll\n",
+					argv[0]);
+#endif
+			} else if (strncmp(optarg, "epoll", 5) != 0) {
+				fprintf(stderr, "%s: unknown engine `%s'\n", argv[0], optarg);
+				return 1;
+			}
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-r rxthreads] [-e epoll|uring]\n",
+				argv[0]);
+			return 1;
+		}
+	}
 	
+	// a peer hanging up is reported by the write, not a signal
+	signal(SIGPIPE, SIG_IGN);
+
 	cli_ctx_init(&ctx);
 	cli_ctx_display_info();
 	
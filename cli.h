@@ -6,7 +6,9 @@ void cli_ctx_init(cli_ctx *ctx);
 void cli_ctx_exit(cli_ctx *ctx);
 
 void cli_ctx_display_info();
+void cli_write_manifest(cli_ctx *ctx);
 void cli_write_ctx(cli_ctx *ctx);
+void cli_write_if(cli_if *iface);
 
 int cli_interpret(cli_ctx *ctx);
 void cli_interpret_if(cli_ctx *ctx);
@@ -20,18 +22,35 @@ void cli_print_type(cli_if_type type);
 void cli_print_typel(cli_if_type type);
 void cli_print_mode(cli_if_mode mode);
 void cli_print_model(cli_if_mode mode);
+void cli_print_overload(cli_overload overload);
+void cli_print_durable(cli_durable *d);
+void cli_print_limits(unsigned long bytes, unsigned long secs);
+void cli_print_time(unsigned long ts);
+void cli_print_if(cli_if *iface);
 
 void cli_print_error(const char *caller);
 
 void cli_print_format_mode(cli_if_mode mode, const char *buffer, size_t len);
-char *cli_format(cli_if_mode mode, char byte, int *size);
 
-void cli_handle_rx(cli_ctx *ctx, cli_if *iface, char *buffer);
-void *cli_rx_interrupt(void *pvctx);
+void cli_rx_reserve(cli_if *iface, unsigned int len, long *ipos, long *dpos);
+cli_if_mode cli_rx_mode(cli_if *iface, unsigned char flags);
+void cli_rx_display(cli_ctx *ctx, cli_if *iface, char *buffer, unsigned int len,
+	unsigned char flags);
+void cli_rx_forward(cli_ctx *ctx, cli_if *iface, char *buffer, unsigned int len);
+void cli_rx_show(cli_if *iface, cli_rechdr *rh, struct sockaddr_in *peer,
+	char *buffer, unsigned int len);
+void cli_rx_range(cli_ctx *ctx, cli_if *iface, const char *arg);
+void cli_rx_view(cli_ctx *ctx, cli_if *iface, const char *arg);
+void cli_handle_rx_batch(cli_ctx *ctx, cli_if *iface, cli_rec *recs,
+	unsigned int n);
+void cli_handle_rx(cli_ctx *ctx, cli_if *iface, char *buffer, unsigned int len);
+int cli_rx_udp(cli_reactor *r, cli_if *iface);
+void *cli_rx_interrupt(void *pvr);
 
 void cli_if_rx(cli_ctx *ctx, const char *buffer);
+int cli_if_send(cli_ctx *ctx, cli_if *iface, char *buffer, int len);
 int cli_if_tx(cli_ctx *ctx, cli_if *iface, char *buffer);
 
 void cli_ctx_reload(cli_ctx *ctx, const char *ctxfile);
-void cli_ctx_reload_iface(cli_ctx *ctx, const char *ifacefile);
+void cli_ctx_reload_iface(cli_ctx *ctx, cli_if **ifs, const char *ifacefile);
 
@@ -0,0 +1,195 @@
+/*
+ * cli_bloom.c - per segment Bloom filter search index
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clibase.h"
+#include "cli_store.h"
+#include "cli_seg.h"
+#include "cli_bloom.h"
+
+// each trigram sets two bits of a filter
+#define CLI_BLOOM_H1(t)	(((uint32_t)(t) * 0x9e3779b1U) >> 14)
+#define CLI_BLOOM_H2(t)	(((uint32_t)(t) * 0x85ebca77U) >> 14)
+
+#define CLI_BLOOM_ENTRY	(sizeof(cli_bloomhdr) + (CLI_BLOOM_BITS / 8))
+
+static unsigned long cli_bloom_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+/**
+ * Appends the filter being built to the segment's index file.
+ */
+void cli_bloom_flush(cli_seg *seg)
+{
+	cli_bloomhdr hdr;
+	unsigned long off;
+
+	if ((seg->bits == NULL) || (seg->bnrec == 0) || (seg->bloom == NULL)) {
+		return;
+	}
+
+	hdr.rec = seg->brec;
+	hdr.nrec = seg->bnrec;
+
+	off = cli_store_size(seg->bloom);
+	cli_store_write(seg->bloom, off, &hdr, sizeof(cli_bloomhdr));
+	cli_store_write(seg->bloom, off + sizeof(cli_bloomhdr), seg->bits,
+		CLI_BLOOM_BITS / 8);
+
+	memset(seg->bits, 0, CLI_BLOOM_BITS / 8);
+	seg->bnrec = 0;
+	seg->bbytes = 0;
+}
+
+/**
+ * Adds the trigrams of n records, the first of them record rec of the
+ * interface, to the filter being built for seg.  Filters never cover a gap,
+ * so turning the index off and on again only leaves records unindexed, which
+ * searches then scan.  Only for the capture writer, with iface->lock held.
+ */
+void cli_bloom_batch(cli_if *iface, cli_seg *seg, unsigned int rec,
+	cli_rec *recs, unsigned int n)
+{
+	char path[CLI_DEFAULT_BUFFER];
+	const unsigned char *p;
+	unsigned long start, bytes = 0;
+	unsigned int i, j;
+	uint32_t t, last;
+
+	if ((seg->bloom == NULL) && (cli_seg_path(seg, "bloom", path) == 0)) {
+		seg->bloom = cli_store_open(path, CLI_STORE_CREATE);
+	}
+	if ((seg->bits == NULL) &&
+		((seg->bits = (char *)calloc(1, CLI_BLOOM_BITS / 8)) == NULL)) {
+		return;
+	}
+	if (seg->bloom == NULL) { return; }
+
+	start = cli_bloom_clock();
+
+	rec -= seg->first;
+	if ((seg->bnrec > 0) && (seg->brec + seg->bnrec != rec)) {
+		cli_bloom_flush(seg);
+	}
+
+	for (i = 0; i < n; i++, rec++) {
+		if (seg->bnrec == 0) { seg->brec = rec; }
+
+		// runs of one byte repeat a trigram, which is set already
+		p = (const unsigned char *)recs[i].data;
+		for (j = 0, t = 0, last = 0xffffffff; j < recs[i].len; j++) {
+			t = ((t << 8) | p[j]) & 0xffffff;
+			if ((j >= 2) && (t != last)) {
+				last = t;
+				seg->bits[CLI_BLOOM_H1(t) >> 3] |= 1 << (CLI_BLOOM_H1(t) & 7);
+				seg->bits[CLI_BLOOM_H2(t) >> 3] |= 1 << (CLI_BLOOM_H2(t) & 7);
+			}
+		}
+
+		seg->bnrec++;
+		seg->bbytes += recs[i].len;
+		bytes += recs[i].len;
+
+		if (seg->bbytes >= CLI_BLOOM_BYTES) { cli_bloom_flush(seg); }
+	}
+
+	__atomic_add_fetch(&iface->index_bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&iface->index_nsec, cli_bloom_clock() - start,
+		__ATOMIC_RELAXED);
+}
+
+/**
+ * Cuts the index of a reloaded seg after the last filter that only covers
+ * records seg still holds (see cli_seg_trim).
+ */
+void cli_bloom_trim(cli_seg *seg)
+{
+	cli_bloomhdr hdr;
+	unsigned long off, size;
+
+	if (seg->bloom == NULL) { return; }
+
+	size = cli_store_size(seg->bloom);
+	for (off = 0; off + CLI_BLOOM_ENTRY <= size; off += CLI_BLOOM_ENTRY) {
+		if ((cli_store_read(seg->bloom, off, &hdr, sizeof(cli_bloomhdr)) !=
+			sizeof(cli_bloomhdr)) || (hdr.nrec == 0) ||
+			(hdr.rec + hdr.nrec > seg->count)) {
+			break;
+		}
+	}
+
+	cli_store_trim(seg->bloom, off);
+}
+
+static int cli_bloom_has(cli_store *s, unsigned long off, uint32_t bit)
+{
+	unsigned char byte = 0;
+
+	cli_store_read(s, off + sizeof(cli_bloomhdr) + (bit >> 3), &byte, 1);
+	return (byte >> (bit & 7)) & 1;
+}
+
+/**
+ * Collects the groups of records of seg whose filters show that they cannot
+ * hold the len bytes of pat, in record order, into a newly allocated array.
+ * Patterns shorter than a trigram rule nothing out.  Returns how many there
+ * are.
+ */
+unsigned int cli_bloom_misses(cli_seg *seg, const char *pat, unsigned int len,
+	cli_bloomhdr **miss)
+{
+	const unsigned char *p = (const unsigned char *)pat;
+	cli_bloomhdr hdr;
+	unsigned long off, size;
+	unsigned int j, n = 0, cap = 0;
+	cli_bloomhdr *tmp;
+	uint32_t t;
+	int has;
+
+	*miss = NULL;
+	if ((seg->bloom == NULL) || (len < 3)) { return 0; }
+
+	size = cli_store_size(seg->bloom);
+	for (off = 0; off + CLI_BLOOM_ENTRY <= size; off += CLI_BLOOM_ENTRY) {
+		// an index still being written ends in reserved space
+		if ((cli_store_read(seg->bloom, off, &hdr, sizeof(cli_bloomhdr)) !=
+			sizeof(cli_bloomhdr)) || (hdr.nrec == 0)) {
+			break;
+		}
+
+		for (j = 0, t = 0, has = 1; (j < len) && (has); j++) {
+			t = ((t << 8) | p[j]) & 0xffffff;
+			if (j >= 2) {
+				has = (cli_bloom_has(seg->bloom, off, CLI_BLOOM_H1(t)) &&
+					cli_bloom_has(seg->bloom, off, CLI_BLOOM_H2(t)));
+			}
+		}
+		if (has) { continue; }
+
+		if (n == cap) {
+			cap = (cap == 0 ? 64 : cap * 2);
+			if ((tmp = (cli_bloomhdr *)realloc(*miss, cap * sizeof(cli_bloomhdr))) == NULL) {
+				break;
+			}
+			*miss = tmp;
+		}
+		(*miss)[n++] = hdr;
+	}
+
+	return n;
+}
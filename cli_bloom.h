@@ -0,0 +1,15 @@
+#pragma once
+
+#include "clibase.h"
+
+// capture writer, with iface->lock held
+void cli_bloom_batch(cli_if *iface, cli_seg *seg, unsigned int rec,
+	cli_rec *recs, unsigned int n);
+void cli_bloom_flush(cli_seg *seg);
+
+// cli_seg_load, before anything else uses seg
+void cli_bloom_trim(cli_seg *seg);
+
+// any thread
+unsigned int cli_bloom_misses(cli_seg *seg, const char *pat, unsigned int len,
+	cli_bloomhdr **miss);
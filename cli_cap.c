@@ -0,0 +1,398 @@
+/*
+ * cli_cap.c - versioned on-disk capture format
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "clibase.h"
+#include "cli_store.h"
+#include "cli_seg.h"
+#include "cli_cap.h"
+
+/**
+ * Wall clock time in nanoseconds, as kept in record headers.
+ */
+unsigned long cli_cap_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+/**
+ * Parses a duration such as 90s, 5min, 1h30min, 250ms or 2d into
+ * nanoseconds.  Returns -1 if value is not of that form.
+ */
+static int cli_cap_parse_duration(const char *value, unsigned long *ns)
+{
+	const char *p = value;
+	unsigned long n;
+	int len;
+
+	*ns = 0;
+
+	while (sscanf(p, "%lu%n", &n, &len) == 1) {
+		p += len;
+		if (strncmp(p, "ms", 2) == 0) {
+			*ns += n * 1000000UL;
+			p += 2;
+		} else if (strncmp(p, "min", 3) == 0) {
+			*ns += n * 60000000000UL;
+			p += 3;
+		} else {
+			switch (*p) {
+			case 's': *ns += n * 1000000000UL; break;
+			case 'm': *ns += n * 60000000000UL; break;
+			case 'h': *ns += n * 3600000000000UL; break;
+			case 'd': *ns += n * 86400000000000UL; break;
+			default: return -1;
+			}
+			p++;
+		}
+	}
+
+	return ((*p == 0) && (p != value) ? 0 : -1);
+}
+
+/**
+ * Parses the target of `rx @' (and of cliq): a time of day (14:03:12, today),
+ * a date with or without one (2026-10-18 14:03:12), seconds since the epoch,
+ * or -<duration> before now.  Seconds may have a fraction.  Returns nanoseconds
+ * since the epoch, or 0 if value is not of that form.
+ */
+unsigned long cli_cap_parse_time(const char *value)
+{
+	struct tm tm, day;
+	time_t now = time(NULL), t;
+	const char *p, *q;
+	unsigned long ns = 0, scale = 100000000UL, dur;
+
+	while (*value == ' ') { value++; }
+
+	if (*value == '-') {
+		if ((cli_cap_parse_duration(value + 1, &dur) == -1) ||
+			(dur > cli_cap_now())) {
+			return 0;
+		}
+		return cli_cap_now() - dur;
+	}
+
+	if (strpbrk(value, ":-") == NULL) {
+		// seconds since the epoch
+		p = value;
+		t = strtoul(value, (char **)&p, 10);
+		if (p == value) { return 0; }
+	} else {
+		// today, unless a date is given; a failed match may leave some of
+		// the fields set
+		localtime_r(&now, &tm);
+		tm.tm_sec = 0;
+		day = tm;
+		if ((p = strptime(value, "%Y-%m-%d", &day)) != NULL) {
+			tm = day;
+			tm.tm_hour = 0;
+			tm.tm_min = 0;
+			if ((*p == ' ') || (*p == 'T')) { p++; }
+		} else {
+			p = value;
+		}
+
+		if (((q = strptime(p, "%H:%M:%S", &tm)) != NULL) ||
+			((q = strptime(p, "%H:%M", &tm)) != NULL)) {
+			p = q;
+		} else if (*p != 0) {
+			return 0;
+		}
+
+		tm.tm_isdst = -1;
+		if ((t = mktime(&tm)) == (time_t)-1) { return 0; }
+	}
+
+	if (*p == '.') {
+		for (p++; (*p >= '0') && (*p <= '9'); p++) {
+			ns += (*p - '0') * scale;
+			scale /= 10;
+		}
+	}
+
+	while (*p == ' ') { p++; }
+	if ((*p != 0) || (t < 0)) { return 0; }
+
+	return ((unsigned long)t * 1000000000UL) + ns;
+}
+
+/**
+ * One end of a range of records: a record number, ^, $ or @time.
+ */
+static int cli_cap_parse_end(cli_if *iface, const char *arg, unsigned int len,
+	unsigned int *rec)
+{
+	char tmp[CLI_DEFAULT_BUFFER];
+	unsigned long ts;
+	char *end;
+
+	while ((len > 0) && (*arg == ' ')) { arg++; len--; }
+	while ((len > 0) && (arg[len - 1] == ' ')) { len--; }
+	if ((len == 0) || (len >= CLI_DEFAULT_BUFFER)) { return -1; }
+
+	memcpy(tmp, arg, len);
+	tmp[len] = 0;
+
+	if (strcmp(tmp, "^") == 0) {
+		*rec = iface->rx_first;
+	} else if (strcmp(tmp, "$") == 0) {
+		*rec = (iface->rx_count > 0 ? iface->rx_count - 1 : 0);
+	} else if (tmp[0] == '@') {
+		if ((ts = cli_cap_parse_time(tmp + 1)) == 0) { return -1; }
+		*rec = cli_seg_seek(iface, ts);
+	} else {
+		*rec = strtoul(tmp, &end, 10);
+		if ((end == tmp) || (*end != 0)) { return -1; }
+	}
+
+	return 0;
+}
+
+/**
+ * Parses records a..b of iface, or record a alone, into from and to (not
+ * included).  Ends are record numbers, ^ (the first), $ (the last) or @time
+ * (the first record received then or later); a time as the last end is where
+ * the range stops.  The range is kept to the records iface holds.  Returns -1
+ * if arg is not of that form.
+ */
+int cli_cap_parse_range(cli_if *iface, const char *arg, unsigned int *from,
+	unsigned int *to)
+{
+	const char *dots = strstr(arg, "..");
+
+	if (dots == NULL) {
+		if (cli_cap_parse_end(iface, arg, strlen(arg), from) == -1) { return -1; }
+		*to = *from + 1;
+	} else {
+		if ((cli_cap_parse_end(iface, arg, dots - arg, from) == -1) ||
+			(cli_cap_parse_end(iface, dots + 2, strlen(dots + 2), to) == -1)) {
+			return -1;
+		}
+		while (dots[2] == ' ') { dots++; }
+		if (dots[2] != '@') { (*to)++; }
+	}
+
+	if (*from < iface->rx_first) { *from = iface->rx_first; }
+	if (*to > iface->rx_count) { *to = iface->rx_count; }
+	if (*to < *from) { *to = *from; }
+
+	return 0;
+}
+
+/**
+ * Describes the settings of iface in a version 2 interface header.
+ */
+void cli_cap_ifhdr(cli_if *iface, cli_ifhdr *hdr)
+{
+	memset(hdr, 0, sizeof(cli_ifhdr));
+
+	hdr->magic = CLI_CAP_MAGIC;
+	hdr->version = CLI_CAP_VERSION;
+	hdr->size = sizeof(cli_ifhdr);
+
+	hdr->id = iface->id;
+	hdr->type = iface->type;
+	hdr->rxmode = iface->rxmode;
+	hdr->txmode = iface->txmode;
+	hdr->flags = iface->flags;
+	hdr->buffer_size = iface->buffer_size;
+	hdr->rx_batch = iface->rx_batch;
+	hdr->overload = iface->overload;
+	hdr->compress = iface->compress;
+	hdr->index = iface->index;
+
+	hdr->durable_mode = iface->durable.mode;
+	hdr->durable_ms = iface->durable.ms;
+	hdr->durable_records = iface->durable.records;
+	hdr->rx_count = iface->rx_count;
+	hdr->rx_size = iface->rx_size;
+
+	hdr->rotate_bytes = iface->rotate_bytes;
+	hdr->rotate_secs = iface->rotate_secs;
+	hdr->retain_bytes = iface->retain_bytes;
+	hdr->retain_secs = iface->retain_secs;
+
+	memcpy(hdr->dev, iface->devname, CLI_DEFAULT_BUFFER);
+}
+
+static void cli_cap_load_v2(cli_if *iface, const cli_ifhdr *hdr)
+{
+	iface->id = hdr->id;
+	iface->type = hdr->type;
+	iface->rxmode = hdr->rxmode;
+	iface->txmode = hdr->txmode;
+	iface->flags = hdr->flags;
+	iface->buffer_size = hdr->buffer_size;
+	iface->rx_batch = hdr->rx_batch;
+	iface->overload = hdr->overload;
+	iface->compress = hdr->compress;
+	iface->index = hdr->index;
+
+	iface->durable.mode = hdr->durable_mode;
+	iface->durable.ms = hdr->durable_ms;
+	iface->durable.records = hdr->durable_records;
+	iface->rx_count = hdr->rx_count;
+	iface->rx_size = hdr->rx_size;
+
+	iface->rotate_bytes = hdr->rotate_bytes;
+	iface->rotate_secs = hdr->rotate_secs;
+	iface->retain_bytes = hdr->retain_bytes;
+	iface->retain_secs = hdr->retain_secs;
+
+	memcpy(iface->devname, hdr->dev, CLI_DEFAULT_BUFFER);
+}
+
+static void cli_cap_load_v1(cli_if *iface, const cli_if_v1 *v1)
+{
+	iface->id = v1->id;
+	iface->type = v1->type;
+	iface->rxmode = v1->rxmode;
+	iface->txmode = v1->txmode;
+	iface->flags = v1->flags;
+	iface->buffer_size = v1->buffer_size;
+	iface->rx_count = v1->rx_count;
+	iface->rx_size = v1->rx_size;
+
+	// settings that did not exist yet
+	iface->rx_batch = CLI_RX_BATCH;
+	iface->rotate_bytes = CLI_SEG_BYTES;
+
+	memcpy(iface->devname, v1->devname, CLI_DEFAULT_BUFFER);
+}
+
+/**
+ * Reads the interface header in path into iface, leaving its runtime state
+ * alone.  Both a version 2 if%02x-header and the if%02x-offset of a version 1
+ * session will do.  Returns the version found, or -1.
+ */
+int cli_cap_read_if(cli_if *iface, const char *path)
+{
+	union {
+		cli_ifhdr v2;
+		cli_if_v1 v1;
+	} hdr;
+	FILE *fp;
+	size_t len;
+
+	if ((fp = fopen(path, "rb")) == NULL) { return -1; }
+	memset(&hdr, 0, sizeof(hdr));
+	len = fread(&hdr, 1, sizeof(hdr), fp);
+	fclose(fp);
+
+	iface->header = 'i';
+
+	// headers from before the later settings end at dev; those read as 0
+	if ((len >= offsetof(cli_ifhdr, index)) && (hdr.v2.magic == CLI_CAP_MAGIC)) {
+		if (hdr.v2.version > CLI_CAP_VERSION) { return -1; }
+		cli_cap_load_v2(iface, &hdr.v2);
+		return 2;
+	} else if ((len >= sizeof(cli_if_v1)) && (hdr.v1.header == 'i')) {
+		cli_cap_load_v1(iface, &hdr.v1);
+		return 1;
+	}
+
+	return -1;
+}
+
+/**
+ * Describes the n interfaces of ifs (empty spots and lines left out) as
+ * manifest entries in ents, which must hold CLI_DEFAULT_BUFFER of them.
+ * Returns how many there are.
+ */
+unsigned int cli_cap_manifest(cli_if **ifs, unsigned int n,
+	cli_manifestent *ents)
+{
+	unsigned int i, k = 0;
+
+	for (i = 0; (i < n) && (k < CLI_DEFAULT_BUFFER); i++) {
+		if ((ifs[i] == NULL) || (ifs[i]->header != 'i')) { continue; }
+
+		memset(&ents[k], 0, sizeof(cli_manifestent));
+		ents[k].id = ifs[i]->id;
+		cli_seg_range(ifs[i], &ents[k].first, &ents[k].next);
+		k++;
+	}
+
+	return k;
+}
+
+/**
+ * Writes the manifest of the session in dir.  It goes to a new file that
+ * then takes the place of the old one, so readers find one or the other
+ * whole.  Returns -1 on error.
+ */
+int cli_cap_write_manifest(const char *dir, cli_manifestent *ents,
+	unsigned int n)
+{
+	char path[CLI_DEFAULT_BUFFER], tmp[CLI_DEFAULT_BUFFER];
+	cli_manifest m;
+	FILE *fp;
+	int ret = 0;
+
+	snprintf(path, CLI_DEFAULT_BUFFER, "%s/" CLI_CAP_MANIFEST, dir);
+	snprintf(tmp, CLI_DEFAULT_BUFFER, "%s/." CLI_CAP_MANIFEST, dir);
+
+	memset(&m, 0, sizeof(cli_manifest));
+	m.magic = CLI_CAP_MAGIC;
+	m.version = CLI_CAP_VERSION;
+	m.size = sizeof(cli_manifest);
+	m.count = n;
+
+	if ((fp = fopen(tmp, "wb")) == NULL) { return -1; }
+	if ((fwrite(&m, sizeof(cli_manifest), 1, fp) != 1) ||
+		(fwrite(ents, sizeof(cli_manifestent), n, fp) != n)) {
+		ret = -1;
+	}
+	if (fclose(fp) != 0) { ret = -1; }
+
+	if ((ret == -1) || (rename(tmp, path) == -1)) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Reads the manifest of the session in dir into ents, which must hold
+ * CLI_DEFAULT_BUFFER entries.  Returns how many interfaces it lists, or -1
+ * if there is none (sessions from before it) or it cannot be read.
+ */
+int cli_cap_read_manifest(const char *dir, cli_manifestent *ents)
+{
+	char path[CLI_DEFAULT_BUFFER];
+	cli_manifest m;
+	FILE *fp;
+	int ret = -1;
+
+	snprintf(path, CLI_DEFAULT_BUFFER, "%s/" CLI_CAP_MANIFEST, dir);
+	if ((fp = fopen(path, "rb")) == NULL) { return -1; }
+
+	if ((fread(&m, sizeof(cli_manifest), 1, fp) == 1) &&
+		(m.magic == CLI_CAP_MAGIC) && (m.version <= CLI_CAP_VERSION) &&
+		(m.size >= sizeof(cli_manifest)) && (m.count <= CLI_DEFAULT_BUFFER) &&
+		(fseek(fp, m.size, SEEK_SET) == 0) &&
+		(fread(ents, sizeof(cli_manifestent), m.count, fp) == m.count)) {
+		ret = m.count;
+	}
+	fclose(fp);
+
+	return ret;
+}
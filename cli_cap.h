@@ -0,0 +1,17 @@
+#pragma once
+
+#include "clibase.h"
+
+unsigned long cli_cap_now(void);
+unsigned long cli_cap_parse_time(const char *value);
+int cli_cap_parse_range(cli_if *iface, const char *arg, unsigned int *from,
+	unsigned int *to);
+
+void cli_cap_ifhdr(cli_if *iface, cli_ifhdr *hdr);
+int cli_cap_read_if(cli_if *iface, const char *path);
+
+unsigned int cli_cap_manifest(cli_if **ifs, unsigned int n,
+	cli_manifestent *ents);
+int cli_cap_write_manifest(const char *dir, cli_manifestent *ents,
+	unsigned int n);
+int cli_cap_read_manifest(const char *dir, cli_manifestent *ents);
@@ -7,16 +7,25 @@
  * the Free Software Foundation, either version 3 of the License, or
  * (at your option) any later version.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+
+#include <unistd.h>
 
 #include <curses.h>
 #include <arpa/inet.h>
 
+#include "config.h"
+
 #include "clibase.h"
 #include "cli.h"
 #include "cli_cmd.h"
+#include "cli_reactor.h"
+#include "cli_flush.h"
+#include "cli_cap.h"
 
 void cli_cmd_if_set_type(cli_ctx *ctx, const char *value)
 {
@@ -24,6 +33,16 @@ void cli_cmd_if_set_type(cli_ctx *ctx, const char *value)
 	int tmp;
 
 	if (iface != NULL) {
+		pthread_rwlock_wrlock(&ctx->iflock);
+		pthread_mutex_lock(&iface->txlock);
+
+		// drop any socket left over from a previous type
+		if ((iface->rxopen) && (iface->type & CLI_IP_TYPES)) {
+			cli_reactor_remove(ctx, iface);
+			close(iface->rxdev.fd);
+			iface->rxopen = 0;
+		}
+
 		if (strncmp(value, "tcp", 3) == 0) {
 			memset(&iface->sock, 0, sizeof(struct sockaddr_in));
 			iface->sock.sin_family = AF_INET;
@@ -37,6 +56,8 @@ void cli_cmd_if_set_type(cli_ctx *ctx, const char *value)
 				iface->rxdev.fd = tmp;
 				iface->rxopen = 1;
 			}
+			// not readable until `connect'
+			iface->active = 0;
 			iface->type = CLI_TYPE_TCP;
 		} else if (strncmp(value, "udp", 3) == 0) {
 			memset(&iface->sock, 0, sizeof(struct sockaddr_in));
@@ -76,6 +97,10 @@ void cli_cmd_if_set_type(cli_ctx *ctx, const char *value)
 		} else {
 			printw("Error: `if set' type `%s' unrecognized.\n", value);
 		}
+
+		cli_reactor_update(ctx, iface);
+		pthread_mutex_unlock(&iface->txlock);
+		pthread_rwlock_unlock(&ctx->iflock);
 	}
 }
 
@@ -91,6 +116,217 @@ void cli_cmd_if_set_buffersize(cli_ctx *ctx, const char *value)
 	}
 }
 
+void cli_cmd_if_set_batch(cli_ctx *ctx, const char *value)
+{
+	int i;
+	cli_if *iface = ctx->ifs[ctx->ifsel];
+
+	if (iface != NULL) {
+		i = atoi(value);
+		if ((i < 1) || (i > CLI_RX_BATCH)) {
+			printw("Error: `if set' batch must be between 1 and %d.\n",
+				CLI_RX_BATCH);
+		} else {
+			iface->rx_batch = i;
+		}
+	}
+}
+
+void cli_cmd_if_set_overload(cli_ctx *ctx, const char *value)
+{
+	cli_if *iface = ctx->ifs[ctx->ifsel];
+
+	if (iface != NULL) {
+		if (strncmp(value, "block", 5) == 0) {
+			iface->overload = CLI_OVERLOAD_BLOCK;
+		} else if ((strncmp(value, "drop-newest", 11) == 0) ||
+					(strncmp(value, "newest", 6) == 0)) {
+			iface->overload = CLI_OVERLOAD_DROP_NEWEST;
+		} else if ((strncmp(value, "drop-oldest", 11) == 0) ||
+					(strncmp(value, "oldest", 6) == 0)) {
+			iface->overload = CLI_OVERLOAD_DROP_OLDEST;
+		} else {
+			printw("Error: `if set' overload must be block, drop-newest or drop-oldest.\n");
+		}
+	}
+}
+
+/**
+ * durability=none | record | <N>ms | <N>rec, periodic limits may be combined
+ * with a '/' as in 100ms/500rec.
+ */
+void cli_cmd_if_set_durable(cli_ctx *ctx, const char *value)
+{
+	cli_if *iface = ctx->ifs[ctx->ifsel];
+	unsigned int n, ms = 0, records = 0;
+	const char *p = value;
+	int len;
+
+	if (iface == NULL) { return; }
+
+	if (strncmp(value, "none", 4) == 0) {
+		iface->durable.mode = CLI_DURABLE_NONE;
+	} else if (strncmp(value, "record", 6) == 0) {
+		iface->durable.mode = CLI_DURABLE_RECORD;
+	} else {
+		while (sscanf(p, "%u%n", &n, &len) == 1) {
+			p += len;
+			if (strncmp(p, "ms", 2) == 0) {
+				ms = n;
+				p += 2;
+			} else {
+				records = n;
+				if (strncmp(p, "rec", 3) == 0) { p += 3; }
+			}
+			if (*p == '/') { p++; }
+		}
+
+		if ((*p != 0) || ((ms == 0) && (records == 0))) {
+			printw("Error: `if set' durability must be none, record, <N>ms or <N>rec.\n");
+		} else {
+			iface->durable.mode = CLI_DURABLE_PERIODIC;
+			iface->durable.ms = ms;
+			iface->durable.records = records;
+		}
+	}
+
+	// let the flusher pick up the new period
+	cli_flusher_kick(ctx);
+}
+
+/**
+ * Parses size and age limits such as 64MB, 12h or 10GB/24h.  Sizes take K,
+ * M or G (with an optional B), ages s, min or h.  Returns -1 if value is not
+ * of that form.
+ */
+static int cli_cmd_parse_limits(const char *value, unsigned long *bytes,
+	unsigned long *secs)
+{
+	const char *p = value;
+	unsigned long n;
+	int len;
+
+	*bytes = 0;
+	*secs = 0;
+
+	if (strncmp(value, "none", 4) == 0) { return 0; }
+
+	while (sscanf(p, "%lu%n", &n, &len) == 1) {
+		p += len;
+		switch (*p) {
+		case 'K': *bytes = n << 10; p++; break;
+		case 'M': *bytes = n << 20; p++; break;
+		case 'G': *bytes = n << 30; p++; break;
+		case 'B': *bytes = n; break;
+		case 'h': *secs = n * 3600; p++; break;
+		case 's': *secs = n; p++; break;
+		case 'm':
+			if (strncmp(p, "min", 3) != 0) { return -1; }
+			*secs = n * 60;
+			p += 3;
+			break;
+		default: return -1;
+		}
+
+		if (*p == 'B') { p++; }
+		if (*p == '/') { p++; }
+	}
+
+	return ((*p == 0) && (p != value) ? 0 : -1);
+}
+
+/**
+ * compress=none|zlib[:<level>]: whether sealed segments are compressed in
+ * the background.
+ */
+void cli_cmd_if_set_compress(cli_ctx *ctx, const char *value)
+{
+	cli_if *iface = ctx->ifs[ctx->ifsel];
+	unsigned int level = 6;
+
+	if (iface == NULL) { return; }
+
+	if (strncmp(value, "none", 4) == 0) {
+		iface->compress = 0;
+	} else if ((strncmp(value, "zlib", 4) != 0) ||
+		((value[4] == ':') && ((sscanf(value + 5, "%u", &level) < 1) ||
+		(level < 1) || (level > 9))) || ((value[4] != ':') && (value[4] != 0))) {
+		printw("Error: `if set' compress must be none, zlib or zlib:<1-9>.\n");
+	} else {
+#if HAVE_LIBZ
+		iface->compress = level;
+
+		// compression runs on the flusher
+		cli_flusher_kick(ctx);
+#else
+		printw("Error: `if set' compress needs cli built with zlib.\n");
+#endif
+	}
+}
+
+/**
+ * index=none|bloom: whether a search index is built for the records captured
+ * from now on.
+ */
+void cli_cmd_if_set_index(cli_ctx *ctx, const char *value)
+{
+	cli_if *iface = ctx->ifs[ctx->ifsel];
+
+	if (iface == NULL) { return; }
+
+	if (strncmp(value, "none", 4) == 0) {
+		iface->index = CLI_INDEX_NONE;
+	} else if (strncmp(value, "bloom", 5) == 0) {
+		iface->index = CLI_INDEX_BLOOM;
+	} else {
+		printw("Error: `if set' index must be none or bloom.\n");
+	}
+}
+
+/**
+ * rotate=<size>|<age>: when capture rolls over to a new segment.
+ */
+void cli_cmd_if_set_rotate(cli_ctx *ctx, const char *value)
+{
+	cli_if *iface = ctx->ifs[ctx->ifsel];
+	unsigned long bytes, secs;
+
+	if (iface == NULL) { return; }
+
+	if (cli_cmd_parse_limits(value, &bytes, &secs) == -1) {
+		printw("Error: `if set' rotate takes a size (64MB) and/or an age (1h).\n");
+	} else if (bytes > CLI_SEG_MAX_BYTES) {
+		printw("Error: `if set' segments are limited to %luMB.\n",
+			CLI_SEG_MAX_BYTES >> 20);
+	} else {
+		pthread_mutex_lock(&iface->lock);
+		iface->rotate_bytes = bytes;
+		iface->rotate_secs = secs;
+		pthread_mutex_unlock(&iface->lock);
+	}
+}
+
+/**
+ * retain=<size>|<age>: how much of the capture is kept on disk.
+ */
+void cli_cmd_if_set_retain(cli_ctx *ctx, const char *value)
+{
+	cli_if *iface = ctx->ifs[ctx->ifsel];
+	unsigned long bytes, secs;
+
+	if (iface == NULL) { return; }
+
+	if (cli_cmd_parse_limits(value, &bytes, &secs) == -1) {
+		printw("Error: `if set' retain takes a size (10GB) and/or an age (24h).\n");
+	} else {
+		iface->retain_bytes = bytes;
+		iface->retain_secs = secs;
+
+		// retention runs on the flusher
+		cli_flusher_kick(ctx);
+	}
+}
+
 void cli_cmd_if_set_ipaddr(cli_ctx *ctx, const char *value)
 {
 	cli_if *iface = ctx->ifs[ctx->ifsel];
@@ -120,6 +356,8 @@ void cli_cmd_if_set_devname(cli_ctx *ctx, const char *value)
 	if (iface != NULL) {
 		switch (iface->type) {
 		case CLI_TYPE_FILE:
+			// a replay may be writing to the file being swapped out
+			pthread_rwlock_wrlock(&ctx->iflock);
 			if (strncmp(iface->devname, "stdout", 6) != 0) {
 				fflush(iface->rxdev.fp);
 				fclose(iface->rxdev.fp);
@@ -130,6 +368,7 @@ void cli_cmd_if_set_devname(cli_ctx *ctx, const char *value)
 			} else {
 				iface->rxdev.fp = fopen(value, "wb");
 			}
+			pthread_rwlock_unlock(&ctx->iflock);
 			break;
 		default:
 			break;
@@ -219,6 +458,21 @@ void cli_cmd_if_set(cli_ctx *ctx)
 			cli_cmd_if_set_type(ctx, val);
 		} else if (strncmp(var, "buffer", 6) == 0) {
 			cli_cmd_if_set_buffersize(ctx, val);
+		} else if ((strncmp(var, "batch", 5) == 0) &&
+					(ctx->ifs[ctx->ifsel]->type == CLI_TYPE_UDP)) {
+			cli_cmd_if_set_batch(ctx, val);
+		} else if (strncmp(var, "rotate", 6) == 0) {
+			cli_cmd_if_set_rotate(ctx, val);
+		} else if (strncmp(var, "retain", 6) == 0) {
+			cli_cmd_if_set_retain(ctx, val);
+		} else if (strncmp(var, "compress", 8) == 0) {
+			cli_cmd_if_set_compress(ctx, val);
+		} else if (strncmp(var, "index", 5) == 0) {
+			cli_cmd_if_set_index(ctx, val);
+		} else if (strncmp(var, "durability", 10) == 0) {
+			cli_cmd_if_set_durable(ctx, val);
+		} else if (strncmp(var, "overload", 8) == 0) {
+			cli_cmd_if_set_overload(ctx, val);
 		} else if (strncmp(var, "rxmode", 6) == 0) {
 			cli_cmd_if_set_xmode(&ctx->ifs[ctx->ifsel]->rxmode, val);
 		} else if (strncmp(var, "txmode", 6) == 0) {
@@ -228,10 +482,7 @@ void cli_cmd_if_set(cli_ctx *ctx)
 		}
 	}
 	
-	fseek(ctx->ifs[ctx->ifsel]->offset, 0, SEEK_SET);
-	fwrite(ctx->ifs[ctx->ifsel], 1,
-		sizeof(cli_if), ctx->ifs[ctx->ifsel]->offset);
-	fseek(ctx->ifs[ctx->ifsel]->offset, 0, SEEK_END);
+	cli_write_if(ctx->ifs[ctx->ifsel]);
 }
 
 /**
@@ -22,6 +22,7 @@ void cli_cmd_add(cli_ctx *ctx);
 void cli_cmd_tie(cli_ctx *ctx);
 void cli_cmd_cd(cli_ctx *ctx);
 void cli_cmd_tx(cli_ctx *ctx);
+void cli_cmd_tx_file(cli_ctx *ctx);
 void cli_cmd_if(cli_ctx *ctx);
 void cli_cmd_ls(cli_ctx *ctx);
 void cli_cmd_session(cli_ctx *ctx);
@@ -29,11 +30,20 @@ void cli_cmd_cwd(cli_ctx *ctx);
 void cli_cmd_history(cli_ctx *ctx);
 void cli_cmd_save(cli_ctx *ctx);
 void cli_cmd_load(cli_ctx *ctx);
+void cli_cmd_export(cli_ctx *ctx);
+void cli_cmd_replay(cli_ctx *ctx);
 void cli_cmd_rx(cli_ctx *ctx);
 void cli_cmd_flush(cli_ctx *ctx);
 
 void cli_cmd_if_set(cli_ctx *ctx);
 void cli_cmd_if_set_type(cli_ctx *ctx, const char *value);
+void cli_cmd_if_set_batch(cli_ctx *ctx, const char *value);
+void cli_cmd_if_set_overload(cli_ctx *ctx, const char *value);
+void cli_cmd_if_set_durable(cli_ctx *ctx, const char *value);
+void cli_cmd_if_set_rotate(cli_ctx *ctx, const char *value);
+void cli_cmd_if_set_retain(cli_ctx *ctx, const char *value);
+void cli_cmd_if_set_compress(cli_ctx *ctx, const char *value);
+void cli_cmd_if_set_index(cli_ctx *ctx, const char *value);
 void cli_cmd_if_set_ipaddr(cli_ctx *ctx, const char *value);
 void cli_cmd_if_set_ipport(cli_ctx *ctx, const char *value);
 void cli_cmd_if_set_devname(cli_ctx *ctx, const char *value);
@@ -0,0 +1,279 @@
+/*
+ * cli_flush.c - background flusher making capture files durable
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+
+#include "clibase.h"
+#include "cli_store.h"
+#include "cli_seg.h"
+#include "cli_cap.h"
+#include "cli_flush.h"
+
+// how often retention limits are checked
+#define CLI_FLUSH_RETAIN_MS	1000
+
+// how soon background compression continues while there is work left
+#define CLI_FLUSH_PACK_MS	10
+
+static unsigned long cli_flusher_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000UL) + (ts.tv_nsec / 1000);
+}
+
+/**
+ * Group commit: forces everything the capture writer has published for iface
+ * to disk with one sync per file, data before offsets, and accounts for it.
+ * Segments that were rolled over have been synced by the writer already, so
+ * only the active one needs it.
+ */
+static void cli_flusher_commit(cli_if *iface)
+{
+	cli_durable *d = &iface->durable;
+	unsigned int count, batch;
+	unsigned long t0, t1;
+	cli_seg *seg;
+
+	pthread_mutex_lock(&iface->lock);
+	count = iface->rx_count;
+	seg = cli_seg_active(iface);
+	if (seg != NULL) { __atomic_add_fetch(&seg->ref, 1, __ATOMIC_RELAXED); }
+	pthread_mutex_unlock(&iface->lock);
+
+	batch = count - d->synced;
+	if ((batch == 0) || (seg == NULL)) {
+		cli_seg_put(seg);
+		return;
+	}
+
+	t0 = cli_flusher_usec();
+	cli_store_sync(seg->buffer);
+	cli_store_sync(seg->peer);
+	cli_store_sync(seg->offset);
+	t1 = cli_flusher_usec();
+
+	cli_seg_put(seg);
+
+	d->last = t1 / 1000;
+	d->commits++;
+	d->batch_total += batch;
+	if (batch > d->batch_max) { d->batch_max = batch; }
+	d->usec_total += t1 - t0;
+	if (t1 - t0 > d->usec_max) { d->usec_max = t1 - t0; }
+
+	__atomic_store_n(&d->synced, count, __ATOMIC_RELEASE);
+}
+
+/**
+ * Whether iface has records that its policy wants on disk by now.
+ */
+static int cli_flusher_due(cli_if *iface, unsigned long now, int final)
+{
+	cli_durable *d = &iface->durable;
+	unsigned int pending = iface->rx_count - d->synced;
+
+	if ((pending == 0) || (d->mode == CLI_DURABLE_NONE)) { return 0; }
+	if ((final) || (d->mode == CLI_DURABLE_RECORD)) { return 1; }
+
+	return (((d->ms > 0) && (now - d->last >= d->ms)) ||
+		((d->records > 0) && (pending >= d->records)));
+}
+
+/**
+ * One round over the interfaces: commits what is due, enforces segment
+ * retention and compresses a slice of the sealed segments.  Returns how long
+ * the flusher may sleep (0: no limit), which is the shortest commit period
+ * among the periodic interfaces, or CLI_FLUSH_RETAIN_MS if retention or
+ * compression have to be checked sooner (CLI_FLUSH_PACK_MS while compression
+ * is behind).
+ */
+static unsigned int cli_flusher_pass(cli_ctx *ctx, int final)
+{
+	unsigned int i, n, tick = 0, removed = 0;
+	unsigned long now = cli_flusher_usec() / 1000;
+	cli_manifestent ents[CLI_DEFAULT_BUFFER];
+	char dir[CLI_DEFAULT_BUFFER];
+	cli_if *iface;
+
+	pthread_rwlock_rdlock(&ctx->iflock);
+	for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
+		iface = ctx->ifs[i];
+		if ((iface == NULL) || (iface->header != 'i')) { continue; }
+
+		if (cli_flusher_due(iface, now, final)) { cli_flusher_commit(iface); }
+
+		if ((iface->retain_bytes > 0) || (iface->retain_secs > 0)) {
+			removed += cli_seg_retain(iface, time(NULL));
+			if ((tick == 0) || (tick > CLI_FLUSH_RETAIN_MS)) {
+				tick = CLI_FLUSH_RETAIN_MS;
+			}
+		}
+
+		// compression comes in slices so it cannot hold up commits for long
+		if ((iface->compress > 0) && (!final)) {
+			if (cli_seg_compress(iface, iface->compress)) {
+				tick = CLI_FLUSH_PACK_MS;
+			} else if ((tick == 0) || (tick > CLI_FLUSH_RETAIN_MS)) {
+				tick = CLI_FLUSH_RETAIN_MS;
+			}
+		}
+
+		if ((iface->durable.mode == CLI_DURABLE_PERIODIC) &&
+			(iface->durable.ms > 0) &&
+			((tick == 0) || (iface->durable.ms < tick))) {
+			tick = iface->durable.ms;
+		}
+	}
+
+	// so that reloading does not go looking for what retention removed; a
+	// session directory too long to name is left to the directory scan
+	if ((removed > 0) && (snprintf(dir, CLI_DEFAULT_BUFFER, "%s/%08x", ctx->pwd,
+		ctx->pid) < CLI_DEFAULT_BUFFER)) {
+		pthread_mutex_lock(&ctx->mflock);
+		n = cli_cap_manifest(ctx->ifs, CLI_DEFAULT_BUFFER, ents);
+		cli_cap_write_manifest(dir, ents, n);
+		pthread_mutex_unlock(&ctx->mflock);
+	}
+	pthread_rwlock_unlock(&ctx->iflock);
+
+	return tick;
+}
+
+void *cli_flusher_interrupt(void *pvctx)
+{
+	cli_ctx *ctx = (cli_ctx *)pvctx;
+	cli_flusher *f = &ctx->flusher;
+	struct timespec ts;
+	unsigned int tick = 0;
+
+	pthread_mutex_lock(&f->lock);
+	while (!f->stop) {
+		if (tick > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts.tv_sec += tick / 1000;
+			ts.tv_nsec += (tick % 1000) * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&f->wake, &f->lock, &ts);
+		} else {
+			pthread_cond_wait(&f->wake, &f->lock);
+		}
+		pthread_mutex_unlock(&f->lock);
+
+		tick = cli_flusher_pass(ctx, 0);
+
+		pthread_mutex_lock(&f->lock);
+		pthread_cond_broadcast(&f->done);
+	}
+	pthread_mutex_unlock(&f->lock);
+
+	// whatever the policies, leave nothing a policy covers behind
+	cli_flusher_pass(ctx, 1);
+
+	pthread_exit(NULL);
+}
+
+int cli_flusher_start(cli_ctx *ctx)
+{
+	cli_flusher *f = &ctx->flusher;
+	pthread_condattr_t attr;
+
+	f->stop = 0;
+	f->running = 0;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&f->lock, NULL);
+	pthread_cond_init(&f->wake, &attr);
+	pthread_cond_init(&f->done, NULL);
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_create(&f->thread, NULL, cli_flusher_interrupt, (void *)ctx) != 0) {
+		return -1;
+	}
+	f->running = 1;
+
+	return 0;
+}
+
+/**
+ * Makes a final commit and ends the flusher.  The capture writer must already
+ * be stopped.
+ */
+void cli_flusher_stop(cli_ctx *ctx)
+{
+	cli_flusher *f = &ctx->flusher;
+
+	if (f->running) {
+		pthread_mutex_lock(&f->lock);
+		f->stop = 1;
+		pthread_cond_signal(&f->wake);
+		pthread_mutex_unlock(&f->lock);
+
+		pthread_join(f->thread, NULL);
+		f->running = 0;
+	} else {
+		cli_flusher_pass(ctx, 1);
+	}
+
+	pthread_cond_destroy(&f->wake);
+	pthread_cond_destroy(&f->done);
+	pthread_mutex_destroy(&f->lock);
+}
+
+void cli_flusher_kick(cli_ctx *ctx)
+{
+	pthread_mutex_lock(&ctx->flusher.lock);
+	pthread_cond_signal(&ctx->flusher.wake);
+	pthread_mutex_unlock(&ctx->flusher.lock);
+}
+
+/**
+ * Called by the capture writer after each commit.  Periodic interfaces that
+ * reached their record limit get the flusher going; per-record interfaces
+ * wait until the commit is on disk, and whatever queues up in the meantime
+ * goes into the next group.
+ */
+void cli_flusher_note(cli_ctx *ctx, cli_if *iface)
+{
+	cli_flusher *f = &ctx->flusher;
+	cli_durable *d = &iface->durable;
+	unsigned int count = iface->rx_count;
+
+	switch (d->mode) {
+	case CLI_DURABLE_PERIODIC:
+		if ((d->records > 0) && (count - d->synced >= d->records)) {
+			cli_flusher_kick(ctx);
+		}
+		break;
+	case CLI_DURABLE_RECORD:
+		if (!f->running) {
+			cli_flusher_commit(iface);
+			break;
+		}
+
+		pthread_mutex_lock(&f->lock);
+		while ((int)(count - __atomic_load_n(&d->synced, __ATOMIC_ACQUIRE)) > 0) {
+			pthread_cond_signal(&f->wake);
+			pthread_cond_wait(&f->done, &f->lock);
+		}
+		pthread_mutex_unlock(&f->lock);
+		break;
+	default:
+		break;
+	}
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "clibase.h"
+
+int cli_flusher_start(cli_ctx *ctx);
+void cli_flusher_stop(cli_ctx *ctx);
+void cli_flusher_kick(cli_ctx *ctx);
+
+// capture writer, after committing records to iface
+void cli_flusher_note(cli_ctx *ctx, cli_if *iface);
@@ -0,0 +1,198 @@
+/*
+ * cli_fmt.c - formatting of records for display and file sinks
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <string.h>
+
+#include "clibase.h"
+#include "cli_fmt.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// lookup tables of what each byte value turns into, built by the compiler
+#define CLI_FMT_4(e, n)		e(n), e((n) + 1), e((n) + 2), e((n) + 3)
+#define CLI_FMT_16(e, n)	CLI_FMT_4(e, n), CLI_FMT_4(e, (n) + 4), \
+	CLI_FMT_4(e, (n) + 8), CLI_FMT_4(e, (n) + 12)
+#define CLI_FMT_64(e, n)	CLI_FMT_16(e, n), CLI_FMT_16(e, (n) + 16), \
+	CLI_FMT_16(e, (n) + 32), CLI_FMT_16(e, (n) + 48)
+#define CLI_FMT_256(e)		CLI_FMT_64(e, 0), CLI_FMT_64(e, 64), \
+	CLI_FMT_64(e, 128), CLI_FMT_64(e, 192)
+
+#define CLI_FMT_DIGIT(d)	((d) < 10 ? '0' + (d) : 'a' + (d) - 10)
+#define CLI_FMT_HEX(n)		{ CLI_FMT_DIGIT((n) >> 4), CLI_FMT_DIGIT((n) & 15) }
+#define CLI_FMT_OCT(n)		{ '0' + ((n) >> 6), '0' + (((n) >> 3) & 7), \
+	'0' + ((n) & 7) }
+#define CLI_FMT_BIN(n)		{ '0' + (((n) >> 7) & 1), '0' + (((n) >> 6) & 1), \
+	'0' + (((n) >> 5) & 1), '0' + (((n) >> 4) & 1), '0' + (((n) >> 3) & 1), \
+	'0' + (((n) >> 2) & 1), '0' + (((n) >> 1) & 1), '0' + ((n) & 1) }
+// what isprint() takes in the C locale, and newlines
+#define CLI_FMT_SHOWN(n)	((((n) >= 0x20) && ((n) < 0x7f)) || ((n) == '\n'))
+
+static const char cli_fmt_hex[256][2] = { CLI_FMT_256(CLI_FMT_HEX) };
+static const char cli_fmt_oct[256][3] = { CLI_FMT_256(CLI_FMT_OCT) };
+static const char cli_fmt_bin[256][8] = { CLI_FMT_256(CLI_FMT_BIN) };
+static const unsigned char cli_fmt_shown[256] = { CLI_FMT_256(CLI_FMT_SHOWN) };
+
+/**
+ * Copies the w characters the table tab has for each byte of in to out,
+ * each followed by a space if sep is set.  Called with constants, so that
+ * every mode gets a loop of its own.
+ */
+static inline size_t cli_fmt_run(const char *tab, unsigned int w, int sep,
+	const unsigned char *in, size_t len, char *out)
+{
+	char *o = out;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		memcpy(o, tab + (in[i] * w), w);
+		o += w;
+		if (sep) { *o++ = ' '; }
+	}
+
+	return o - out;
+}
+
+#ifdef __SSE2__
+/**
+ * Hex encodes in 16 bytes at a time.  Returns how many bytes it did; the
+ * rest is left to the table.
+ */
+static size_t cli_fmt_hex_sse2(const unsigned char *in, size_t len, char *out)
+{
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i digit = _mm_set1_epi8('0');
+	const __m128i letter = _mm_set1_epi8('a' - '0' - 10);
+	__m128i v, hi, lo;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(in + i));
+		hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+		lo = _mm_and_si128(v, nibble);
+
+		// nibbles over 9 move on from the digits to the letters
+		hi = _mm_add_epi8(_mm_add_epi8(hi, digit),
+			_mm_and_si128(_mm_cmpgt_epi8(hi, nine), letter));
+		lo = _mm_add_epi8(_mm_add_epi8(lo, digit),
+			_mm_and_si128(_mm_cmpgt_epi8(lo, nine), letter));
+
+		_mm_storeu_si128((__m128i *)(out + (2 * i)), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(out + (2 * i) + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+
+	return i;
+}
+#endif
+
+/**
+ * Bytes shown per line in mode.  Text takes up to CLI_FMT_LINE bytes at a
+ * time and breaks lines where the data does.
+ */
+unsigned int cli_fmt_width(cli_if_mode mode)
+{
+	switch (mode) {
+	case CLI_MODE_HEX: return 24;
+	case CLI_MODE_OCTAL: return 20;
+	case CLI_MODE_BINARY: return 8;
+	default: return CLI_FMT_LINE;
+	}
+}
+
+/**
+ * Formats the bytes of in, at most cli_fmt_width(mode) of them, into one
+ * line of out, which must hold CLI_FMT_LINE characters: each byte followed
+ * by a space, and a newline once the line is full.  Text is shown as by
+ * cli_fmt_text.  Returns the characters written; out is not terminated.
+ */
+size_t cli_fmt_line(cli_if_mode mode, const unsigned char *in, size_t len,
+	char *out)
+{
+	size_t n;
+
+	if (len > cli_fmt_width(mode)) { len = cli_fmt_width(mode); }
+
+	switch (mode) {
+	case CLI_MODE_HEX:
+		n = cli_fmt_run(cli_fmt_hex[0], 2, 1, in, len, out);
+		break;
+	case CLI_MODE_OCTAL:
+		n = cli_fmt_run(cli_fmt_oct[0], 3, 1, in, len, out);
+		break;
+	case CLI_MODE_BINARY:
+		n = cli_fmt_run(cli_fmt_bin[0], 8, 1, in, len, out);
+		break;
+	default:
+		return cli_fmt_text(in, len, out);
+	}
+
+	if (len == cli_fmt_width(mode)) { out[n++] = '\n'; }
+
+	return n;
+}
+
+/**
+ * Copies the printable bytes and newlines of in to out, which must hold len
+ * characters, leaving out the rest.  Returns how many it copied.
+ */
+size_t cli_fmt_text(const unsigned char *in, size_t len, char *out)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < len; i++) {
+		out[n] = in[i];
+		n += cli_fmt_shown[in[i]];
+	}
+
+	return n;
+}
+
+/**
+ * Copies in to out, which must hold len characters, with a dot for every
+ * byte that is not printable, as the text column of a hex dump.
+ */
+void cli_fmt_ascii(const unsigned char *in, size_t len, char *out)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		out[i] = ((cli_fmt_shown[in[i]]) && (in[i] != '\n') ? in[i] : '.');
+	}
+}
+
+/**
+ * Encodes the bytes of in back to back, as typed in mode and as file
+ * interfaces write them, into out, which must hold len * CLI_FMT_MAX
+ * characters.  rxmode zlib data is encoded as hex.  Returns the characters
+ * written; out is not terminated.
+ */
+size_t cli_fmt_bytes(cli_if_mode mode, const unsigned char *in, size_t len,
+	char *out)
+{
+	size_t i = 0;
+
+	switch (mode) {
+	case CLI_MODE_HEX:
+	case CLI_MODE_Z:
+#ifdef __SSE2__
+		i = cli_fmt_hex_sse2(in, len, out);
+#endif
+		return (2 * i) + cli_fmt_run(cli_fmt_hex[0], 2, 0, in + i, len - i,
+			out + (2 * i));
+	case CLI_MODE_OCTAL:
+		return cli_fmt_run(cli_fmt_oct[0], 3, 0, in, len, out);
+	case CLI_MODE_BINARY:
+		return cli_fmt_run(cli_fmt_bin[0], 8, 0, in, len, out);
+	default:
+		memcpy(out, in, len);
+		return len;
+	}
+}
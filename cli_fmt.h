@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "clibase.h"
+
+// characters of a formatted line, the newline included, and the most bytes
+// of text taken per line
+#define CLI_FMT_LINE	128
+// characters a byte takes up at most when encoded (binary)
+#define CLI_FMT_MAX	8
+
+unsigned int cli_fmt_width(cli_if_mode mode);
+size_t cli_fmt_line(cli_if_mode mode, const unsigned char *in, size_t len,
+	char *out);
+size_t cli_fmt_text(const unsigned char *in, size_t len, char *out);
+void cli_fmt_ascii(const unsigned char *in, size_t len, char *out);
+size_t cli_fmt_bytes(cli_if_mode mode, const unsigned char *in, size_t len,
+	char *out);
@@ -0,0 +1,188 @@
+/*
+ * cli_inflate.c - streaming zlib decoding of rxmode zlib interfaces
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#include "clibase.h"
+#include "cli.h"
+#include "cli_inflate.h"
+
+#if HAVE_LIBZ
+static unsigned long cli_inflate_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+/**
+ * Sets up the inflate state of iface on its first compressed read.  zlib and
+ * gzip streams are both accepted.
+ */
+static int cli_inflate_init(cli_if *iface)
+{
+	z_stream *zs;
+
+	if (iface->zin != NULL) { return 0; }
+
+	zs = (z_stream *)malloc(sizeof(z_stream));
+	iface->zout = (char *)malloc(CLI_RX_BATCH * CLI_MAX_BUFFER);
+	if ((zs == NULL) || (iface->zout == NULL)) {
+		free(zs);
+		free(iface->zout);
+		iface->zout = NULL;
+		return -1;
+	}
+
+	memset(zs, 0, sizeof(z_stream));
+	if (inflateInit2(zs, 15 + 32) != Z_OK) {
+		free(zs);
+		free(iface->zout);
+		iface->zout = NULL;
+		return -1;
+	}
+
+	iface->zin = zs;
+	return 0;
+}
+#endif
+
+/**
+ * Commits n records read by an interface.  In rxmode zlib they are fed
+ * through the interface's inflate stream first, which carries over from one
+ * read to the next, and whatever they inflate to is committed instead, in
+ * records of up to CLI_MAX_BUFFER bytes that take the time and source of the
+ * read that completed them.  Nothing waits for the end of a stream.  Input
+ * that does not inflate is kept as received, flagged CLI_REC_RAW, and the
+ * stream starts over with the next read.  Only the capture writer of iface
+ * (or its rx thread, if there is no writer) may call this.
+ */
+void cli_inflate_batch(cli_ctx *ctx, cli_if *iface, cli_rec *recs,
+	unsigned int n)
+{
+#if HAVE_LIBZ
+	cli_rec out[CLI_RX_BATCH];
+	cli_zstat st;
+	z_stream *zs;
+	char *head;
+	unsigned int i, k = 0, len;
+	unsigned long start;
+	int ret;
+
+	if ((iface->rxmode != CLI_MODE_Z) || (cli_inflate_init(iface) == -1)) {
+		cli_handle_rx_batch(ctx, iface, recs, n);
+		return;
+	}
+
+	zs = (z_stream *)iface->zin;
+	memset(&st, 0, sizeof(cli_zstat));
+
+	for (i = 0; i < n; i++) {
+		zs->next_in = (Bytef *)recs[i].data;
+		zs->avail_in = recs[i].len;
+		st.in += recs[i].len;
+		head = recs[i].data;
+
+		// also drains output left over when the last slot filled up
+		do {
+			if (k == CLI_RX_BATCH) {
+				cli_handle_rx_batch(ctx, iface, out, k);
+				k = 0;
+			}
+
+			zs->next_out = (Bytef *)(iface->zout + (k * CLI_MAX_BUFFER));
+			zs->avail_out = CLI_MAX_BUFFER;
+
+			start = cli_inflate_clock();
+			ret = inflate(zs, Z_SYNC_FLUSH);
+			st.nsec += cli_inflate_clock() - start;
+
+			len = CLI_MAX_BUFFER - zs->avail_out;
+			if (len > 0) {
+				out[k] = recs[i];
+				out[k].buf = NULL;
+				out[k].data = iface->zout + (k * CLI_MAX_BUFFER);
+				out[k].len = len;
+				out[k].flags &= ~CLI_REC_TRUNC;
+				st.out += len;
+				k++;
+			}
+
+			if (ret == Z_STREAM_END) {
+				// concatenated streams follow each other
+				inflateReset(zs);
+				head = (char *)zs->next_in;
+				st.streams++;
+			} else if ((ret != Z_OK) && (ret != Z_BUF_ERROR)) {
+				st.errors++;
+				// a stream that never got going is kept from its first byte
+				if (zs->total_out == 0) {
+					zs->avail_in += (char *)zs->next_in - head;
+					zs->next_in = (Bytef *)head;
+				}
+				if (zs->avail_in > 0) {
+					if (k == CLI_RX_BATCH) {
+						cli_handle_rx_batch(ctx, iface, out, k);
+						k = 0;
+					}
+					out[k] = recs[i];
+					out[k].buf = NULL;
+					out[k].data = (char *)zs->next_in;
+					out[k].len = zs->avail_in;
+					out[k].flags |= CLI_REC_RAW;
+					k++;
+				}
+				inflateReset(zs);
+				break;
+			} else if (len == 0) {
+				// needs more input
+				break;
+			}
+		} while ((zs->avail_in > 0) || (zs->avail_out == 0));
+	}
+
+	// the output points into zout (and the raw input into recs), so it
+	// is committed before the records are given back
+	cli_handle_rx_batch(ctx, iface, out, k);
+
+	__atomic_add_fetch(&iface->zstat.in, st.in, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&iface->zstat.out, st.out, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&iface->zstat.nsec, st.nsec, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&iface->zstat.streams, st.streams, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&iface->zstat.errors, st.errors, __ATOMIC_RELAXED);
+#else
+	cli_handle_rx_batch(ctx, iface, recs, n);
+#endif
+}
+
+/**
+ * Throws away the inflate state of iface.
+ */
+void cli_inflate_free(cli_if *iface)
+{
+#if HAVE_LIBZ
+	if (iface->zin != NULL) {
+		inflateEnd((z_stream *)iface->zin);
+		free(iface->zin);
+	}
+#endif
+	free(iface->zout);
+	iface->zin = NULL;
+	iface->zout = NULL;
+}
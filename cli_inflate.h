@@ -0,0 +1,7 @@
+#pragma once
+
+#include "clibase.h"
+
+void cli_inflate_batch(cli_ctx *ctx, cli_if *iface, cli_rec *recs,
+	unsigned int n);
+void cli_inflate_free(cli_if *iface);
@@ -0,0 +1,351 @@
+/*
+ * cli_pcap.c - pcapng export of tcp and udp interface captures
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "clibase.h"
+#include "cli_store.h"
+#include "cli_seg.h"
+#include "cli_pcap.h"
+
+// blocks are written out this many bytes at a time
+#define CLI_PCAP_BUFFER		(1UL << 20)
+
+#define CLI_PCAP_SHB		0x0a0d0d0a
+#define CLI_PCAP_IDB		0x00000001
+#define CLI_PCAP_EPB		0x00000006
+#define CLI_PCAP_MAGIC		0x1a2b3c4d
+#define CLI_PCAP_ETHERNET	1
+
+#define CLI_PCAP_ETH		14
+#define CLI_PCAP_IP			20
+#define CLI_PCAP_TCP		20
+#define CLI_PCAP_UDP		8
+
+// largest enhanced packet block: its fields, the headers and a record
+#define CLI_PCAP_MAXBLOCK	(32 + CLI_PCAP_ETH + CLI_PCAP_IP + CLI_PCAP_TCP + \
+	CLI_MAX_BUFFER + 4)
+
+static char *cli_pcap_put16(char *p, uint16_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static char *cli_pcap_put32(char *p, uint32_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+/**
+ * Adds len bytes at p to an internet checksum, in the byte order they are
+ * in; odd lengths only at the end.
+ */
+static uint64_t cli_pcap_sum(const char *p, size_t len, uint64_t sum)
+{
+	uint32_t w;
+	uint16_t h = 0;
+
+	for (; len >= 4; p += 4, len -= 4) {
+		memcpy(&w, p, 4);
+		sum += w;
+	}
+	if (len >= 2) {
+		memcpy(&h, p, 2);
+		sum += h;
+		p += 2;
+		len -= 2;
+	}
+	if (len > 0) {
+		h = 0;
+		memcpy(&h, p, 1);
+		sum += h;
+	}
+
+	return sum;
+}
+
+static uint16_t cli_pcap_fold(uint64_t sum)
+{
+	while (sum >> 16) { sum = (sum & 0xffff) + (sum >> 16); }
+	return (uint16_t)~sum;
+}
+
+static int cli_pcap_flush(cli_pcap *p)
+{
+	unsigned long off = 0;
+	ssize_t n;
+
+	while ((off < p->len) && (!p->err)) {
+		n = write(p->fd, p->buf + off, p->len - off);
+		if (n > 0) {
+			off += n;
+		} else if ((n == -1) && (errno != EINTR)) {
+			p->err = errno;
+		}
+	}
+	p->len = 0;
+
+	return (p->err ? -1 : 0);
+}
+
+/**
+ * Starts a pcapng section for the records of iface, written to fd: the
+ * section header and an ethernet interface with nanosecond timestamps.  The
+ * local end of the interface's traffic is not captured, so it is local if
+ * given, or 127.0.0.1.  Returns NULL unless iface is a tcp or udp one.
+ */
+cli_pcap *cli_pcap_open(cli_if *iface, int fd, const struct sockaddr_in *local)
+{
+	cli_pcap *p;
+	char name[8], *q;
+	unsigned int namelen, idblen;
+
+	if ((iface->type != CLI_TYPE_TCP) && (iface->type != CLI_TYPE_UDP)) {
+		return NULL;
+	}
+
+	if ((p = (cli_pcap *)malloc(sizeof(cli_pcap))) == NULL) { return NULL; }
+	memset(p, 0, sizeof(cli_pcap));
+
+	if ((p->buf = (char *)malloc(CLI_PCAP_BUFFER)) == NULL) {
+		free(p);
+		return NULL;
+	}
+
+	p->fd = fd;
+	p->iface = iface;
+	p->proto = (iface->type == CLI_TYPE_TCP ? IPPROTO_TCP : IPPROTO_UDP);
+	p->remote = iface->sock;
+	p->seq[CLI_DIR_RX] = 1;
+	p->seq[CLI_DIR_TX] = 1;
+
+	if ((local != NULL) && (local->sin_family == AF_INET)) {
+		p->local = *local;
+	} else {
+		p->local.sin_family = AF_INET;
+		p->local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		p->local.sin_port = htons(49152 + iface->id);
+	}
+
+	// section header block
+	q = p->buf;
+	q = cli_pcap_put32(q, CLI_PCAP_SHB);
+	q = cli_pcap_put32(q, 28);
+	q = cli_pcap_put32(q, CLI_PCAP_MAGIC);
+	q = cli_pcap_put16(q, 1);
+	q = cli_pcap_put16(q, 0);
+	q = cli_pcap_put32(q, 0xffffffff);	// section length not known
+	q = cli_pcap_put32(q, 0xffffffff);
+	q = cli_pcap_put32(q, 28);
+
+	// interface description block, named after the interface
+	namelen = snprintf(name, sizeof(name), "if%02x", iface->id);
+	idblen = 20 + 4 + ((namelen + 3) & ~3) + 4 + 4 + 4;
+	q = cli_pcap_put32(q, CLI_PCAP_IDB);
+	q = cli_pcap_put32(q, idblen);
+	q = cli_pcap_put16(q, CLI_PCAP_ETHERNET);
+	q = cli_pcap_put16(q, 0);
+	q = cli_pcap_put32(q, 0);			// no snap length
+	q = cli_pcap_put16(q, 2);			// if_name
+	q = cli_pcap_put16(q, namelen);
+	memset(q, 0, (namelen + 3) & ~3);
+	memcpy(q, name, namelen);
+	q += (namelen + 3) & ~3;
+	q = cli_pcap_put16(q, 9);			// if_tsresol: nanoseconds
+	q = cli_pcap_put16(q, 1);
+	memset(q, 0, 4);
+	*q = 9;
+	q += 4;
+	q = cli_pcap_put32(q, 0);			// opt_endofopt
+	q = cli_pcap_put32(q, idblen);
+
+	p->len = q - p->buf;
+
+	return p;
+}
+
+/**
+ * Builds the link, ip and tcp or udp headers in front of len bytes of data
+ * at h going in direction dir, from src to dst.  Returns how long they are.
+ */
+static unsigned int cli_pcap_headers(cli_pcap *p, char *h, unsigned int dir,
+	const struct sockaddr_in *src, const struct sockaddr_in *dst,
+	unsigned int len)
+{
+	static const char mac[2][6] = {
+		{ 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },	// local
+		{ 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 }	// remote
+	};
+	unsigned int l4 = (p->proto == IPPROTO_TCP ? CLI_PCAP_TCP : CLI_PCAP_UDP);
+	char *ip = h + CLI_PCAP_ETH, *th = ip + CLI_PCAP_IP, *q;
+	uint64_t sum;
+	uint16_t csum = 0;
+
+	// ethernet
+	memcpy(h, mac[dir == CLI_DIR_TX], 6);
+	memcpy(h + 6, mac[dir != CLI_DIR_TX], 6);
+	cli_pcap_put16(h + 12, htons(0x0800));
+
+	// ipv4, don't fragment
+	q = ip;
+	*q++ = 0x45;
+	*q++ = 0;
+	q = cli_pcap_put16(q, htons(CLI_PCAP_IP + l4 + len));
+	q = cli_pcap_put16(q, htons(p->ipid++));
+	q = cli_pcap_put16(q, htons(0x4000));
+	*q++ = 64;
+	*q++ = p->proto;
+	q = cli_pcap_put16(q, 0);
+	memcpy(q, &src->sin_addr.s_addr, 4);
+	memcpy(q + 4, &dst->sin_addr.s_addr, 4);
+	csum = cli_pcap_fold(cli_pcap_sum(ip, CLI_PCAP_IP, 0));
+	cli_pcap_put16(ip + 10, csum);
+
+	q = th;
+	q = cli_pcap_put16(q, src->sin_port);
+	q = cli_pcap_put16(q, dst->sin_port);
+	if (p->proto == IPPROTO_TCP) {
+		// one stream each way, acknowledging everything the other sent
+		q = cli_pcap_put32(q, htonl(p->seq[dir]));
+		q = cli_pcap_put32(q, htonl(p->seq[!dir]));
+		*q++ = 0x50;
+		*q++ = 0x18;					// psh, ack
+		q = cli_pcap_put16(q, htons(65535));
+		q = cli_pcap_put16(q, 0);
+		q = cli_pcap_put16(q, 0);
+		p->seq[dir] += len;
+	} else {
+		q = cli_pcap_put16(q, htons(CLI_PCAP_UDP + len));
+		q = cli_pcap_put16(q, 0);
+	}
+
+	// pseudo header, transport header and data
+	sum = cli_pcap_sum(ip + 12, 8, 0);
+	sum += htons(p->proto);
+	sum += htons(l4 + len);
+	sum = cli_pcap_sum(th, l4, sum);
+	sum = cli_pcap_sum(th + l4, len, sum);
+	csum = cli_pcap_fold(sum);
+	if ((p->proto == IPPROTO_UDP) && (csum == 0)) { csum = 0xffff; }
+	cli_pcap_put16(th + (p->proto == IPPROTO_TCP ? 16 : 6), csum);
+
+	return CLI_PCAP_ETH + CLI_PCAP_IP + l4;
+}
+
+/**
+ * Adds record rec of the interface as an enhanced packet block.  Received
+ * records come from their source address if one was kept, or from the
+ * interface's; sent ones go to the interface's.  Records without a time
+ * (version 1 sessions) take the time their segment was started.  Records
+ * that are gone are left out.  Returns -1 if writing failed.
+ */
+int cli_pcap_write(cli_pcap *p, unsigned int rec)
+{
+	struct sockaddr_in peer;
+	cli_rechdr rh;
+	char *b, *h;
+	unsigned int hdr, hlen, pad;
+	unsigned long ts;
+	int len;
+
+	if ((p->len + CLI_PCAP_MAXBLOCK > CLI_PCAP_BUFFER) &&
+		(cli_pcap_flush(p) == -1)) {
+		return -1;
+	}
+
+	// a segment at a time is kept in memory
+	p->seg = cli_seg_walk(p->iface, p->seg, rec);
+	if (p->seg == NULL) { return 0; }
+
+	// the record goes straight where it belongs in the block
+	b = p->buf + p->len;
+	hdr = CLI_PCAP_ETH + CLI_PCAP_IP +
+		(p->proto == IPPROTO_TCP ? CLI_PCAP_TCP : CLI_PCAP_UDP);
+	h = b + 28;
+	if ((len = cli_seg_copy(p->seg, rec, h + hdr, CLI_MAX_BUFFER, &rh,
+		&peer)) < 0) {
+		return 0;
+	}
+
+	if (rh.dir == CLI_DIR_TX) {
+		hlen = cli_pcap_headers(p, h, CLI_DIR_TX, &p->local, &p->remote, len);
+	} else {
+		hlen = cli_pcap_headers(p, h, CLI_DIR_RX,
+			(peer.sin_family == AF_INET ? &peer : &p->remote), &p->local, len);
+	}
+
+	ts = (rh.ts != 0 ? rh.ts : (unsigned long)p->seg->created * 1000000000UL);
+	pad = (4 - ((hlen + len) & 3)) & 3;
+	memset(h + hlen + len, 0, pad);
+
+	cli_pcap_put32(b, CLI_PCAP_EPB);
+	cli_pcap_put32(b + 4, 32 + hlen + len + pad);
+	cli_pcap_put32(b + 8, 0);
+	cli_pcap_put32(b + 12, ts >> 32);
+	cli_pcap_put32(b + 16, ts & 0xffffffff);
+	cli_pcap_put32(b + 20, hlen + len);
+	cli_pcap_put32(b + 24, hlen + len);
+	cli_pcap_put32(h + hlen + len + pad, 32 + hlen + len + pad);
+
+	p->len += 32 + hlen + len + pad;
+	p->recs++;
+	p->bytes += len;
+
+	return 0;
+}
+
+/**
+ * Writes out what is left and ends the export.  Returns -1 if any of it
+ * could not be written.
+ */
+int cli_pcap_close(cli_pcap *p)
+{
+	int ret;
+
+	ret = cli_pcap_flush(p);
+
+	cli_seg_drop(p->seg);
+	cli_seg_put(p->seg);
+	free(p->buf);
+	free(p);
+
+	return ret;
+}
+
+/**
+ * Exports records from..to (not included) of iface to fd.  Returns how many
+ * records were written, or -1.
+ */
+long cli_pcap_export(cli_if *iface, unsigned int from, unsigned int to, int fd,
+	const struct sockaddr_in *local, unsigned long *bytes)
+{
+	cli_pcap *p;
+	unsigned int rec;
+	long n;
+
+	if ((p = cli_pcap_open(iface, fd, local)) == NULL) { return -1; }
+
+	for (rec = from; (rec < to) && (!p->err); rec++) {
+		cli_pcap_write(p, rec);
+	}
+
+	n = p->recs;
+	if (bytes != NULL) { *bytes = p->bytes; }
+
+	return (cli_pcap_close(p) == -1 ? -1 : n);
+}
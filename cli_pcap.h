@@ -0,0 +1,12 @@
+#pragma once
+
+#include <netinet/in.h>
+
+#include "clibase.h"
+
+cli_pcap *cli_pcap_open(cli_if *iface, int fd, const struct sockaddr_in *local);
+int cli_pcap_write(cli_pcap *p, unsigned int rec);
+int cli_pcap_close(cli_pcap *p);
+
+long cli_pcap_export(cli_if *iface, unsigned int from, unsigned int to, int fd,
+	const struct sockaddr_in *local, unsigned long *bytes);
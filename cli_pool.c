@@ -0,0 +1,121 @@
+/*
+ * cli_pool.c - slab backed pools of reference counted rx buffers
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "clibase.h"
+#include "cli_pool.h"
+
+void cli_pool_init(cli_pool *pool, const char *name, unsigned int max)
+{
+	memset(pool, 0, sizeof(cli_pool));
+
+	strncpy(pool->name, name, sizeof(pool->name) - 1);
+	pool->max = max;
+	pthread_mutex_init(&pool->lock, NULL);
+}
+
+/**
+ * Releases every slab.  Buffers still referenced at this point are gone too,
+ * so this is only called once all their users have stopped.
+ */
+void cli_pool_exit(cli_pool *pool)
+{
+	cli_slab *s;
+
+	while (pool->slabs != NULL) {
+		s = pool->slabs;
+		pool->slabs = s->next;
+		free(s);
+	}
+
+	pool->free = NULL;
+	pool->total = 0;
+	pool->inuse = 0;
+
+	pthread_mutex_destroy(&pool->lock);
+}
+
+/**
+ * Carves a new slab into free buffers.  Must be called with pool->lock held.
+ */
+static int cli_pool_grow(cli_pool *pool)
+{
+	cli_slab *s;
+	int i;
+
+	if (pool->total + CLI_POOL_SLAB > pool->max) { return -1; }
+
+	s = (cli_slab *)malloc(sizeof(cli_slab));
+	if (s == NULL) { return -1; }
+
+	s->next = pool->slabs;
+	pool->slabs = s;
+
+	for (i = 0; i < CLI_POOL_SLAB; i++) {
+		s->bufs[i].pool = pool;
+		s->bufs[i].next = pool->free;
+		pool->free = &s->bufs[i];
+	}
+	pool->total += CLI_POOL_SLAB;
+
+	return 0;
+}
+
+/**
+ * Returns a buffer holding one reference, or NULL (counted as a failure) if
+ * the pool is at its limit.
+ */
+cli_buf *cli_buf_alloc(cli_pool *pool)
+{
+	cli_buf *buf = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if ((pool->free != NULL) || (cli_pool_grow(pool) == 0)) {
+		buf = pool->free;
+		pool->free = buf->next;
+
+		buf->next = NULL;
+		buf->ref = 1;
+
+		pool->allocs++;
+		pool->inuse++;
+		if (pool->inuse > pool->hwm) { pool->hwm = pool->inuse; }
+	} else {
+		pool->fails++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return buf;
+}
+
+void cli_buf_ref(cli_buf *buf)
+{
+	__atomic_add_fetch(&buf->ref, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Drops a reference; the last one returns the buffer to its pool.
+ */
+void cli_buf_unref(cli_buf *buf)
+{
+	cli_pool *pool;
+
+	if (buf == NULL) { return; }
+	if (__atomic_sub_fetch(&buf->ref, 1, __ATOMIC_ACQ_REL) != 0) { return; }
+
+	pool = buf->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	buf->next = pool->free;
+	pool->free = buf;
+	pool->inuse--;
+	pthread_mutex_unlock(&pool->lock);
+}
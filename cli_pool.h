@@ -0,0 +1,10 @@
+#pragma once
+
+#include "clibase.h"
+
+void cli_pool_init(cli_pool *pool, const char *name, unsigned int max);
+void cli_pool_exit(cli_pool *pool);
+
+cli_buf *cli_buf_alloc(cli_pool *pool);
+void cli_buf_ref(cli_buf *buf);
+void cli_buf_unref(cli_buf *buf);
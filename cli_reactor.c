@@ -0,0 +1,334 @@
+/*
+ * cli_reactor.c - epoll based event loop for interface rx
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "config.h"
+
+#include "clibase.h"
+#include "cli.h"
+#include "cli_reactor.h"
+#include "cli_writer.h"
+#include "cli_ring.h"
+#include "cli_pool.h"
+#include "cli_uring.h"
+
+static int cli_reactor_batch_init(cli_reactor *r)
+{
+	int i;
+
+	r->discard = (char *)malloc(CLI_MAX_BUFFER);
+	r->msgs = (struct mmsghdr *)calloc(CLI_RX_BATCH, sizeof(struct mmsghdr));
+	r->iov = (struct iovec *)calloc(CLI_RX_BATCH, sizeof(struct iovec));
+	r->recs = (cli_rec *)calloc(CLI_RX_BATCH, sizeof(cli_rec));
+
+	if ((r->discard == NULL) || (r->msgs == NULL) ||
+		(r->iov == NULL) || (r->recs == NULL)) {
+		return -1;
+	}
+
+	for (i = 0; i < CLI_RX_BATCH; i++) {
+		r->msgs[i].msg_hdr.msg_iov = &r->iov[i];
+		r->msgs[i].msg_hdr.msg_iovlen = 1;
+		r->msgs[i].msg_hdr.msg_name = &r->recs[i].peer;
+	}
+
+	return 0;
+}
+
+static void cli_reactor_batch_exit(cli_reactor *r)
+{
+	int i;
+
+	if (r->recs != NULL) {
+		for (i = 0; i < CLI_RX_BATCH; i++) { cli_buf_unref(r->recs[i].buf); }
+	}
+
+	free(r->discard);
+	free(r->msgs);
+	free(r->iov);
+	free(r->recs);
+
+	r->discard = NULL;
+	r->msgs = NULL;
+	r->iov = NULL;
+	r->recs = NULL;
+}
+
+int cli_reactor_init(cli_reactor *r)
+{
+	struct epoll_event ev;
+
+	r->engine = CLI_ENGINE_EPOLL;
+	r->uring = NULL;
+
+	if (cli_reactor_batch_init(r) == -1) {
+		cli_reactor_batch_exit(r);
+		return -1;
+	}
+
+	r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (r->epfd == -1) {
+		cli_reactor_batch_exit(r);
+		return -1;
+	}
+
+	r->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (r->evfd == -1) {
+		close(r->epfd);
+		r->epfd = -1;
+		cli_reactor_batch_exit(r);
+		return -1;
+	}
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.events = EPOLLIN;
+	ev.data.u32 = CLI_REACTOR_WAKE;
+	epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->evfd, &ev);
+
+	return 0;
+}
+
+void cli_reactor_exit(cli_reactor *r)
+{
+	if (r->evfd != -1) { close(r->evfd); }
+	if (r->epfd != -1) { close(r->epfd); }
+
+	r->evfd = -1;
+	r->epfd = -1;
+
+	cli_reactor_batch_exit(r);
+}
+
+/**
+ * Creates ctx->nreactors rx threads, each with its own epoll set and buffer pool.
+ * Interfaces are sharded across them as they are registered.  When
+ * ctx->engine asks for io_uring, reactors whose ring cannot be set up fall
+ * back to epoll.
+ */
+int cli_reactor_start(cli_ctx *ctx)
+{
+	int i;
+	long n;
+	char tmp[16];
+	void *(*rxfunc)(void *);
+
+	if (ctx->nreactors == 0) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+		ctx->nreactors = (n > 0 ? n : 1);
+	}
+	if (ctx->nreactors > CLI_MAX_REACTORS) {
+		ctx->nreactors = CLI_MAX_REACTORS;
+	}
+
+	for (i = 0; i < ctx->nreactors; i++) {
+		ctx->reactor[i].id = i;
+		ctx->reactor[i].nifs = 0;
+		ctx->reactor[i].ctx = ctx;
+
+		sprintf(tmp, "rx%d", i);
+		cli_pool_init(&ctx->reactor[i].pool, tmp, CLI_POOL_MAX);
+
+		if (cli_reactor_init(&ctx->reactor[i]) == -1) {
+			cli_pool_exit(&ctx->reactor[i].pool);
+			break;
+		}
+
+		rxfunc = cli_rx_interrupt;
+#ifdef HAVE_LIBURING
+		if ((ctx->engine == CLI_ENGINE_URING) &&
+			(cli_uring_init(&ctx->reactor[i]) == 0)) {
+			rxfunc = cli_uring_interrupt;
+		}
+#endif
+
+		if (pthread_create(&ctx->reactor[i].thread, NULL,
+			rxfunc, (void *)&ctx->reactor[i]) != 0) {
+#ifdef HAVE_LIBURING
+			cli_uring_exit(&ctx->reactor[i]);
+#endif
+			cli_reactor_exit(&ctx->reactor[i]);
+			cli_pool_exit(&ctx->reactor[i].pool);
+			break;
+		}
+	}
+
+	// run with however many threads we managed to start
+	ctx->nreactors = i;
+
+	return (i > 0 ? 0 : -1);
+}
+
+/**
+ * Wakes every rx thread (ctx->state must already be CLI_EXITING) and waits
+ * for them to finish.  Their buffer pools stay around until the records they
+ * queued have been written out.
+ */
+void cli_reactor_stop(cli_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->nreactors; i++) {
+		cli_reactor_wake(&ctx->reactor[i]);
+	}
+
+	for (i = 0; i < ctx->nreactors; i++) {
+		pthread_join(ctx->reactor[i].thread, NULL);
+#ifdef HAVE_LIBURING
+		cli_uring_exit(&ctx->reactor[i]);
+#endif
+		cli_reactor_exit(&ctx->reactor[i]);
+	}
+}
+
+/**
+ * Gets an rx buffer for iface from the reactor's pool.  When the pool is
+ * exhausted every buffer is queued behind the capture writer; under the
+ * blocking overload policy wait for it to release some, otherwise recycle the
+ * buffer of iface's oldest queued record (drop-oldest) or return NULL so the
+ * caller discards what it receives (drop-newest, or nothing left to shed).
+ */
+cli_buf *cli_reactor_buf(cli_reactor *r, cli_if *iface)
+{
+	cli_buf *buf;
+	cli_rec old;
+	unsigned long gen = cli_writer_gen(r->ctx);
+
+	while ((buf = cli_buf_alloc(&r->pool)) == NULL) {
+		if ((iface->overload == CLI_OVERLOAD_DROP_OLDEST) &&
+			(iface->rxq != NULL) && (cli_ring_take(iface->rxq, &old, 1) == 1)) {
+			// the record goes, its buffer stays
+			buf = old.buf;
+			old.buf = NULL;
+			cli_rx_drop(iface, &old);
+
+			if (buf != NULL) { return buf; }
+			continue;
+		}
+
+		if ((iface->overload != CLI_OVERLOAD_BLOCK) ||
+			(r->ctx->state != CLI_NORMAL)) { return NULL; }
+
+		cli_writer_wait(r->ctx, gen);
+		gen = cli_writer_gen(r->ctx);
+	}
+
+	return buf;
+}
+
+/**
+ * Kicks an rx thread out of epoll_wait so that it re-examines ctx->state.
+ */
+void cli_reactor_wake(cli_reactor *r)
+{
+	uint64_t one = 1;
+
+	write(r->evfd, &one, sizeof(uint64_t));
+}
+
+void cli_reactor_drain(cli_reactor *r)
+{
+	uint64_t n;
+
+	read(r->evfd, &n, sizeof(uint64_t));
+}
+
+/**
+ * Picks the least loaded rx thread for a newly registered interface.
+ */
+static cli_reactor *cli_reactor_pick(cli_ctx *ctx)
+{
+	int i;
+	cli_reactor *r = &ctx->reactor[0];
+
+	for (i = 1; i < ctx->nreactors; i++) {
+		if (ctx->reactor[i].nifs < r->nifs) { r = &ctx->reactor[i]; }
+	}
+
+	return r;
+}
+
+/**
+ * Registers or unregisters an interface with a reactor depending on its
+ * current state.  Only open, active, fd based interfaces are watched, which
+ * keeps unconnected tcp sockets (always reporting EPOLLHUP) out of the set.
+ * Must be called with ctx->iflock held for writing, or by the rx thread that
+ * owns the interface.
+ */
+void cli_reactor_update(cli_ctx *ctx, cli_if *iface)
+{
+	struct epoll_event ev;
+	cli_reactor *r;
+	int want;
+
+	if (ctx->nreactors == 0) { return; }
+
+	want = (iface->header == 'i') &&
+		(iface->type & CLI_FD_TYPES) &&
+		(iface->rxopen != 0) &&
+		(iface->active != 0);
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.events = EPOLLIN;
+	ev.data.u32 = iface->id;
+
+	if ((want) && (!iface->rxreg)) {
+		r = cli_reactor_pick(ctx);
+
+		// never let a spurious wakeup block the rx thread in read()
+		fcntl(iface->rxdev.fd, F_SETFL,
+			fcntl(iface->rxdev.fd, F_GETFL) | O_NONBLOCK);
+
+		// io_uring reactors arm their receives themselves once woken
+		if ((r->engine == CLI_ENGINE_URING) ||
+			(epoll_ctl(r->epfd, EPOLL_CTL_ADD, iface->rxdev.fd, &ev) == 0)) {
+			iface->rxreg = 1;
+			iface->shard = r->id;
+			r->nifs++;
+		}
+
+		cli_reactor_wake(r);
+	} else if ((!want) && (iface->rxreg)) {
+		cli_reactor_remove(ctx, iface);
+	}
+}
+
+/**
+ * Unconditionally drops an interface from its reactor, used before its
+ * descriptor is closed.  Same locking rules as cli_reactor_update.
+ */
+void cli_reactor_remove(cli_ctx *ctx, cli_if *iface)
+{
+	struct epoll_event ev;
+	cli_reactor *r;
+
+	if (iface->rxreg) {
+		r = &ctx->reactor[iface->shard];
+
+		if (r->engine == CLI_ENGINE_EPOLL) {
+			memset(&ev, 0, sizeof(struct epoll_event));
+			epoll_ctl(r->epfd, EPOLL_CTL_DEL, iface->rxdev.fd, &ev);
+		}
+		iface->rxreg = 0;
+		r->nifs--;
+
+		cli_reactor_wake(r);
+	}
+}
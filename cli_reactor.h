@@ -0,0 +1,21 @@
+#pragma once
+
+#include "clibase.h"
+
+// epoll token used for the reactor's own eventfd (interfaces use their id)
+#define CLI_REACTOR_WAKE	CLI_DEFAULT_BUFFER
+#define CLI_REACTOR_EVENTS	64
+
+int cli_reactor_init(cli_reactor *r);
+void cli_reactor_exit(cli_reactor *r);
+
+int cli_reactor_start(cli_ctx *ctx);
+void cli_reactor_stop(cli_ctx *ctx);
+
+cli_buf *cli_reactor_buf(cli_reactor *r, cli_if *iface);
+
+void cli_reactor_wake(cli_reactor *r);
+void cli_reactor_drain(cli_reactor *r);
+
+void cli_reactor_update(cli_ctx *ctx, cli_if *iface);
+void cli_reactor_remove(cli_ctx *ctx, cli_if *iface);
@@ -0,0 +1,275 @@
+/*
+ * cli_replay.c - replaying captured records out of another interface
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <curses.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "clibase.h"
+#include "cli_seg.h"
+#include "cli_send.h"
+#include "cli_replay.h"
+
+static unsigned long cli_replay_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+/**
+ * Sleeps on the timer tfd until the monotonic time due, in ns.  Returns -1
+ * if the replay is stopped meanwhile.
+ */
+static int cli_replay_wait(cli_replay *r, int tfd, unsigned long due)
+{
+	struct itimerspec its;
+	struct pollfd p[2];
+	uint64_t n;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = due / 1000000000UL;
+	its.it_value.tv_nsec = due % 1000000000UL;
+	if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) == -1) { return 0; }
+
+	p[0].fd = tfd;
+	p[0].events = POLLIN;
+	p[1].fd = r->wake;
+	p[1].events = POLLIN;
+
+	while (poll(p, 2, -1) == -1) {
+		if (errno != EINTR) { return 0; }
+	}
+	if (p[1].revents & POLLIN) { return -1; }
+
+	if (read(tfd, &n, sizeof(n)) != sizeof(n)) { return 0; }
+
+	return 0;
+}
+
+/**
+ * Sends a record out of r->dst.  Files are written, and captured, with
+ * ctx->iflock held as the rx threads do.  Descriptors are checked under
+ * iflock but written with only dst->txlock held, which keeps the prompt from
+ * closing or swapping them meanwhile without a full socket holding up every
+ * other user of iflock.  Returns -1 once dst can no longer be written to.
+ */
+static int cli_replay_send(cli_replay *r, char *data, int n)
+{
+	cli_if *dst = r->dst;
+	int ret = -1;
+
+	pthread_rwlock_rdlock(&r->ctx->iflock);
+	if (dst->type == CLI_TYPE_FILE) {
+		if ((dst->rxdev.fp != NULL) &&
+			(cli_send_buffer(r->ctx, dst, data, n) != -1)) {
+			ret = 0;
+		}
+		pthread_rwlock_unlock(&r->ctx->iflock);
+		return ret;
+	}
+
+	if (!((dst->type & CLI_FD_TYPES) && (dst->rxopen))) {
+		pthread_rwlock_unlock(&r->ctx->iflock);
+		return -1;
+	}
+	pthread_mutex_lock(&dst->txlock);
+	pthread_rwlock_unlock(&r->ctx->iflock);
+
+	if (cli_send_buffer(r->ctx, dst, data, n) != -1) { ret = 0; }
+	pthread_mutex_unlock(&dst->txlock);
+
+	return ret;
+}
+
+/**
+ * Sends the records of r.  Each one is due when its offset from the first
+ * record, scaled by the speed, has passed since the start, so being late
+ * for one record does not push back the rest.
+ */
+static void *cli_replay_thread(void *arg)
+{
+	cli_replay *r = (cli_replay *)arg;
+	char data[CLI_MAX_BUFFER];
+	cli_seg *seg = NULL;
+	cli_rechdr rh;
+	unsigned long now, due, base = 0, late;
+	unsigned int rec;
+	int n, tfd = r->timer;
+
+	for (rec = r->from; rec < r->to; rec++) {
+		if (__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) { break; }
+
+		// records retention took away meanwhile are skipped
+		if ((seg = cli_seg_walk(r->src, seg, rec)) == NULL) { continue; }
+		if ((n = cli_seg_copy(seg, rec, data, CLI_MAX_BUFFER, &rh, NULL)) < 0) {
+			continue;
+		}
+
+		// v1 records have no timestamps and go out back to back
+		if ((tfd != -1) && (rh.ts != 0)) {
+			if (base == 0) { base = rh.ts; }
+			due = r->start + (((rh.ts > base ? rh.ts - base : 0) * 1000UL) / r->speed);
+
+			if ((due > cli_replay_clock()) && (cli_replay_wait(r, tfd, due) == -1)) {
+				break;
+			}
+
+			now = cli_replay_clock();
+			late = (now > due ? now - due : 0);
+			__atomic_add_fetch(&r->late, late, __ATOMIC_RELAXED);
+			if (late > r->late_max) {
+				__atomic_store_n(&r->late_max, late, __ATOMIC_RELAXED);
+			}
+		}
+
+		if (cli_replay_send(r, data, n) == -1) { break; }
+
+		__atomic_add_fetch(&r->bytes, n, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&r->sent, 1, __ATOMIC_RELEASE);
+	}
+
+	if (seg != NULL) {
+		cli_seg_drop(seg);
+		cli_seg_put(seg);
+	}
+	if (tfd != -1) { close(tfd); }
+
+	__atomic_store_n(&r->usec, (cli_replay_clock() - r->start) / 1000UL,
+		__ATOMIC_RELAXED);
+	__atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
+
+	// say so, unless it was asked to stop
+	if (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&r->ctx->ui.mutex);
+		if (!r->ctx->ui.paging) {
+			cli_replay_print(r);
+			refresh();
+		}
+		pthread_mutex_unlock(&r->ctx->ui.mutex);
+	}
+
+	return NULL;
+}
+
+/**
+ * Starts replaying records from to to - 1 of src out of dst in the
+ * background (see cli_replay).  Only one replay runs at a time.  Returns -1
+ * if one is running, a paced one cannot get a timer or the thread could not
+ * be started.
+ */
+int cli_replay_start(cli_ctx *ctx, cli_if *src, cli_if *dst,
+	unsigned int from, unsigned int to, unsigned int speed)
+{
+	cli_replay *r = &ctx->replay;
+
+	if (__atomic_load_n(&r->running, __ATOMIC_ACQUIRE)) {
+		errno = EBUSY;
+		return -1;
+	}
+	cli_replay_stop(ctx);
+
+	r->ctx = ctx;
+	r->src = src;
+	r->dst = dst;
+	r->from = from;
+	r->to = to;
+	r->speed = speed;
+	r->stop = 0;
+	r->sent = 0;
+	r->bytes = 0;
+	r->usec = 0;
+	r->start = cli_replay_clock();
+	r->late = 0;
+	r->late_max = 0;
+	r->timer = -1;
+	// nothing to join until the thread is up
+	r->joined = 1;
+
+	// a paced replay that cannot be timed is not run at full speed instead
+	if ((r->speed > 0) &&
+		((r->timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) == -1)) {
+		return -1;
+	}
+
+	if ((r->wake = eventfd(0, EFD_CLOEXEC)) == -1) {
+		if (r->timer != -1) { close(r->timer); }
+		return -1;
+	}
+
+	r->running = 1;
+	if (pthread_create(&r->thread, NULL, cli_replay_thread, (void *)r) != 0) {
+		r->running = 0;
+		close(r->wake);
+		if (r->timer != -1) { close(r->timer); }
+		return -1;
+	}
+	r->joined = 0;
+
+	return 0;
+}
+
+/**
+ * Stops the replay, if there is one, and waits for its thread.  The counts
+ * are kept for cli_replay_print.
+ */
+void cli_replay_stop(cli_ctx *ctx)
+{
+	cli_replay *r = &ctx->replay;
+	uint64_t one = 1;
+
+	if ((r->ctx == NULL) || (r->joined)) { return; }
+
+	__atomic_store_n(&r->stop, 1, __ATOMIC_RELEASE);
+	if (write(r->wake, &one, sizeof(one)) != sizeof(one)) { }
+
+	pthread_join(r->thread, NULL);
+	close(r->wake);
+	r->joined = 1;
+}
+
+/**
+ * Prints how far r got, and the rate and timing it kept.
+ */
+void cli_replay_print(cli_replay *r)
+{
+	unsigned int sent = __atomic_load_n(&r->sent, __ATOMIC_ACQUIRE);
+	unsigned long bytes = __atomic_load_n(&r->bytes, __ATOMIC_RELAXED);
+	unsigned long late = __atomic_load_n(&r->late, __ATOMIC_RELAXED);
+	unsigned long usec, kbs;
+	int running = __atomic_load_n(&r->running, __ATOMIC_ACQUIRE);
+
+	usec = (running ? (cli_replay_clock() - r->start) / 1000UL :
+		__atomic_load_n(&r->usec, __ATOMIC_RELAXED));
+	kbs = (usec > 0 ? (bytes * 1000UL) / usec : 0);
+
+	printw("  replay if%02x -> if%02x %s: %u of %u record(s), %lu byte(s), "
+		"%lu.%03lus\n", r->src->id, r->dst->id,
+		(running ? "running" : (r->stop ? "stopped" : "done")),
+		sent, r->to - r->from, bytes, usec / 1000000UL, (usec / 1000UL) % 1000UL);
+	printw("    %lu record(s)/s, %lu.%02lu MB/s", (usec > 0 ?
+		(sent * 1000000UL) / usec : 0), kbs / 1000UL, (kbs % 1000UL) / 10UL);
+
+	if (r->speed == 0) {
+		printw(", as fast as possible\n");
+	} else {
+		printw(", x%u.%03u, late %luus on average and %luus at most\n",
+			r->speed / 1000, r->speed % 1000, (sent > 0 ? late / sent : 0) / 1000UL,
+			__atomic_load_n(&r->late_max, __ATOMIC_RELAXED) / 1000UL);
+	}
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "clibase.h"
+
+int cli_replay_start(cli_ctx *ctx, cli_if *src, cli_if *dst,
+	unsigned int from, unsigned int to, unsigned int speed);
+void cli_replay_stop(cli_ctx *ctx);
+void cli_replay_print(cli_replay *r);
@@ -0,0 +1,107 @@
+/*
+ * cli_ring.c - lock-free single-producer/single-consumer record queue
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "clibase.h"
+#include "cli_ring.h"
+#include "cli_pool.h"
+
+/**
+ * Allocates a ring of slots records, which must be a power of two.
+ */
+cli_ring *cli_ring_new(unsigned int slots)
+{
+	cli_ring *q = (cli_ring *)malloc(sizeof(cli_ring));
+
+	if (q == NULL) { return NULL; }
+	memset(q, 0, sizeof(cli_ring));
+
+	q->size = slots;
+	q->slots = (cli_rec *)calloc(slots, sizeof(cli_rec));
+
+	if (q->slots == NULL) {
+		free(q);
+		q = NULL;
+	}
+
+	return q;
+}
+
+/**
+ * Frees the ring, dropping the buffer references of records still queued.
+ * Neither side may be using the ring any more.
+ */
+void cli_ring_free(cli_ring *q)
+{
+	cli_rec rec;
+
+	if (q != NULL) {
+		while (cli_ring_take(q, &rec, 1) == 1) { cli_buf_unref(rec.buf); }
+
+		free(q->slots);
+		free(q);
+	}
+}
+
+/**
+ * Queues rec, taking over its buffer reference.  Returns -1 without touching
+ * the ring if it is full.  Only one thread may push to a ring.
+ */
+int cli_ring_push(cli_ring *q, const cli_rec *rec)
+{
+	unsigned long tail = q->tail;
+
+	// only look at the consumer's cache line when we appear to be full
+	if (tail - q->head_cache >= q->size) {
+		q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+		if (tail - q->head_cache >= q->size) { return -1; }
+	}
+
+	q->slots[tail & (q->size - 1)] = *rec;
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/**
+ * Number of records queued.
+ */
+unsigned int cli_ring_avail(cli_ring *q)
+{
+	return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Dequeues up to max of the oldest records into recs, along with their buffer
+ * references, and returns how many were taken.  Besides the consumer, the
+ * producer may take records too (to shed the oldest ones when the ring is
+ * full), so the head only ever moves by compare-and-swap; a copy made from
+ * slots the other side claimed first is simply thrown away and redone.
+ */
+unsigned int cli_ring_take(cli_ring *q, cli_rec *recs, unsigned int max)
+{
+	unsigned long head, tail;
+	unsigned int i, n;
+
+	head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	do {
+		tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+		n = (tail - head < max ? tail - head : max);
+
+		for (i = 0; i < n; i++) {
+			recs[i] = q->slots[(head + i) & (q->size - 1)];
+		}
+	} while ((n > 0) && (!__atomic_compare_exchange_n(&q->head, &head, head + n,
+		0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)));
+
+	return n;
+}
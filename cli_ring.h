@@ -0,0 +1,13 @@
+#pragma once
+
+#include "clibase.h"
+
+cli_ring *cli_ring_new(unsigned int slots);
+void cli_ring_free(cli_ring *q);
+
+// producer
+int cli_ring_push(cli_ring *q, const cli_rec *rec);
+
+// either side
+unsigned int cli_ring_avail(cli_ring *q);
+unsigned int cli_ring_take(cli_ring *q, cli_rec *recs, unsigned int max);
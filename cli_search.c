@@ -0,0 +1,513 @@
+/*
+ * cli_search.c - parallel byte pattern search over an interface's capture
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "clibase.h"
+#include "cli_store.h"
+#include "cli_seg.h"
+#include "cli_bloom.h"
+#include "cli_search.h"
+
+// raw bytes per work item, and blocks per item of a compressed segment
+#define CLI_SEARCH_CHUNK	(4UL << 20)
+#define CLI_SEARCH_BLOCKS	(CLI_SEARCH_CHUNK / CLI_BLOCK_BYTES)
+
+#define CLI_SEARCH_THREADS	16
+
+// hits each worker keeps
+#define CLI_SEARCH_HITS		(1U << 20)
+
+/**
+ * memmem, 16 positions at a time: candidates are where both the first and
+ * the last byte of pat match, and only those are compared in full.
+ */
+static const char *cli_search_mem(const char *hay, size_t n, const char *pat,
+	size_t m)
+{
+#if defined(__SSE2__)
+	__m128i first, last, a, b;
+	unsigned int mask, bit;
+	size_t i;
+
+	if ((m < 2) || (n < m + 15)) {
+		return (m == 1 ? memchr(hay, pat[0], n) : memmem(hay, n, pat, m));
+	}
+
+	first = _mm_set1_epi8(pat[0]);
+	last = _mm_set1_epi8(pat[m - 1]);
+
+	for (i = 0; i + m + 15 <= n; i += 16) {
+		a = _mm_loadu_si128((const __m128i *)(hay + i));
+		b = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+		mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+			_mm_cmpeq_epi8(b, last)));
+
+		while (mask != 0) {
+			bit = __builtin_ctz(mask);
+			if (memcmp(hay + i + bit + 1, pat + 1, m - 2) == 0) {
+				return hay + i + bit;
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	return memmem(hay + i, n - i, pat, m);
+#else
+	return memmem(hay, n, pat, m);
+#endif
+}
+
+/**
+ * Where record i of the scanned segment starts in its buffer file: its header
+ * in version 2, its data in version 1.
+ */
+static unsigned long cli_search_off(cli_seg *seg, unsigned int i)
+{
+	uint64_t off = 0;
+	uint32_t off32 = 0;
+
+	if (seg->version == 1) {
+		cli_store_read(seg->offset, seg->base + (i * sizeof(uint32_t)),
+			&off32, sizeof(off32));
+		return off32;
+	}
+
+	cli_store_read(seg->offset, seg->base + (i * sizeof(uint64_t)), &off,
+		sizeof(off));
+	return off;
+}
+
+/**
+ * Finds the record whose bytes (header included) hold position pos, and
+ * where its data starts and ends.
+ */
+static unsigned int cli_search_locate(cli_scan *sc, unsigned long pos,
+	unsigned long *from, unsigned long *to)
+{
+	unsigned int lo = 0, hi = sc->n, mid;
+
+	// the last record starting at or before pos
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cli_search_off(sc->seg, mid) <= pos) { lo = mid + 1; } else { hi = mid; }
+	}
+	if (lo > 0) { lo--; }
+
+	*from = cli_search_off(sc->seg, lo);
+	if (sc->seg->version != 1) { *from += sizeof(cli_rechdr); }
+
+	// version 1 keeps the end of the last record as well
+	if ((lo + 1 < sc->n) || (sc->seg->version == 1)) {
+		*to = cli_search_off(sc->seg, lo + 1);
+	} else {
+		*to = sc->end;
+	}
+
+	return sc->seg->first + lo;
+}
+
+static void cli_search_hit(cli_searcher *w, unsigned int rec)
+{
+	// records come in order within a range
+	if ((w->nhits > 0) && (w->hits[w->nhits - 1] == rec)) { return; }
+	if (w->nhits < CLI_SEARCH_HITS) { w->hits[w->nhits++] = rec; }
+}
+
+/**
+ * Looks for the pattern in len bytes of sc, starting at position base, that
+ * buf holds.  Only matches starting in the first starts bytes count; one is
+ * enough for a record, and one across two records is none.
+ */
+static void cli_search_range(cli_searcher *w, cli_scan *sc, const char *buf,
+	size_t len, unsigned long base, size_t starts)
+{
+	cli_query *s = w->query;
+	const char *p = buf, *h;
+	unsigned long pos, from, to;
+	unsigned int rec;
+
+	while ((p < buf + len) &&
+		((h = cli_search_mem(p, buf + len - p, s->pat, s->len)) != NULL) &&
+		(h - buf < starts)) {
+		pos = base + (h - buf);
+		rec = cli_search_locate(sc, pos, &from, &to);
+
+		if (pos < from) {
+			// in a record header
+			p = buf + (from - base);
+		} else {
+			if (pos + s->len <= to) { cli_search_hit(w, rec); }
+			// matches later on in the record are either beside the point or
+			// cross into the next one
+			p = (to > pos ? buf + (to - base) : h + 1);
+		}
+	}
+}
+
+static void *cli_search_worker(void *pvw)
+{
+	cli_searcher *w = (cli_searcher *)pvw;
+	cli_query *s = w->query;
+	cli_scan *sc;
+	char *buf;
+	unsigned long pos, b, end;
+	unsigned int i;
+	long len;
+
+	buf = (char *)malloc(CLI_SEARCH_CHUNK + CLI_MAX_BUFFER + CLI_SEG_SCRATCH);
+	if (buf == NULL) { return NULL; }
+
+	while ((i = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED)) < s->nscans) {
+		sc = &s->scans[i];
+
+		if (sc->seg->packed) {
+			// blocks hold whole records, so no match crosses into the next
+			for (b = sc->from; b < sc->to; b++) {
+				if ((len = cli_seg_block(sc->seg, b, buf, &pos)) > 0) {
+					cli_search_range(w, sc, buf, len, pos, len);
+					w->bytes += len;
+				}
+			}
+		} else {
+			// overlap the next range by the length of the pattern
+			end = sc->to + s->len - 1;
+			if (end > sc->end) { end = sc->end; }
+			len = cli_store_read(sc->seg->buffer, sc->from, buf, end - sc->from);
+			cli_store_drop(sc->seg->buffer, sc->from, sc->to - sc->from);
+			cli_search_range(w, sc, buf, len, sc->from, sc->to - sc->from);
+			w->bytes += sc->to - sc->from;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int cli_search_add(cli_query *s, unsigned int *cap, cli_scan *sc,
+	unsigned long from, unsigned long to)
+{
+	cli_scan *tmp;
+
+	if (s->nscans == *cap) {
+		*cap = (*cap == 0 ? 64 : *cap * 2);
+		if ((tmp = (cli_scan *)realloc(s->scans, *cap * sizeof(cli_scan))) == NULL) {
+			return -1;
+		}
+		s->scans = tmp;
+	}
+
+	s->scans[s->nscans] = *sc;
+	s->scans[s->nscans].from = from;
+	s->scans[s->nscans].to = to;
+	s->nscans++;
+
+	return 0;
+}
+
+/**
+ * Splits bytes from..to of sc into ranges for the workers: CLI_SEARCH_CHUNK
+ * bytes each, or CLI_SEARCH_BLOCKS of the blocks holding them where the
+ * segment is compressed.  *b is the first block not taken yet.
+ */
+static int cli_search_split(cli_query *s, unsigned int *cap, cli_scan *sc,
+	unsigned long from, unsigned long to, unsigned long *b)
+{
+	cli_blockent be;
+	unsigned long pos, n, first;
+
+	if (!sc->seg->packed) {
+		for (pos = from; pos < to; pos += CLI_SEARCH_CHUNK) {
+			if (cli_search_add(s, cap, sc, pos,
+				(pos + CLI_SEARCH_CHUNK < to ? pos + CLI_SEARCH_CHUNK : to)) == -1) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	n = cli_seg_blocks(sc->seg);
+	for (first = *b; *b < n; (*b)++) {
+		if (cli_store_read(sc->seg->block, *b * sizeof(cli_blockent), &be,
+			sizeof(cli_blockent)) != sizeof(cli_blockent)) {
+			break;
+		}
+		if (be.raw >= to) { break; }
+		if (be.raw + be.rawlen <= from) {
+			first = *b + 1;
+			continue;
+		}
+
+		if ((*b + 1 - first == CLI_SEARCH_BLOCKS) &&
+			(cli_search_add(s, cap, sc, first, *b + 1) == -1)) {
+			return -1;
+		}
+		if (*b + 1 - first == CLI_SEARCH_BLOCKS) { first = *b + 1; }
+	}
+
+	if ((*b > first) && (cli_search_add(s, cap, sc, first, *b) == -1)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Splits the published part of every segment into ranges for the workers,
+ * leaving out the records a segment's search index rules out.  Returns how
+ * many bytes that saves.
+ */
+static unsigned long cli_search_plan(cli_query *s, cli_seg **segs,
+	unsigned int nsegs)
+{
+	cli_scan sc;
+	cli_rechdr rh;
+	cli_bloomhdr *miss;
+	unsigned long pos, at, b, from, to, skipped = 0;
+	unsigned int i, k, nmiss, cap = 0, width;
+
+	for (i = 0; i < nsegs; i++) {
+		memset(&sc, 0, sizeof(cli_scan));
+		sc.seg = segs[i];
+
+		// only what the capture writer has published
+		width = (segs[i]->version == 1 ? sizeof(uint32_t) : sizeof(uint64_t));
+		if (cli_store_size(segs[i]->offset) < segs[i]->base) { continue; }
+		sc.n = (cli_store_size(segs[i]->offset) - segs[i]->base) / width;
+		if (segs[i]->version == 1) { sc.n = (sc.n > 0 ? sc.n - 1 : 0); }
+		if (sc.n > segs[i]->count) { sc.n = segs[i]->count; }
+		if (sc.n == 0) { continue; }
+
+		if (segs[i]->version == 1) {
+			sc.end = cli_search_off(segs[i], sc.n);
+		} else if (cli_seg_find(segs[i], segs[i]->first + sc.n - 1, &rh, &pos) == 0) {
+			sc.end = pos + rh.len;
+		} else {
+			continue;
+		}
+
+		nmiss = cli_bloom_misses(segs[i], s->pat, s->len, &miss);
+		for (k = 0, at = 0, b = 0; k < nmiss; k++) {
+			if (miss[k].rec >= sc.n) { break; }
+
+			from = cli_search_off(segs[i], miss[k].rec);
+			to = (miss[k].rec + miss[k].nrec < sc.n ?
+				cli_search_off(segs[i], miss[k].rec + miss[k].nrec) : sc.end);
+
+			if ((from > at) &&
+				(cli_search_split(s, &cap, &sc, at, from, &b) == -1)) {
+				break;
+			}
+			if (to > at) {
+				skipped += to - (from > at ? from : at);
+				at = to;
+			}
+		}
+		free(miss);
+
+		cli_search_split(s, &cap, &sc, at, sc.end, &b);
+	}
+
+	return skipped;
+}
+
+static int cli_search_cmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Parses `/text/' or `x/hex bytes/' into the pattern of s.  In text, `\/',
+ * `\\', `\n', `\r', `\t' and `\xNN' stand for the byte they name.  Returns the
+ * pattern length, 0 if there is none.
+ */
+static unsigned int cli_search_parse(cli_query *s, const char *arg)
+{
+	unsigned int x;
+	int hex = (arg[0] == 'x');
+
+	s->len = 0;
+	arg += (hex ? 2 : 1);
+
+	while ((*arg) && (*arg != '/') && (s->len < CLI_MAX_BUFFER)) {
+		if (hex) {
+			if (isspace(*arg)) { arg++; continue; }
+			if ((!isxdigit(arg[0])) || (!isxdigit(arg[1])) ||
+				(sscanf(arg, "%2x", &x) != 1)) {
+				return 0;
+			}
+			s->pat[s->len++] = x;
+			arg += 2;
+		} else if ((arg[0] == '\\') && (arg[1])) {
+			switch (arg[1]) {
+			case 'n': s->pat[s->len++] = '\n'; break;
+			case 'r': s->pat[s->len++] = '\r'; break;
+			case 't': s->pat[s->len++] = '\t'; break;
+			case 'x':
+				if ((isxdigit(arg[2])) && (isxdigit(arg[3])) &&
+					(sscanf(arg + 2, "%2x", &x) == 1)) {
+					s->pat[s->len++] = x;
+					arg += 2;
+					break;
+				}
+				// fall through
+			default: s->pat[s->len++] = arg[1]; break;
+			}
+			arg += 2;
+		} else {
+			s->pat[s->len++] = *arg++;
+		}
+	}
+
+	return s->len;
+}
+
+/**
+ * Searches all of iface's capture for the pattern in arg (see
+ * cli_search_parse) and keeps the records holding it in iface->hits, in
+ * order.  The capture is split into ranges that a worker per cpu copies out
+ * of the mapped buffer files and scans, block by block where they are
+ * compressed; what a search index rules out is skipped, and counted in
+ * skipped.  Returns the number of hits, or -1 if arg holds no pattern.
+ */
+int cli_search(cli_if *iface, const char *arg, unsigned long *bytes,
+	unsigned long *skipped, unsigned long *usec)
+{
+	cli_query *s;
+	cli_searcher w[CLI_SEARCH_THREADS];
+	cli_seg **segs;
+	struct timespec t0, t1;
+	unsigned int i, j, k, n, nw, total = 0;
+	long cpus;
+
+	if ((s = (cli_query *)malloc(sizeof(cli_query))) == NULL) { return -1; }
+	memset(s, 0, sizeof(cli_query));
+
+	if (cli_search_parse(s, arg) == 0) {
+		free(s);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	segs = cli_seg_snapshot(iface, &n);
+	*skipped = cli_search_plan(s, segs, n);
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nw = (cpus < 1 ? 1 : (cpus > CLI_SEARCH_THREADS ? CLI_SEARCH_THREADS : cpus));
+	if (nw > s->nscans) { nw = (s->nscans > 0 ? s->nscans : 1); }
+
+	memset(w, 0, sizeof(w));
+	for (i = 0; i < nw; i++) {
+		w[i].query = s;
+		w[i].hits = (unsigned int *)malloc(CLI_SEARCH_HITS * sizeof(unsigned int));
+		if ((w[i].hits == NULL) ||
+			(pthread_create(&w[i].thread, NULL, cli_search_worker, &w[i]) != 0)) {
+			// the calling thread does the work instead
+			w[i].thread = 0;
+		}
+	}
+
+	for (i = 0; i < nw; i++) {
+		if (w[i].thread != 0) {
+			pthread_join(w[i].thread, NULL);
+		} else if (w[i].hits != NULL) {
+			cli_search_worker(&w[i]);
+		}
+	}
+
+	cli_seg_release(segs, n);
+
+	// merge what the workers found
+	free(iface->hits);
+	iface->hits = NULL;
+	iface->nhits = 0;
+	iface->hit = 0;
+
+	*bytes = 0;
+	for (i = 0; i < nw; i++) {
+		total += w[i].nhits;
+		*bytes += w[i].bytes;
+	}
+
+	if ((total > 0) &&
+		((iface->hits = (unsigned int *)malloc(total * sizeof(unsigned int))) != NULL)) {
+		for (i = 0, k = 0; i < nw; i++) {
+			memcpy(iface->hits + k, w[i].hits, w[i].nhits * sizeof(unsigned int));
+			k += w[i].nhits;
+		}
+
+		// a record split over two ranges may be found twice
+		qsort(iface->hits, total, sizeof(unsigned int), cli_search_cmp);
+		for (i = 0, j = 0; i < total; i++) {
+			if ((j == 0) || (iface->hits[j - 1] != iface->hits[i])) {
+				iface->hits[j++] = iface->hits[i];
+			}
+		}
+		iface->nhits = j;
+	}
+
+	for (i = 0; i < nw; i++) { free(w[i].hits); }
+	free(s->scans);
+	free(s);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	*usec = ((t1.tv_sec - t0.tv_sec) * 1000000UL) +
+		(t1.tv_nsec / 1000) - (t0.tv_nsec / 1000);
+
+	return iface->nhits;
+}
+
+/**
+ * Moves iface->hit to the first hit at or after record rec (or the last hit
+ * before it, if dir is negative).  Hits that retention has removed since are
+ * passed over.  Returns the record, or -1 if there is none.
+ */
+long cli_search_move(cli_if *iface, unsigned int rec, int dir)
+{
+	unsigned int lo = 0, hi = iface->nhits, mid;
+
+	// first hit at or after rec
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (iface->hits[mid] < rec) { lo = mid + 1; } else { hi = mid; }
+	}
+
+	if (dir < 0) {
+		if (lo == 0) { return -1; }
+		lo--;
+		if (iface->hits[lo] < iface->rx_first) { return -1; }
+	} else {
+		while ((lo < iface->nhits) && (iface->hits[lo] < iface->rx_first)) { lo++; }
+		if (lo == iface->nhits) { return -1; }
+	}
+
+	iface->hit = lo;
+	return iface->hits[lo];
+}
+
+void cli_search_free(cli_if *iface)
+{
+	free(iface->hits);
+	iface->hits = NULL;
+	iface->nhits = 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "clibase.h"
+
+int cli_search(cli_if *iface, const char *arg, unsigned long *bytes,
+	unsigned long *skipped, unsigned long *usec);
+long cli_search_move(cli_if *iface, unsigned int rec, int dir);
+void cli_search_free(cli_if *iface);
@@ -0,0 +1,1395 @@
+/*
+ * cli_seg.c - segmented capture files with rollover and retention
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "config.h"
+
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#include "clibase.h"
+#include "cli_store.h"
+#include "cli_seg.h"
+#include "cli_bloom.h"
+
+// raw bytes compressed per call to cli_seg_compress
+#define CLI_PACK_BYTES	(4UL << 20)
+
+/**
+ * File name of one of the segment's files, without the directory.  A version
+ * 1 session has a single unnumbered set of files.
+ */
+void cli_seg_name(cli_seg *seg, const char *kind, char *name)
+{
+	if (seg->version == 1) {
+		sprintf(name, "if%02x-%s", seg->id, kind);
+	} else {
+		sprintf(name, "if%02x-%s.%06u", seg->id, kind, seg->seq);
+	}
+}
+
+/**
+ * Full path of one of the segment's files into path, which holds
+ * CLI_DEFAULT_BUFFER characters.  Returns -1, leaving path empty, if it
+ * does not fit.
+ */
+int cli_seg_path(cli_seg *seg, const char *kind, char *path)
+{
+	char name[CLI_DEFAULT_BUFFER];
+
+	cli_seg_name(seg, kind, name);
+	if (snprintf(path, CLI_DEFAULT_BUFFER, "%s/%s", seg->dir, name) >=
+		CLI_DEFAULT_BUFFER) {
+		path[0] = 0;
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void cli_seg_free(cli_seg *seg)
+{
+	char path[CLI_DEFAULT_BUFFER];
+
+	// the records of the filter being built would go unindexed
+	if (!seg->dead) { cli_bloom_flush(seg); }
+
+	cli_store_close(seg->offset);
+	cli_store_close(seg->buffer);
+	cli_store_close(seg->peer);
+	cli_store_close(seg->time);
+	cli_store_close(seg->zdata);
+	cli_store_close(seg->block);
+	cli_store_close(seg->bloom);
+
+	// version 1 files also hold the interface settings, so they stay
+	if ((seg->dead) && (seg->version != 1)) {
+		cli_seg_path(seg, "offset", path);
+		unlink(path);
+		cli_seg_path(seg, "buffer", path);
+		unlink(path);
+		cli_seg_path(seg, "peer", path);
+		unlink(path);
+		cli_seg_path(seg, "time", path);
+		unlink(path);
+		cli_seg_path(seg, "bloom", path);
+		unlink(path);
+	}
+
+	// compressed copies, done or half done
+	if ((seg->dead) || (seg->zdata != NULL && !seg->packed && !seg->rdonly)) {
+		cli_seg_path(seg, "zdata", path);
+		unlink(path);
+		cli_seg_path(seg, "block", path);
+		unlink(path);
+	}
+
+	pthread_mutex_destroy(&seg->zlock);
+	free(seg->zcache);
+	free(seg->bits);
+	free(seg);
+}
+
+static cli_seg *cli_seg_alloc(cli_if *iface, const char *dir)
+{
+	cli_seg *seg;
+
+	seg = (cli_seg *)malloc(sizeof(cli_seg));
+	if (seg == NULL) { return NULL; }
+	memset(seg, 0, sizeof(cli_seg));
+
+	seg->id = iface->id;
+	seg->ref = 1;
+	seg->zcached = -1;
+	pthread_mutex_init(&seg->zlock, NULL);
+	strncpy(seg->dir, dir, CLI_DEFAULT_BUFFER - 1);
+
+	return seg;
+}
+
+/**
+ * Opens the files of segment seq.  CLI_STORE_CREATE starts them from
+ * scratch, CLI_STORE_RDONLY leaves them as they are.  A segment whose buffer
+ * file was compressed is opened from the compressed copy.
+ */
+static cli_seg *cli_seg_open(cli_if *iface, const char *dir, unsigned int seq,
+	int flags)
+{
+	char path[CLI_DEFAULT_BUFFER];
+	int create = (flags & CLI_STORE_CREATE);
+	cli_seg *seg;
+
+	if ((seg = cli_seg_alloc(iface, dir)) == NULL) { return NULL; }
+
+	seg->rdonly = ((flags & CLI_STORE_RDONLY) != 0);
+	seg->version = CLI_CAP_VERSION;
+	seg->base = sizeof(cli_seghdr);
+	seg->seq = seq;
+
+	// the other files' names are no longer than this one's; without an
+	// offset file there is no segment seq, and nothing else is opened
+	if ((cli_seg_path(seg, "offset", path) == -1) ||
+		((seg->offset = cli_store_open(path, flags | CLI_STORE_RESERVE)) == NULL)) {
+		cli_seg_free(seg);
+		return NULL;
+	}
+	cli_seg_path(seg, "buffer", path);
+	seg->buffer = cli_store_open(path, flags | CLI_STORE_RESERVE);
+#if HAVE_LIBZ
+	if ((seg->buffer == NULL) && (!create)) {
+		cli_seg_path(seg, "zdata", path);
+		seg->zdata = cli_store_open(path, CLI_STORE_RDONLY);
+		cli_seg_path(seg, "block", path);
+		seg->block = cli_store_open(path, CLI_STORE_RDONLY);
+		seg->packed = ((seg->zdata != NULL) && (seg->block != NULL));
+	}
+#endif
+	cli_seg_path(seg, "peer", path);
+	seg->peer = cli_store_open(path, flags | CLI_STORE_RESERVE);
+
+	// segments from before the time index get an empty one, filled in by
+	// cli_seg_load; read only, they go without
+	cli_seg_path(seg, "time", path);
+	seg->time = cli_store_open(path, flags);
+	if ((seg->time == NULL) && (flags == 0)) {
+		seg->time = cli_store_open(path, CLI_STORE_CREATE);
+	}
+
+	// there is a search index only if it was turned on
+	if (!create) {
+		cli_seg_path(seg, "bloom", path);
+		seg->bloom = cli_store_open(path, flags);
+	}
+
+	if ((seg->offset == NULL) || ((seg->buffer == NULL) && (!seg->packed)) ||
+		(seg->peer == NULL) ||
+		((seg->time == NULL) && (!(flags & CLI_STORE_RDONLY)))) {
+		cli_seg_free(seg);
+		return NULL;
+	}
+
+	return seg;
+}
+
+static int cli_seg_append(cli_if *iface, cli_seg *seg)
+{
+	cli_seg **segs;
+
+	if (iface->nsegs == iface->segcap) {
+		segs = (cli_seg **)realloc(iface->segs,
+			(iface->segcap + 16) * sizeof(cli_seg *));
+		if (segs == NULL) { return -1; }
+
+		iface->segs = segs;
+		iface->segcap += 16;
+	}
+
+	iface->segs[iface->nsegs++] = seg;
+
+	return 0;
+}
+
+/**
+ * Starts a new segment at the next record.  Must be called with iface->lock
+ * held.
+ */
+cli_seg *cli_seg_new(cli_if *iface, const char *dir)
+{
+	cli_seghdr hdr;
+	cli_seg *seg;
+
+	seg = cli_seg_open(iface, dir, iface->seq, CLI_STORE_CREATE);
+	if (seg == NULL) { return NULL; }
+
+	seg->first = iface->rx_count;
+	seg->created = time(NULL);
+
+	memset(&hdr, 0, sizeof(cli_seghdr));
+	hdr.magic = CLI_CAP_MAGIC;
+	hdr.version = CLI_CAP_VERSION;
+	hdr.size = sizeof(cli_seghdr);
+	hdr.seq = seg->seq;
+	hdr.first = seg->first;
+	hdr.created = seg->created;
+
+	cli_store_write(seg->offset, 0, &hdr, sizeof(cli_seghdr));
+
+	if (cli_seg_append(iface, seg) == -1) {
+		seg->dead = 1;
+		cli_seg_free(seg);
+		return NULL;
+	}
+
+	iface->seq++;
+	iface->rx_offsetpos = 0;
+
+	return seg;
+}
+
+/**
+ * The segment records are appended to.  Must be called with iface->lock held.
+ */
+cli_seg *cli_seg_active(cli_if *iface)
+{
+	return (iface->nsegs > 0 ? iface->segs[iface->nsegs - 1] : NULL);
+}
+
+static void cli_seg_seal(cli_seg *seg)
+{
+	cli_bloom_flush(seg);
+
+	cli_store_seal(seg->offset);
+	cli_store_seal(seg->buffer);
+	cli_store_seal(seg->peer);
+	cli_store_seal(seg->time);
+	cli_store_seal(seg->zdata);
+	cli_store_seal(seg->block);
+	cli_store_seal(seg->bloom);
+}
+
+/**
+ * Rolls the active segment over once it reaches the interface's size or age
+ * limit.  The sealed segment is made durable first unless the interface does
+ * not ask for durability at all.  Returns -1, leaving the old segment active,
+ * if the new one cannot be created.  Must be called with iface->lock held.
+ */
+int cli_seg_rotate(cli_if *iface, long now)
+{
+	cli_seg *seg = cli_seg_active(iface);
+
+	if ((seg == NULL) || (seg->count == 0)) { return 0; }
+
+	if ((seg->bytes < CLI_SEG_MAX_BYTES) &&
+		((iface->rotate_bytes == 0) || (seg->bytes < iface->rotate_bytes)) &&
+		((iface->rotate_secs == 0) || (now - seg->created < iface->rotate_secs))) {
+		return 0;
+	}
+
+	// the old segment stays the active one until a new one is in place
+	if (cli_seg_new(iface, seg->dir) == NULL) { return -1; }
+
+	if (iface->durable.mode != CLI_DURABLE_NONE) {
+		cli_store_sync(seg->buffer);
+		cli_store_sync(seg->peer);
+		cli_store_sync(seg->offset);
+		cli_store_sync(seg->time);
+	}
+
+	cli_seg_seal(seg);
+	seg->sealed = now;
+
+	return 0;
+}
+
+/**
+ * Returns the segment holding record rec with a reference held, or NULL if
+ * the record was never captured or retention already removed it.
+ */
+cli_seg *cli_seg_get(cli_if *iface, unsigned int rec)
+{
+	cli_seg *seg = NULL;
+	int lo, hi, mid;
+
+	pthread_mutex_lock(&iface->lock);
+	lo = 0;
+	hi = (int)iface->nsegs - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (iface->segs[mid]->first > rec) {
+			hi = mid - 1;
+		} else if (rec - iface->segs[mid]->first >= iface->segs[mid]->count) {
+			lo = mid + 1;
+		} else {
+			seg = iface->segs[mid];
+			__atomic_add_fetch(&seg->ref, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&iface->lock);
+
+	return seg;
+}
+
+void cli_seg_put(cli_seg *seg)
+{
+	if ((seg != NULL) && (__atomic_sub_fetch(&seg->ref, 1, __ATOMIC_ACQ_REL) == 0)) {
+		cli_seg_free(seg);
+	}
+}
+
+#if HAVE_LIBZ
+/**
+ * Inflates the block be describes into raw, which must hold CLI_SEG_SCRATCH
+ * bytes: the block itself, followed by room for its compressed form.
+ */
+static int cli_seg_unpack(cli_seg *seg, cli_blockent *be, char *raw)
+{
+	uLongf rawlen = CLI_BLOCK_MAX;
+	char *zin = raw + CLI_BLOCK_MAX;
+
+	if ((be->rawlen > CLI_BLOCK_MAX) ||
+		(be->zlen > CLI_SEG_SCRATCH - CLI_BLOCK_MAX) ||
+		(cli_store_read(seg->zdata, be->zoff, zin, be->zlen) != be->zlen) ||
+		(uncompress((Bytef *)raw, &rawlen, (Bytef *)zin, be->zlen) != Z_OK) ||
+		(rawlen != be->rawlen)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Copies up to len bytes from position pos of a compressed buffer file.  The
+ * block holding them is inflated unless it was the last one asked for.
+ */
+static size_t cli_seg_inflate(cli_seg *seg, unsigned long pos, void *data,
+	size_t len)
+{
+	cli_blockent be;
+	unsigned int lo = 0, hi, mid;
+
+	// the last block starting at or before pos
+	hi = cli_store_size(seg->block) / sizeof(cli_blockent);
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		cli_store_read(seg->block, mid * sizeof(cli_blockent), &be,
+			sizeof(cli_blockent));
+		if (be.raw <= pos) { lo = mid + 1; } else { hi = mid; }
+	}
+	if (lo == 0) { return 0; }
+
+	cli_store_read(seg->block, (lo - 1) * sizeof(cli_blockent), &be,
+		sizeof(cli_blockent));
+	if ((pos >= be.raw + be.rawlen) || (be.rawlen > CLI_BLOCK_MAX)) { return 0; }
+
+	pthread_mutex_lock(&seg->zlock);
+	if (seg->zcached != lo - 1) {
+		if (seg->zcache == NULL) {
+			seg->zcache = (char *)malloc(CLI_SEG_SCRATCH);
+		}
+
+		if ((seg->zcache == NULL) || (cli_seg_unpack(seg, &be, seg->zcache) == -1)) {
+			seg->zcached = -1;
+			pthread_mutex_unlock(&seg->zlock);
+			return 0;
+		}
+		seg->zcached = lo - 1;
+	}
+
+	if (len > be.raw + be.rawlen - pos) { len = be.raw + be.rawlen - pos; }
+	memcpy(data, seg->zcache + (pos - be.raw), len);
+	pthread_mutex_unlock(&seg->zlock);
+
+	return len;
+}
+#endif
+
+/**
+ * Copies up to len bytes from position pos of the segment's buffer file,
+ * wherever it is kept.  Returns how many were available.  A record never
+ * spans two compressed blocks.
+ */
+static size_t cli_seg_fetch(cli_seg *seg, unsigned long pos, void *data,
+	size_t len)
+{
+	if (!__atomic_load_n(&seg->packed, __ATOMIC_ACQUIRE)) {
+		return cli_store_read(seg->buffer, pos, data, len);
+	}
+
+#if HAVE_LIBZ
+	return cli_seg_inflate(seg, pos, data, len);
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Number of blocks a compressed segment is kept in.
+ */
+unsigned int cli_seg_blocks(cli_seg *seg)
+{
+	if (!seg->packed) { return 0; }
+
+	return cli_store_size(seg->block) / sizeof(cli_blockent);
+}
+
+/**
+ * Inflates block b of a compressed segment into raw, which must hold
+ * CLI_SEG_SCRATCH bytes, without going through the segment's block cache.
+ * Blocks hold whole records.  Returns the length of the block and sets pos to
+ * where it starts in the buffer file, or returns -1.
+ */
+long cli_seg_block(cli_seg *seg, unsigned int b, char *raw, unsigned long *pos)
+{
+#if HAVE_LIBZ
+	cli_blockent be;
+
+	if ((b >= cli_seg_blocks(seg)) ||
+		(cli_store_read(seg->block, b * sizeof(cli_blockent), &be,
+		sizeof(cli_blockent)) != sizeof(cli_blockent)) ||
+		(cli_seg_unpack(seg, &be, raw) == -1)) {
+		return -1;
+	}
+
+	*pos = be.raw;
+	return be.rawlen;
+#else
+	return -1;
+#endif
+}
+
+/**
+ * Size of the segment's buffer file, compressed or not.
+ */
+unsigned long cli_seg_raw(cli_seg *seg)
+{
+	cli_blockent be;
+	unsigned long n;
+
+	if (!seg->packed) { return cli_store_size(seg->buffer); }
+
+	n = cli_store_size(seg->block) / sizeof(cli_blockent);
+	if ((n == 0) || (cli_store_read(seg->block, (n - 1) * sizeof(cli_blockent),
+		&be, sizeof(cli_blockent)) != sizeof(cli_blockent))) {
+		return 0;
+	}
+
+	return be.raw + be.rawlen;
+}
+
+/**
+ * Finds record i of a version 1 segment: 32 bit end offsets, the first of
+ * them 0, and nothing but the data in the buffer file.
+ */
+static int cli_seg_find_v1(cli_seg *seg, unsigned int i, cli_rechdr *rh,
+	unsigned long *pos)
+{
+	uint32_t idx[2];
+
+	if (cli_store_read(seg->offset, seg->base + (i * sizeof(uint32_t)),
+		idx, sizeof(idx)) != sizeof(idx)) {
+		return -1;
+	}
+
+	memset(rh, 0, sizeof(cli_rechdr));
+	rh->len = idx[1] - idx[0];
+	*pos = idx[0];
+
+	return 0;
+}
+
+/**
+ * Reads the header of record rec and where its data starts in the buffer
+ * file of seg.  Returns -1 if the record is not (yet) there.
+ */
+int cli_seg_find(cli_seg *seg, unsigned int rec, cli_rechdr *rh,
+	unsigned long *pos)
+{
+	uint64_t off;
+	unsigned int i = rec - seg->first;
+
+	if (seg->version == 1) { return cli_seg_find_v1(seg, i, rh, pos); }
+
+	// the capture writer may still be publishing the entry
+	if ((cli_store_read(seg->offset, seg->base + (i * sizeof(uint64_t)),
+		&off, sizeof(off)) != sizeof(off)) ||
+		(cli_seg_fetch(seg, off, rh, sizeof(cli_rechdr)) !=
+		sizeof(cli_rechdr))) {
+		return -1;
+	}
+
+	*pos = off + sizeof(cli_rechdr);
+
+	return 0;
+}
+
+/**
+ * Copies record rec of seg (at most max bytes) into data, its header into rh
+ * and its source address into peer, if given.  Returns the record length, or
+ * -1 if it is not available.
+ */
+int cli_seg_copy(cli_seg *seg, unsigned int rec, char *data, unsigned int max,
+	cli_rechdr *rh, struct sockaddr_in *peer)
+{
+	cli_rechdr h;
+	int ret;
+
+	if (rh == NULL) { rh = &h; }
+	if ((ret = cli_seg_part(seg, rec, 0, data, max, rh)) == -1) { return -1; }
+
+	if (peer != NULL) { cli_seg_peer(seg, rec, rh, peer); }
+
+	return ret;
+}
+
+/**
+ * Copies the data of record rec of seg from skip bytes in (at most max bytes)
+ * into data, and its header into rh.  Returns how many bytes that was, or -1
+ * if the record is not available.
+ */
+int cli_seg_part(cli_seg *seg, unsigned int rec, unsigned int skip, char *data,
+	unsigned int max, cli_rechdr *rh)
+{
+	unsigned long pos;
+
+	if (cli_seg_find(seg, rec, rh, &pos) == -1) { return -1; }
+	if (skip >= rh->len) { return 0; }
+	if (max > rh->len - skip) { max = rh->len - skip; }
+
+	return cli_seg_fetch(seg, pos + skip, data, max);
+}
+
+/**
+ * Data bytes the records of seg before rec hold, headers left out, for rec
+ * from seg->first up to and including seg->first + seg->count.
+ */
+unsigned long cli_seg_data(cli_seg *seg, unsigned int rec)
+{
+	cli_rechdr rh;
+	unsigned long pos;
+	unsigned int i = rec - seg->first;
+	unsigned long hdr = (seg->version == 1 ? 0 : sizeof(cli_rechdr));
+
+	if (i == 0) { return 0; }
+	if ((i < seg->count) && (cli_seg_find(seg, rec, &rh, &pos) == 0)) {
+		return pos - ((i + 1) * hdr);
+	}
+
+	// past the last record: where it ends
+	if (cli_seg_find(seg, rec - 1, &rh, &pos) == -1) { return 0; }
+	return pos + rh.len - (i * hdr);
+}
+
+/**
+ * Reads the source address kept for record rec of seg, whose header is rh,
+ * into peer.  Records without one get a zeroed address.
+ */
+void cli_seg_peer(cli_seg *seg, unsigned int rec, cli_rechdr *rh,
+	struct sockaddr_in *peer)
+{
+	memset(peer, 0, sizeof(struct sockaddr_in));
+	if (rh->flags & CLI_REC_PEER) {
+		cli_store_read(seg->peer, (rec - seg->first) * sizeof(struct sockaddr_in),
+			peer, sizeof(struct sockaddr_in));
+	}
+}
+
+/**
+ * Copies records rec to rec + n - 1 of seg into data (at most max bytes) in
+ * one read, each a cli_rechdr followed by its data as in the buffer file.
+ * Stops early at a record that does not fit or at the end of a compressed
+ * block; max of CLI_BLOCK_MAX always fits one.  Returns how many whole
+ * records data holds and sets len to the bytes they take up, or returns -1
+ * for version 1 segments, which keep no headers, and records not (yet) there.
+ */
+int cli_seg_run(cli_seg *seg, unsigned int rec, unsigned int n, char *data,
+	unsigned long max, unsigned long *len)
+{
+	cli_rechdr rh;
+	uint64_t off;
+	unsigned long got, pos = 0;
+	unsigned int i = rec - seg->first, k;
+
+	if ((seg->version == 1) || (i >= seg->count)) { return -1; }
+	if (n > seg->count - i) { n = seg->count - i; }
+
+	if (cli_store_read(seg->offset, seg->base + (i * sizeof(uint64_t)),
+		&off, sizeof(off)) != sizeof(off)) {
+		return -1;
+	}
+
+	got = cli_seg_fetch(seg, off, data, max);
+	for (k = 0; k < n; k++) {
+		if (pos + sizeof(cli_rechdr) > got) { break; }
+		memcpy(&rh, data + pos, sizeof(cli_rechdr));
+		if (pos + sizeof(cli_rechdr) + rh.len > got) { break; }
+		pos += sizeof(cli_rechdr) + rh.len;
+	}
+
+	*len = pos;
+	return (k == 0 ? -1 : (int)k);
+}
+
+/**
+ * cli_seg_copy for whichever segment of iface holds record rec.
+ */
+int cli_seg_read(cli_if *iface, unsigned int rec, char *data, unsigned int max,
+	cli_rechdr *rh, struct sockaddr_in *peer)
+{
+	cli_seg *seg;
+	int ret;
+
+	if ((seg = cli_seg_get(iface, rec)) == NULL) { return -1; }
+	ret = cli_seg_copy(seg, rec, data, max, rh, peer);
+	cli_seg_put(seg);
+
+	return ret;
+}
+
+/**
+ * Moves a walk over the records of iface on to the segment that holds rec,
+ * giving back the memory of the one it leaves (see cli_seg_drop).  Walks
+ * start from NULL and end with cli_seg_drop and cli_seg_put.
+ */
+cli_seg *cli_seg_walk(cli_if *iface, cli_seg *seg, unsigned int rec)
+{
+	if ((seg != NULL) && (rec >= seg->first) && (rec - seg->first < seg->count)) {
+		return seg;
+	}
+
+	if (seg != NULL) {
+		cli_seg_drop(seg);
+		cli_seg_put(seg);
+	}
+
+	return cli_seg_get(iface, rec);
+}
+
+/**
+ * Adds record rec, stamped ts, to the time index of seg if it falls on an
+ * index stride.  Only for the capture writer, with iface->lock held, once
+ * the record is published.
+ */
+void cli_seg_index(cli_seg *seg, unsigned int rec, unsigned long ts)
+{
+	cli_timeent te;
+	unsigned int i = rec - seg->first;
+
+	if ((seg->time == NULL) || (i % CLI_TIME_STRIDE != 0)) { return; }
+
+	memset(&te, 0, sizeof(cli_timeent));
+	te.ts = ts;
+	te.rec = rec;
+	cli_store_write(seg->time, (i / CLI_TIME_STRIDE) * sizeof(cli_timeent),
+		&te, sizeof(cli_timeent));
+}
+
+/**
+ * Fills in the time index entries that seg is missing, e.g. after a crash or
+ * for a segment written before there was an index.
+ */
+static void cli_seg_reindex(cli_seg *seg)
+{
+	cli_rechdr rh;
+	unsigned long pos;
+	unsigned int i;
+
+	i = (cli_store_size(seg->time) / sizeof(cli_timeent)) * CLI_TIME_STRIDE;
+	for (; i < seg->count; i += CLI_TIME_STRIDE) {
+		if (cli_seg_find(seg, seg->first + i, &rh, &pos) == -1) { break; }
+		cli_seg_index(seg, seg->first + i, rh.ts);
+	}
+}
+
+/**
+ * Timestamp of the first record of seg.  Untimed (version 1) segments come
+ * before any time, empty ones after it.
+ */
+static unsigned long cli_seg_start(cli_seg *seg)
+{
+	cli_timeent te;
+
+	if (seg->time == NULL) { return 0; }
+	if (cli_store_read(seg->time, 0, &te, sizeof(cli_timeent)) !=
+		sizeof(cli_timeent)) {
+		return (unsigned long)-1;
+	}
+
+	return te.ts;
+}
+
+/**
+ * Finds the first record stamped at ts or later: a binary search over the
+ * segments, then over the time index of the one that holds ts and finally
+ * over the at most CLI_TIME_STRIDE records between two index entries.
+ * Returns rx_count if every record is older.
+ */
+unsigned int cli_seg_seek(cli_if *iface, unsigned long ts)
+{
+	cli_seg **segs, *seg;
+	cli_timeent te;
+	cli_rechdr rh;
+	unsigned long pos;
+	unsigned int n, lo, hi, mid, end, rec;
+
+	segs = cli_seg_snapshot(iface, &n);
+	if (n == 0) {
+		cli_seg_release(segs, n);
+		return iface->rx_count;
+	}
+
+	// segments that start before ts
+	lo = 0;
+	hi = n;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cli_seg_start(segs[mid]) < ts) { lo = mid + 1; } else { hi = mid; }
+	}
+
+	if (lo == 0) {
+		rec = segs[0]->first;
+	} else if ((seg = segs[lo - 1])->time == NULL) {
+		rec = seg->first + seg->count;
+	} else {
+		// index entries before ts, the first of them is
+		lo = 1;
+		hi = cli_store_size(seg->time) / sizeof(cli_timeent);
+		if (hi > (seg->count + CLI_TIME_STRIDE - 1) / CLI_TIME_STRIDE) {
+			hi = (seg->count + CLI_TIME_STRIDE - 1) / CLI_TIME_STRIDE;
+		}
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			cli_store_read(seg->time, mid * sizeof(cli_timeent), &te,
+				sizeof(cli_timeent));
+			if (te.ts < ts) { lo = mid + 1; } else { hi = mid; }
+		}
+
+		// records of that stride before ts, the first of them is
+		end = lo * CLI_TIME_STRIDE;
+		if (end > seg->count) { end = seg->count; }
+		lo = (lo - 1) * CLI_TIME_STRIDE + 1;
+		hi = end;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if ((cli_seg_find(seg, seg->first + mid, &rh, &pos) == 0) &&
+				(rh.ts < ts)) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+
+		rec = seg->first + lo;
+	}
+
+	cli_seg_release(segs, n);
+
+	return rec;
+}
+
+/**
+ * References every current segment, oldest first, so they can be walked
+ * while capture and retention go on.  Release with cli_seg_release.
+ */
+cli_seg **cli_seg_snapshot(cli_if *iface, unsigned int *n)
+{
+	cli_seg **segs;
+	unsigned int i;
+
+	pthread_mutex_lock(&iface->lock);
+	segs = (cli_seg **)malloc((iface->nsegs + 1) * sizeof(cli_seg *));
+	*n = 0;
+	if (segs != NULL) {
+		for (i = 0; i < iface->nsegs; i++) {
+			segs[i] = iface->segs[i];
+			__atomic_add_fetch(&segs[i]->ref, 1, __ATOMIC_RELAXED);
+		}
+		*n = iface->nsegs;
+	}
+	pthread_mutex_unlock(&iface->lock);
+
+	return segs;
+}
+
+void cli_seg_release(cli_seg **segs, unsigned int n)
+{
+	unsigned int i;
+
+	if (segs == NULL) { return; }
+
+	for (i = 0; i < n; i++) { cli_seg_put(segs[i]); }
+	free(segs);
+}
+
+/**
+ * Bytes the segment takes up on disk.
+ */
+unsigned long cli_seg_size(cli_seg *seg)
+{
+	return cli_store_size(seg->offset) + cli_store_size(seg->buffer) +
+		cli_store_size(seg->peer) + cli_store_size(seg->time) +
+		cli_store_size(seg->zdata) + cli_store_size(seg->block) +
+		cli_store_size(seg->bloom);
+}
+
+/**
+ * Gives back the memory that reading seg took up, once done with it.
+ */
+void cli_seg_drop(cli_seg *seg)
+{
+	if (seg == NULL) { return; }
+
+	cli_store_drop(seg->offset, 0, cli_store_size(seg->offset));
+	cli_store_drop(seg->buffer, 0, cli_store_size(seg->buffer));
+	cli_store_drop(seg->peer, 0, cli_store_size(seg->peer));
+	cli_store_drop(seg->zdata, 0, cli_store_size(seg->zdata));
+}
+
+/**
+ * Enforces the retention limits: removes the oldest sealed segments while
+ * the interface holds more than retain_bytes, or while they were sealed more
+ * than retain_secs ago.  The active segment always stays.  Files go away
+ * once the last reader lets go of them.  Returns how many segments it
+ * removed.
+ */
+unsigned int cli_seg_retain(cli_if *iface, long now)
+{
+	cli_seg *dead[CLI_DEFAULT_BUFFER];
+	unsigned long total = 0;
+	unsigned int i, n = 0;
+
+	if ((iface->retain_bytes == 0) && (iface->retain_secs == 0)) { return 0; }
+
+	pthread_mutex_lock(&iface->lock);
+	for (i = 0; i < iface->nsegs; i++) { total += cli_seg_size(iface->segs[i]); }
+
+	while ((iface->nsegs > 1) && (n < CLI_DEFAULT_BUFFER) &&
+		(((iface->retain_bytes > 0) && (total > iface->retain_bytes)) ||
+		((iface->retain_secs > 0) &&
+		(now - iface->segs[0]->sealed >= iface->retain_secs)))) {
+		dead[n] = iface->segs[0];
+		dead[n]->dead = 1;
+		total -= cli_seg_size(dead[n]);
+		n++;
+
+		iface->nsegs--;
+		memmove(iface->segs, iface->segs + 1, iface->nsegs * sizeof(cli_seg *));
+	}
+
+	if (iface->nsegs > 0) { iface->rx_first = iface->segs[0]->first; }
+	pthread_mutex_unlock(&iface->lock);
+
+	for (i = 0; i < n; i++) { cli_seg_put(dead[i]); }
+
+	return n;
+}
+
+#if HAVE_LIBZ
+/**
+ * Compresses the next block of a sealed segment, records seg->zrec on, into
+ * its zdata and block files.  raw and z are scratch space for a block.
+ * Returns the raw bytes taken, -1 on error.
+ */
+static long cli_seg_pack(cli_seg *seg, int level, char *raw, char *z)
+{
+	cli_blockent be;
+	unsigned long end = cli_store_size(seg->buffer);
+	uint64_t off;
+	uLongf zlen = compressBound(CLI_BLOCK_MAX);
+	unsigned int i;
+
+	// the block ends where the first record past CLI_BLOCK_BYTES does
+	for (i = seg->zrec + 1; i < seg->count; i++) {
+		if (cli_store_read(seg->offset, seg->base + (i * sizeof(uint64_t)),
+			&off, sizeof(off)) != sizeof(off)) {
+			return -1;
+		}
+		if (off - seg->zraw >= CLI_BLOCK_BYTES) {
+			end = off;
+			break;
+		}
+	}
+
+	memset(&be, 0, sizeof(cli_blockent));
+	be.raw = seg->zraw;
+	be.zoff = cli_store_size(seg->zdata);
+	be.rawlen = end - seg->zraw;
+
+	if ((be.rawlen > CLI_BLOCK_MAX) ||
+		(cli_store_read(seg->buffer, be.raw, raw, be.rawlen) != be.rawlen) ||
+		(compress2((Bytef *)z, &zlen, (Bytef *)raw, be.rawlen, level) != Z_OK)) {
+		return -1;
+	}
+	be.zlen = zlen;
+
+	if ((cli_store_write(seg->zdata, be.zoff, z, zlen) == -1) ||
+		(cli_store_write(seg->block, cli_store_size(seg->block), &be,
+		sizeof(cli_blockent)) == -1)) {
+		return -1;
+	}
+
+	seg->zraw = end;
+	seg->zrec = i;
+
+	return be.rawlen;
+}
+
+// the compressed copy of seg holds all of its records
+static int cli_seg_zdone(cli_seg *seg)
+{
+	return (seg->zdata != NULL) && (seg->zraw >= cli_store_size(seg->buffer));
+}
+
+/**
+ * Puts the finished compressed copies in place of their buffer files, for the
+ * segments no reader holds.  The others are tried again on the next pass.
+ */
+static void cli_seg_swap(cli_if *iface)
+{
+	char path[CLI_DEFAULT_BUFFER];
+	cli_seg *seg;
+	unsigned int i;
+
+	pthread_mutex_lock(&iface->lock);
+	for (i = 0; i + 1 < iface->nsegs; i++) {
+		seg = iface->segs[i];
+		if ((seg->packed) || (seg->dead) || (!cli_seg_zdone(seg)) ||
+			(__atomic_load_n(&seg->ref, __ATOMIC_ACQUIRE) != 1)) {
+			continue;
+		}
+
+		cli_store_close(seg->buffer);
+		seg->buffer = NULL;
+		__atomic_store_n(&seg->packed, 1, __ATOMIC_RELEASE);
+		cli_seg_path(seg, "buffer", path);
+		unlink(path);
+	}
+	pthread_mutex_unlock(&iface->lock);
+}
+#endif
+
+/**
+ * Background compression: works on the oldest sealed segment of iface that
+ * is not compressed yet, CLI_PACK_BYTES at a time.  Once its compressed copy
+ * is complete (and durable, if the interface asks for durability) it takes
+ * the place of the buffer file, as soon as no reader holds the segment.
+ * Returns 1 if there is more to do right away.
+ */
+int cli_seg_compress(cli_if *iface, int level)
+{
+#if HAVE_LIBZ
+	char path[CLI_DEFAULT_BUFFER];
+	cli_seg *seg = NULL;
+	char *raw;
+	unsigned long done = 0;
+	unsigned int i;
+	long n = 0;
+
+	pthread_mutex_lock(&iface->lock);
+	for (i = 0; i + 1 < iface->nsegs; i++) {
+		if ((iface->segs[i]->version == CLI_CAP_VERSION) &&
+			(!iface->segs[i]->packed) && (iface->segs[i]->count > 0) &&
+			(!cli_seg_zdone(iface->segs[i]))) {
+			seg = iface->segs[i];
+			__atomic_add_fetch(&seg->ref, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&iface->lock);
+
+	if (seg == NULL) {
+		cli_seg_swap(iface);
+		return 0;
+	}
+
+	if (seg->zdata == NULL) {
+		cli_seg_path(seg, "zdata", path);
+		seg->zdata = cli_store_open(path, CLI_STORE_CREATE | CLI_STORE_RESERVE);
+		cli_seg_path(seg, "block", path);
+		seg->block = cli_store_open(path, CLI_STORE_CREATE);
+		seg->zraw = 0;
+		seg->zrec = 0;
+	}
+
+	raw = (char *)malloc(CLI_BLOCK_MAX + compressBound(CLI_BLOCK_MAX));
+	if ((raw == NULL) || (seg->zdata == NULL) || (seg->block == NULL)) {
+		free(raw);
+		cli_seg_put(seg);
+		return 0;
+	}
+
+	while ((seg->zraw < cli_store_size(seg->buffer)) && (done < CLI_PACK_BYTES)) {
+		if ((n = cli_seg_pack(seg, level, raw, raw + CLI_BLOCK_MAX)) <= 0) { break; }
+		done += n;
+	}
+	free(raw);
+
+	if (n == -1) {
+		// start over on the next pass
+		cli_store_close(seg->zdata);
+		cli_store_close(seg->block);
+		seg->zdata = NULL;
+		seg->block = NULL;
+	} else if (cli_seg_zdone(seg)) {
+		if (iface->durable.mode != CLI_DURABLE_NONE) {
+			cli_store_sync(seg->zdata);
+			cli_store_sync(seg->block);
+		}
+		cli_store_seal(seg->zdata);
+		cli_store_seal(seg->block);
+	}
+
+	cli_seg_put(seg);
+	cli_seg_swap(iface);
+
+	return (done > 0);
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Opens the files of a version 1 session as a sealed segment holding all of
+ * its records, read only.  Returns NULL if there is no such session.
+ */
+static cli_seg *cli_seg_open_v1(cli_if *iface, const char *dir)
+{
+	char path[CLI_DEFAULT_BUFFER];
+	struct stat st;
+	cli_if_v1 v1;
+	cli_seg *seg;
+
+	if ((seg = cli_seg_alloc(iface, dir)) == NULL) { return NULL; }
+
+	seg->version = 1;
+	seg->base = sizeof(cli_if_v1);
+
+	cli_seg_path(seg, "offset", path);
+	seg->offset = cli_store_open(path, CLI_STORE_RDONLY);
+	cli_seg_path(seg, "buffer", path);
+	seg->buffer = cli_store_open(path, CLI_STORE_RDONLY);
+
+	if ((seg->offset == NULL) || (seg->buffer == NULL) ||
+		(cli_store_read(seg->offset, 0, &v1, sizeof(cli_if_v1)) !=
+		sizeof(cli_if_v1)) || (v1.header != 'i') ||
+		(cli_store_size(seg->offset) < seg->base + sizeof(uint32_t))) {
+		cli_seg_free(seg);
+		return NULL;
+	}
+
+	seg->first = 0;
+	seg->count = (cli_store_size(seg->offset) - seg->base) /
+		sizeof(uint32_t) - 1;
+	seg->bytes = cli_store_size(seg->buffer);
+
+	// nothing was timed back then; the last write will do
+	if (stat(path, &st) == 0) { seg->created = st.st_mtime; }
+	seg->sealed = seg->created;
+
+	return seg;
+}
+
+static int cli_seg_cmp(const void *a, const void *b)
+{
+	unsigned int x = (*(cli_seg **)a)->seq, y = (*(cli_seg **)b)->seq;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Drops what a capture writer has only reserved at the end of a segment that
+ * was still being written: offsets after the first are never 0.  The files
+ * are cut to the records that are left.
+ */
+static void cli_seg_trim(cli_seg *seg)
+{
+	cli_rechdr rh;
+	cli_timeent te;
+	uint64_t off;
+	unsigned long pos;
+	unsigned int lo = 1, hi = seg->count, mid;
+
+	if ((seg->version == 1) || (seg->packed)) { return; }
+
+	while ((seg->count > 0) && (lo < hi)) {
+		mid = (lo + hi) / 2;
+		if ((cli_store_read(seg->offset, seg->base + (mid * sizeof(uint64_t)),
+			&off, sizeof(off)) == sizeof(off)) && (off != 0)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	// every record is stamped, so an untimed first one is not there yet
+	if ((seg->count == 0) ||
+		(cli_seg_find(seg, seg->first + lo - 1, &rh, &pos) == -1) ||
+		((lo == 1) && (rh.ts == 0))) {
+		seg->count = 0;
+		seg->bytes = 0;
+	} else {
+		seg->count = lo;
+		seg->bytes = pos + rh.len;
+	}
+
+	// likewise the time index entries, up to those of the records left
+	lo = 0;
+	hi = (seg->count + CLI_TIME_STRIDE - 1) / CLI_TIME_STRIDE;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if ((cli_store_read(seg->time, mid * sizeof(cli_timeent), &te,
+			sizeof(cli_timeent)) == sizeof(cli_timeent)) && (te.ts != 0)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	cli_store_trim(seg->offset, seg->base + (seg->count * sizeof(uint64_t)));
+	cli_store_trim(seg->buffer, seg->bytes);
+	cli_store_trim(seg->peer, seg->count * sizeof(struct sockaddr_in));
+	cli_store_trim(seg->time, lo * sizeof(cli_timeent));
+	cli_bloom_trim(seg);
+}
+
+/**
+ * Fills in the time index of a sealed seg, if it is missing entries, from a
+ * writable copy of the file.
+ */
+static void cli_seg_retime(cli_seg *seg)
+{
+	char path[CLI_DEFAULT_BUFFER];
+	cli_store *time;
+
+	if ((seg->version == 1) || (cli_store_size(seg->time) / sizeof(cli_timeent) >=
+		(seg->count + CLI_TIME_STRIDE - 1) / CLI_TIME_STRIDE) ||
+		(cli_seg_path(seg, "time", path) == -1)) {
+		return;
+	}
+
+	if (((time = cli_store_open(path, 0)) == NULL) &&
+		((time = cli_store_open(path, CLI_STORE_CREATE)) == NULL)) {
+		return;
+	}
+
+	// as far as cli_seg_trim took the read only copy
+	cli_store_trim(time, cli_store_size(seg->time));
+	cli_store_close(seg->time);
+	seg->time = time;
+	cli_seg_reindex(seg);
+}
+
+/**
+ * Opens segment seq of a reloaded interface from dir and picks up how far it
+ * got.  Returns NULL if there is no such segment.
+ */
+static cli_seg *cli_seg_load_one(cli_if *iface, const char *dir,
+	unsigned int seq, int flags)
+{
+	cli_seghdr hdr;
+	cli_seg *seg;
+
+	if ((seg = cli_seg_open(iface, dir, seq, flags)) == NULL) { return NULL; }
+
+	if ((cli_store_read(seg->offset, 0, &hdr, sizeof(cli_seghdr)) !=
+		sizeof(cli_seghdr)) || (hdr.magic != CLI_CAP_MAGIC) ||
+		(hdr.version > CLI_CAP_VERSION) ||
+		(cli_store_size(seg->offset) < hdr.size)) {
+		cli_seg_put(seg);
+		return NULL;
+	}
+
+	seg->base = hdr.size;
+	seg->first = hdr.first;
+	seg->created = hdr.created;
+	seg->sealed = seg->created;
+	seg->count = (cli_store_size(seg->offset) - seg->base) /
+		sizeof(uint64_t);
+	seg->bytes = cli_seg_raw(seg);
+	cli_seg_trim(seg);
+	if (!(flags & CLI_STORE_RDONLY)) { cli_seg_reindex(seg); }
+
+	return seg;
+}
+
+/**
+ * Opens segment seq of a reloaded interface from dir and adds it to the
+ * interface's list, unsorted.  Segments are only read; cli_seg_load_done
+ * opens the one capture continues in for writing.  Returns -1 if there is
+ * no such segment.
+ */
+static int cli_seg_load_seq(cli_if *iface, const char *dir, unsigned int seq,
+	int flags)
+{
+	cli_seg *seg;
+
+	seg = cli_seg_load_one(iface, dir, seq, CLI_STORE_RDONLY);
+	if (seg == NULL) { return -1; }
+
+	seg->rdonly = ((flags & CLI_STORE_RDONLY) != 0);
+	if (!seg->rdonly) { cli_seg_retime(seg); }
+
+	if (cli_seg_append(iface, seg) == -1) {
+		cli_seg_put(seg);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Starts loading the segments of a reloaded interface: the old records of a
+ * version 1 session, if there is one, come first.  Returns how many
+ * segments that makes.
+ */
+static unsigned int cli_seg_load_v1(cli_if *iface, const char *dir)
+{
+	cli_seg *seg;
+
+	iface->segs = NULL;
+	iface->nsegs = 0;
+	iface->segcap = 0;
+	iface->seq = 0;
+
+	if ((seg = cli_seg_open_v1(iface, dir)) == NULL) { return 0; }
+	if (cli_seg_append(iface, seg) == -1) {
+		cli_seg_put(seg);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Puts the loaded segments in order and picks up where capture left off.
+ * All but the newest are sealed; capture continues in a fresh segment if the
+ * newest is not a version 2 one.
+ */
+static int cli_seg_load_done(cli_if *iface, const char *dir, int flags,
+	unsigned int legacy)
+{
+	cli_seg *seg = NULL, *tail;
+	unsigned int i;
+	int live = 0;
+
+	if (iface->nsegs > legacy) {
+		qsort(iface->segs + legacy, iface->nsegs - legacy, sizeof(cli_seg *),
+			cli_seg_cmp);
+	}
+
+	for (i = 0; i + 1 < iface->nsegs; i++) {
+		seg = iface->segs[i];
+		cli_seg_seal(seg);
+		seg->sealed = iface->segs[i + 1]->created;
+	}
+
+	// the segments are the authority on what was captured
+	if (iface->nsegs > 0) {
+		seg = iface->segs[iface->nsegs - 1];
+
+		// capture goes on in the newest one if it can be written again
+		if ((!(flags & CLI_STORE_RDONLY)) && (seg->version != 1) &&
+			(!seg->packed) &&
+			((tail = cli_seg_load_one(iface, dir, seg->seq, 0)) != NULL)) {
+			iface->segs[iface->nsegs - 1] = tail;
+			cli_seg_put(seg);
+			seg = tail;
+			live = 1;
+		}
+
+		iface->seq = seg->seq + 1;
+		iface->rx_first = iface->segs[0]->first;
+		iface->rx_count = seg->first + seg->count;
+		iface->rx_offsetpos = seg->bytes;
+	} else {
+		iface->rx_first = iface->rx_count;
+	}
+
+	// capture never appends to old or compressed data
+	if (flags & CLI_STORE_RDONLY) {
+	} else if (!live) {
+		if (cli_seg_new(iface, dir) == NULL) { return -1; }
+	}
+
+	return 0;
+}
+
+/**
+ * Picks up the segments of a reloaded interface from dir, whichever there
+ * are, behind the records of a version 1 session if there is one.
+ * CLI_STORE_RDONLY only reads them, leaving the session as it is for
+ * whoever may still be capturing into it.
+ */
+int cli_seg_load(cli_if *iface, const char *dir, int flags)
+{
+	DIR *d;
+	struct dirent *dp;
+	unsigned int id, seq, legacy;
+	char kind[CLI_DEFAULT_BUFFER];
+
+	if ((d = opendir(dir)) == NULL) { return -1; }
+
+	legacy = cli_seg_load_v1(iface, dir);
+
+	while ((dp = readdir(d)) != NULL) {
+		if ((sscanf(dp->d_name, "if%02x-%6[a-z].%u", &id, kind, &seq) < 3) ||
+			(id != iface->id) || (strcmp(kind, "offset") != 0)) {
+			continue;
+		}
+
+		cli_seg_load_seq(iface, dir, seq, flags);
+	}
+	closedir(d);
+
+	return cli_seg_load_done(iface, dir, flags, legacy);
+}
+
+/**
+ * cli_seg_load for an interface whose segments were first to next - 1 when
+ * the session manifest was written, without scanning dir.  Those since
+ * removed are passed over; those rotated in since follow on from next.
+ */
+int cli_seg_load_range(cli_if *iface, const char *dir, int flags,
+	unsigned int first, unsigned int next)
+{
+	unsigned int seq, legacy;
+
+	legacy = cli_seg_load_v1(iface, dir);
+
+	for (seq = first; seq < next; seq++) {
+		cli_seg_load_seq(iface, dir, seq, flags);
+	}
+	while (cli_seg_load_seq(iface, dir, seq, flags) == 0) { seq++; }
+
+	return cli_seg_load_done(iface, dir, flags, legacy);
+}
+
+/**
+ * The sequence numbers of the version 2 segments of iface, first to
+ * next - 1, for the session manifest.
+ */
+void cli_seg_range(cli_if *iface, uint32_t *first, uint32_t *next)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&iface->lock);
+	*first = *next = iface->seq;
+	for (i = 0; i < iface->nsegs; i++) {
+		if (iface->segs[i]->version != 1) {
+			*first = iface->segs[i]->seq;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&iface->lock);
+}
+
+/**
+ * Drops the interface's hold on its segments, leaving the files in place.
+ */
+void cli_seg_free_all(cli_if *iface)
+{
+	unsigned int i;
+
+	for (i = 0; i < iface->nsegs; i++) { cli_seg_put(iface->segs[i]); }
+	free(iface->segs);
+
+	iface->segs = NULL;
+	iface->nsegs = 0;
+	iface->segcap = 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "clibase.h"
+
+// largest block: it ends with the first record to cross CLI_BLOCK_BYTES
+#define CLI_BLOCK_MAX	(CLI_BLOCK_BYTES + sizeof(cli_rechdr) + CLI_MAX_BUFFER)
+// a block and its compressed form, which zlib keeps within a few bytes
+#define CLI_SEG_SCRATCH	(2 * CLI_BLOCK_MAX + 1024)
+
+void cli_seg_name(cli_seg *seg, const char *kind, char *name);
+int cli_seg_path(cli_seg *seg, const char *kind, char *path);
+
+// capture writer, with iface->lock held
+cli_seg *cli_seg_new(cli_if *iface, const char *dir);
+cli_seg *cli_seg_active(cli_if *iface);
+int cli_seg_rotate(cli_if *iface, long now);
+void cli_seg_index(cli_seg *seg, unsigned int rec, unsigned long ts);
+
+// any thread
+cli_seg *cli_seg_get(cli_if *iface, unsigned int rec);
+void cli_seg_put(cli_seg *seg);
+int cli_seg_find(cli_seg *seg, unsigned int rec, cli_rechdr *rh,
+	unsigned long *pos);
+int cli_seg_copy(cli_seg *seg, unsigned int rec, char *data, unsigned int max,
+	cli_rechdr *rh, struct sockaddr_in *peer);
+int cli_seg_part(cli_seg *seg, unsigned int rec, unsigned int skip, char *data,
+	unsigned int max, cli_rechdr *rh);
+unsigned long cli_seg_data(cli_seg *seg, unsigned int rec);
+void cli_seg_peer(cli_seg *seg, unsigned int rec, cli_rechdr *rh,
+	struct sockaddr_in *peer);
+int cli_seg_run(cli_seg *seg, unsigned int rec, unsigned int n, char *data,
+	unsigned long max, unsigned long *len);
+int cli_seg_read(cli_if *iface, unsigned int rec, char *data, unsigned int max,
+	cli_rechdr *rh, struct sockaddr_in *peer);
+cli_seg *cli_seg_walk(cli_if *iface, cli_seg *seg, unsigned int rec);
+unsigned int cli_seg_seek(cli_if *iface, unsigned long ts);
+cli_seg **cli_seg_snapshot(cli_if *iface, unsigned int *n);
+void cli_seg_release(cli_seg **segs, unsigned int n);
+unsigned long cli_seg_size(cli_seg *seg);
+void cli_seg_drop(cli_seg *seg);
+unsigned long cli_seg_raw(cli_seg *seg);
+unsigned int cli_seg_blocks(cli_seg *seg);
+long cli_seg_block(cli_seg *seg, unsigned int b, char *raw, unsigned long *pos);
+
+// background
+unsigned int cli_seg_retain(cli_if *iface, long now);
+int cli_seg_compress(cli_if *iface, int level);
+
+int cli_seg_load(cli_if *iface, const char *dir, int flags);
+int cli_seg_load_range(cli_if *iface, const char *dir, int flags,
+	unsigned int first, unsigned int next);
+void cli_seg_range(cli_if *iface, uint32_t *first, uint32_t *next);
+void cli_seg_free_all(cli_if *iface);
@@ -0,0 +1,221 @@
+/*
+ * cli_send.c - streaming files out over an interface (tx<file)
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <curses.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "clibase.h"
+#include "cli.h"
+#include "cli_send.h"
+
+// bytes handed to sendfile at a time
+#define CLI_SEND_CHUNK		(1024 * 1024)
+// ms a full socket may hold up a send before it is given up on
+#define CLI_SEND_WAIT		5000
+// us between progress reports
+#define CLI_SEND_REPORT		250000
+
+static unsigned long cli_send_usec(const struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	return ((t1.tv_sec - t0->tv_sec) * 1000000UL) +
+		(t1.tv_nsec / 1000) - (t0->tv_nsec / 1000);
+}
+
+/**
+ * Waits for the non-blocking fd to take more.  Returns -1 if it does not
+ * within CLI_SEND_WAIT.
+ */
+static int cli_send_wait(int fd)
+{
+	struct pollfd p;
+
+	p.fd = fd;
+	p.events = POLLOUT;
+	p.revents = 0;
+
+	if (poll(&p, 1, CLI_SEND_WAIT) != 1) {
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Hands up to len bytes of in from *off on to the kernel to send on iface,
+ * without them passing through user space.
+ */
+static long cli_send_zc(cli_if *iface, int in, off_t *off, size_t len)
+{
+	ssize_t n;
+
+	while ((n = sendfile(iface->rxdev.fd, in, off, len)) == -1) {
+		if (errno == EINTR) { continue; }
+		if ((errno != EAGAIN) || (cli_send_wait(iface->rxdev.fd) == -1)) {
+			return -1;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Sends len bytes of buffer on iface in one piece, a datagram for udp,
+ * waiting on a full fd for up to CLI_SEND_WAIT at a time.  Files are
+ * written through cli_if_send.  Returns len, or -1.
+ */
+long cli_send_buffer(cli_ctx *ctx, cli_if *iface, char *buffer, size_t len)
+{
+	ssize_t w = 0, k;
+
+	if (iface->type == CLI_TYPE_FILE) {
+		cli_if_send(ctx, iface, buffer, len);
+		return len;
+	}
+
+	while (w < (ssize_t)len) {
+		if ((k = write(iface->rxdev.fd, buffer + w, len - w)) == -1) {
+			if (errno == EINTR) { continue; }
+			if ((errno != EAGAIN) || (cli_send_wait(iface->rxdev.fd) == -1)) {
+				return -1;
+			}
+			continue;
+		}
+		w += k;
+	}
+
+	return len;
+}
+
+/**
+ * Reads up to len bytes of in from *off on into buffer and sends them on
+ * iface with cli_send_buffer.  echo, if set, queues them too.
+ */
+static long cli_send_copy(cli_ctx *ctx, cli_if *iface, cli_if *echo, int in,
+	off_t *off, char *buffer, size_t len)
+{
+	ssize_t n;
+
+	if ((n = pread(in, buffer, len, *off)) <= 0) { return n; }
+	if (cli_send_buffer(ctx, iface, buffer, n) == -1) { return -1; }
+
+	if (echo != NULL) { cli_handle_rx(ctx, echo, buffer, n); }
+	*off += n;
+
+	return n;
+}
+
+/**
+ * Rewrites the progress line at row y.  done ends it.
+ */
+static void cli_send_report(cli_ctx *ctx, int y, unsigned long sent,
+	unsigned long size, unsigned long usec, int done)
+{
+	unsigned long kbs = (usec > 0 ? (sent * 1000UL) / usec : 0);
+
+	pthread_mutex_lock(&ctx->ui.mutex);
+	move(y, 0);
+	clrtoeol();
+	printw("  %lu of %lu byte(s) (%lu%%), %lu.%03lus, %lu.%02lu MB/s", sent,
+		size, (size > 0 ? (sent * 100UL) / size : 100UL), usec / 1000000UL,
+		(usec / 1000UL) % 1000UL, kbs / 1000UL, (kbs % 1000UL) / 10UL);
+	if (done) { addch('\n'); }
+	refresh();
+	pthread_mutex_unlock(&ctx->ui.mutex);
+}
+
+/**
+ * Streams the file at path out on iface, whatever its size, reporting
+ * progress and throughput as it goes.  tcp and serial interfaces are fed
+ * by sendfile straight from the page cache.  udp gets a datagram per buffer
+ * size, and files are written through cli_if_send.  echo, if set, queues
+ * what was sent as tie lines do, which needs the bytes read in.  Returns
+ * the bytes sent, or -1.
+ */
+long cli_send_file(cli_ctx *ctx, cli_if *iface, cli_if *echo, const char *path)
+{
+	char buffer[CLI_MAX_BUFFER];
+	struct timespec t0;
+	struct stat st;
+	unsigned long usec, last = 0;
+	off_t off = 0;
+	size_t chunk = CLI_MAX_BUFFER;
+	long n = 0;
+	int fd, y, zc = 0;
+
+	switch (iface->type) {
+	case CLI_TYPE_TCP:
+	case CLI_TYPE_SERIAL:
+		zc = (echo == NULL);
+		chunk = (zc ? CLI_SEND_CHUNK : CLI_MAX_BUFFER);
+		// fall through
+	case CLI_TYPE_UDP:
+		if (!iface->rxopen) {
+			printw("Error: `tx<' interface is not connected.\n");
+			return -1;
+		}
+		if (iface->type == CLI_TYPE_UDP) {
+			chunk = iface->buffer_size;
+			if ((chunk == 0) || (chunk > CLI_MAX_BUFFER)) { chunk = CLI_MAX_BUFFER; }
+		}
+		break;
+	case CLI_TYPE_FILE:
+		break;
+	default:
+		printw("Error: `tx<' cannot send to this type of interface.\n");
+		return -1;
+	}
+
+	if (((fd = open(path, O_RDONLY)) == -1) || (fstat(fd, &st) == -1)) {
+		cli_print_error("tx<");
+		if (fd != -1) { close(fd); }
+		return -1;
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	y = getcury(stdscr);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	while (off < st.st_size) {
+		if (zc) {
+			n = cli_send_zc(iface, fd, &off, chunk);
+		} else {
+			n = cli_send_copy(ctx, iface, echo, fd, &off, buffer, chunk);
+		}
+		// the file got shorter, or the interface gave up
+		if (n <= 0) { break; }
+
+		usec = cli_send_usec(&t0);
+		if (usec - last >= CLI_SEND_REPORT) {
+			cli_send_report(ctx, y, off, st.st_size, usec, 0);
+			last = usec;
+		}
+	}
+
+	cli_send_report(ctx, y, off, st.st_size, cli_send_usec(&t0), 1);
+	if (n < 0) { cli_print_error("tx<"); }
+
+	close(fd);
+
+	return (n < 0 ? -1 : (long)off);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "clibase.h"
+
+long cli_send_buffer(cli_ctx *ctx, cli_if *iface, char *buffer, size_t len);
+long cli_send_file(cli_ctx *ctx, cli_if *iface, cli_if *echo, const char *path);
@@ -0,0 +1,323 @@
+/*
+ * cli_store.c - mmap'd append-only capture files
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "clibase.h"
+#include "cli_store.h"
+
+/**
+ * Grows the file to hold at least end bytes, ahead of the writer copying
+ * them in.  CLI_STORE_RESERVE stores allocate the blocks up front, a
+ * CLI_STORE_STEP at a time, so that a full disk fails here rather than as
+ * SIGBUS in the writer; the others only grow to the next page.
+ */
+static int cli_store_extend(cli_store *s, unsigned long end)
+{
+	unsigned long step = (s->flags & CLI_STORE_RESERVE ? CLI_STORE_STEP :
+		(unsigned long)sysconf(_SC_PAGESIZE));
+	unsigned long size = ((end + step - 1) / step) * step;
+	int err;
+
+	if (end <= s->size) { return 0; }
+
+	if (s->flags & CLI_STORE_RESERVE) {
+		if ((err = posix_fallocate(s->fd, s->size, size - s->size)) != 0) {
+			errno = err;
+			return -1;
+		}
+	} else if (ftruncate(s->fd, size) == -1) {
+		return -1;
+	}
+
+	s->size = size;
+
+	return 0;
+}
+
+/**
+ * Maps chunk c of the file.  The mapping may reach past the end of the file;
+ * the writer extends the file before it touches those pages.
+ */
+static int cli_store_map(cli_store *s, unsigned int c)
+{
+	char *p;
+	int prot = PROT_READ;
+
+	if (c >= CLI_STORE_CHUNKS) { return -1; }
+	if (!(s->flags & CLI_STORE_RDONLY)) { prot |= PROT_WRITE; }
+
+	p = (char *)mmap(NULL, CLI_STORE_CHUNK, prot, MAP_SHARED, s->fd,
+		(off_t)c * CLI_STORE_CHUNK);
+	if (p == MAP_FAILED) { return -1; }
+
+	s->chunk[c] = p;
+	s->nchunks = c + 1;
+
+	return 0;
+}
+
+/**
+ * Opens (CLI_STORE_CREATE: creates or truncates) a capture file.  Whatever
+ * the file already holds counts as published.
+ */
+cli_store *cli_store_open(const char *path, int flags)
+{
+	cli_store *s;
+	struct stat st;
+	unsigned int c, n;
+	int mode = O_RDWR;
+
+	if (flags & CLI_STORE_CREATE) { mode |= O_CREAT | O_TRUNC; }
+	if (flags & CLI_STORE_RDONLY) { mode = O_RDONLY; }
+
+	s = (cli_store *)malloc(sizeof(cli_store));
+	if (s == NULL) { return NULL; }
+	memset(s, 0, sizeof(cli_store));
+
+	s->flags = flags;
+	s->fd = open(path, mode | O_CLOEXEC, 0644);
+	if ((s->fd == -1) || (fstat(s->fd, &st) == -1)) {
+		if (s->fd != -1) { close(s->fd); }
+		free(s);
+		return NULL;
+	}
+
+	s->tail = st.st_size;
+	s->size = st.st_size;
+
+	n = (s->tail + CLI_STORE_CHUNK - 1) / CLI_STORE_CHUNK;
+	for (c = 0; c < n; c++) {
+		if (cli_store_map(s, c) == -1) {
+			cli_store_close(s);
+			return NULL;
+		}
+	}
+
+	return s;
+}
+
+/**
+ * Unmaps the file and cuts off what was grown ahead of the writer, leaving
+ * exactly the published bytes on disk.
+ */
+void cli_store_close(cli_store *s)
+{
+	unsigned int c;
+
+	if (s == NULL) { return; }
+
+	for (c = 0; c < s->nchunks; c++) {
+		munmap(s->chunk[c], CLI_STORE_CHUNK);
+	}
+
+	if (s->fd != -1) {
+		if (!(s->flags & CLI_STORE_RDONLY)) { ftruncate(s->fd, s->tail); }
+		close(s->fd);
+	}
+
+	free(s);
+}
+
+/**
+ * Ends writing: cuts the file to the published bytes and gives up the file
+ * descriptor.  The mapping stays for readers.
+ */
+void cli_store_seal(cli_store *s)
+{
+	if ((s == NULL) || (s->fd == -1)) { return; }
+
+	if (!(s->flags & CLI_STORE_RDONLY)) { ftruncate(s->fd, s->tail); }
+	close(s->fd);
+
+	s->fd = -1;
+	s->flags |= CLI_STORE_RDONLY;
+}
+
+/**
+ * Takes back what was published past tail, e.g. space a writer that died had
+ * only reserved.  Writable stores cut the file there too, so that what the
+ * writer appends next never reads as stale data.
+ */
+int cli_store_trim(cli_store *s, unsigned long tail)
+{
+	if ((s == NULL) || (tail >= s->tail)) { return 0; }
+
+	s->tail = tail;
+	if (s->synced > tail) { s->synced = tail; }
+
+	if ((s->flags & CLI_STORE_RDONLY) || (s->fd == -1)) { return 0; }
+
+	if (ftruncate(s->fd, tail) == -1) { return -1; }
+	s->size = tail;
+
+	return 0;
+}
+
+/**
+ * Copies len bytes to offset off, mapping more of the file as needed, without
+ * publishing them.  Returns -1 if the file cannot grow that far.
+ */
+static int cli_store_copy(cli_store *s, unsigned long off, const void *data,
+	size_t len)
+{
+	const char *src = (const char *)data;
+	size_t n;
+
+	if (cli_store_extend(s, off + len) == -1) { return -1; }
+
+	while (len > 0) {
+		while (off / CLI_STORE_CHUNK >= s->nchunks) {
+			if (cli_store_map(s, s->nchunks) == -1) { return -1; }
+		}
+
+		n = CLI_STORE_CHUNK - (off % CLI_STORE_CHUNK);
+		if (n > len) { n = len; }
+
+		memcpy(s->chunk[off / CLI_STORE_CHUNK] + (off % CLI_STORE_CHUNK), src, n);
+
+		off += n;
+		src += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * Copies len bytes to offset off and publishes them once they are all in
+ * place.  Returns -1, publishing nothing, if the file cannot grow that far.
+ */
+int cli_store_write(cli_store *s, unsigned long off, const void *data,
+	size_t len)
+{
+	if (cli_store_copy(s, off, data, len) == -1) { return -1; }
+
+	if (off + len > s->tail) {
+		__atomic_store_n(&s->tail, off + len, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+/**
+ * cli_store_write for the n buffers of iov, one after the other.
+ */
+int cli_store_writev(cli_store *s, unsigned long off, const struct iovec *iov,
+	int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (cli_store_copy(s, off, iov[i].iov_base, iov[i].iov_len) == -1) {
+			return -1;
+		}
+		off += iov[i].iov_len;
+	}
+
+	if (off > s->tail) { __atomic_store_n(&s->tail, off, __ATOMIC_RELEASE); }
+
+	return 0;
+}
+
+/**
+ * Forces the bytes published since the last call to disk.  Only one thread may
+ * sync a store, but it may do so while the writer keeps appending.
+ */
+int cli_store_sync(cli_store *s)
+{
+	unsigned long tail = cli_store_size(s);
+	unsigned long off, end, page = sysconf(_SC_PAGESIZE);
+	unsigned int c;
+	int ret = 0;
+
+	for (off = s->synced & ~(page - 1); off < tail; off = end) {
+		c = off / CLI_STORE_CHUNK;
+		end = (unsigned long)(c + 1) * CLI_STORE_CHUNK;
+		if (end > tail) { end = tail; }
+
+		if (msync(s->chunk[c] + (off % CLI_STORE_CHUNK), end - off, MS_SYNC) == -1) {
+			ret = -1;
+		}
+	}
+
+	if (ret == 0) { s->synced = tail; }
+
+	return ret;
+}
+
+/**
+ * Bytes published so far.
+ */
+unsigned long cli_store_size(cli_store *s)
+{
+	if (s == NULL) { return 0; }
+	return __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Copies up to len published bytes from offset off and returns how many were
+ * available.
+ */
+size_t cli_store_read(cli_store *s, unsigned long off, void *data, size_t len)
+{
+	char *dst = (char *)data;
+	unsigned long tail = cli_store_size(s);
+	size_t n, total;
+
+	if (off >= tail) { return 0; }
+	if (len > tail - off) { len = tail - off; }
+
+	for (total = len; len > 0; ) {
+		n = CLI_STORE_CHUNK - (off % CLI_STORE_CHUNK);
+		if (n > len) { n = len; }
+
+		memcpy(dst, s->chunk[off / CLI_STORE_CHUNK] + (off % CLI_STORE_CHUNK), n);
+
+		off += n;
+		dst += n;
+		len -= n;
+	}
+
+	return total;
+}
+
+/**
+ * Gives back the memory that reading bytes off..off+len took up.  They stay
+ * in the file and are mapped in again when read next, so a scan over a whole
+ * capture does not keep it resident.
+ */
+void cli_store_drop(cli_store *s, unsigned long off, size_t len)
+{
+	unsigned long page = sysconf(_SC_PAGESIZE), end, to;
+
+	if (s == NULL) { return; }
+
+	end = cli_store_size(s);
+	if (off >= end) { return; }
+	if (len < end - off) { end = off + len; }
+
+	// only the pages wholly in the range
+	off = (off + page - 1) & ~(page - 1);
+	end &= ~(page - 1);
+
+	for (; off < end; off = to) {
+		to = (off / CLI_STORE_CHUNK + 1) * CLI_STORE_CHUNK;
+		if (to > end) { to = end; }
+
+		madvise(s->chunk[off / CLI_STORE_CHUNK] + (off % CLI_STORE_CHUNK),
+			to - off, MADV_DONTNEED);
+	}
+}
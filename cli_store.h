@@ -0,0 +1,29 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include "clibase.h"
+
+#define CLI_STORE_CREATE	0x01
+#define CLI_STORE_RDONLY	0x02
+// records go in: allocate the file's blocks ahead of the writer
+#define CLI_STORE_RESERVE	0x04
+
+cli_store *cli_store_open(const char *path, int flags);
+void cli_store_close(cli_store *s);
+void cli_store_seal(cli_store *s);
+int cli_store_trim(cli_store *s, unsigned long tail);
+
+// writer, serialized by the caller
+int cli_store_write(cli_store *s, unsigned long off, const void *data,
+	size_t len);
+int cli_store_writev(cli_store *s, unsigned long off, const struct iovec *iov,
+	int n);
+
+// flusher: forces everything published so far to disk
+int cli_store_sync(cli_store *s);
+
+// readers, any thread
+unsigned long cli_store_size(cli_store *s);
+size_t cli_store_read(cli_store *s, unsigned long off, void *data, size_t len);
+void cli_store_drop(cli_store *s, unsigned long off, size_t len);
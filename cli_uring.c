@@ -0,0 +1,396 @@
+/*
+ * cli_uring.c - io_uring based rx engine
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+
+#include "config.h"
+
+#include "clibase.h"
+#include "cli.h"
+#include "cli_reactor.h"
+#include "cli_writer.h"
+#include "cli_pool.h"
+#include "cli_uring.h"
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+
+// user_data layout: tag in the upper 32 bits, value in the lower 32
+#define CLI_URING_RECV		1
+#define CLI_URING_WAKE		2
+#define CLI_URING_CANCEL	3
+
+#define CLI_URING_TAG(t, v)	(((uint64_t)(t) << 32) | (uint32_t)(v))
+
+struct cli_uring {
+	struct io_uring ring;
+	struct io_uring_buf_ring *br;
+
+	// pool buffers currently provided to the kernel, by buffer id
+	cli_buf *bufs[CLI_URING_BUFFERS];
+
+	// header template for multishot recvmsg on udp interfaces
+	struct msghdr msg;
+
+	// fd with a live multishot recv per interface (-1 if none) and the
+	// generation of that request, so stale completions can be told apart
+	int armed[CLI_DEFAULT_BUFFER];
+	unsigned int gen[CLI_DEFAULT_BUFFER];
+	unsigned char udp[CLI_DEFAULT_BUFFER];
+	// set for interfaces that are not sockets, polled and then read
+	unsigned char poll[CLI_DEFAULT_BUFFER];
+};
+
+static struct io_uring_sqe *cli_uring_sqe(struct cli_uring *u)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&u->ring);
+
+	if (sqe == NULL) {
+		// sq is full, flush it and try again
+		io_uring_submit(&u->ring);
+		sqe = io_uring_get_sqe(&u->ring);
+	}
+
+	return sqe;
+}
+
+static void cli_uring_recycle(struct cli_uring *u, unsigned int bid)
+{
+	io_uring_buf_ring_add(u->br, u->bufs[bid]->data, CLI_MAX_BUFFER, bid, io_uring_buf_ring_mask(CLI_URING_BUFFERS), 0);
+	io_uring_buf_ring_advance(u->br, 1);
+}
+
+static void cli_uring_arm_wake(cli_reactor *r)
+{
+	struct cli_uring *u = (struct cli_uring *)r->uring;
+	struct io_uring_sqe *sqe = cli_uring_sqe(u);
+
+	io_uring_prep_poll_multishot(sqe, r->evfd, POLLIN);
+	io_uring_sqe_set_data64(sqe, CLI_URING_TAG(CLI_URING_WAKE, 0));
+}
+
+int cli_uring_init(cli_reactor *r)
+{
+	struct cli_uring *u;
+	int i, ret;
+
+	u = (struct cli_uring *)malloc(sizeof(struct cli_uring));
+	if (u == NULL) { return -1; }
+	memset(u, 0, sizeof(struct cli_uring));
+
+	for (i = 0; i < CLI_DEFAULT_BUFFER; i++) { u->armed[i] = -1; }
+	u->msg.msg_namelen = sizeof(struct sockaddr_in);
+
+	if (io_uring_queue_init(CLI_URING_ENTRIES, &u->ring, 0) < 0) {
+		free(u);
+		return -1;
+	}
+
+	u->br = io_uring_setup_buf_ring(&u->ring, CLI_URING_BUFFERS, 0, 0, &ret);
+	for (i = 0; (u->br != NULL) && (i < CLI_URING_BUFFERS); i++) {
+		if ((u->bufs[i] = cli_buf_alloc(&r->pool)) == NULL) { break; }
+	}
+
+	if ((u->br == NULL) || (i < CLI_URING_BUFFERS)) {
+		// kernel without provided buffer rings, stay on epoll
+		if (u->br != NULL) {
+			io_uring_free_buf_ring(&u->ring, u->br, CLI_URING_BUFFERS, 0);
+		}
+		io_uring_queue_exit(&u->ring);
+		for (i = 0; i < CLI_URING_BUFFERS; i++) { cli_buf_unref(u->bufs[i]); }
+		free(u);
+		return -1;
+	}
+
+	for (i = 0; i < CLI_URING_BUFFERS; i++) {
+		cli_uring_recycle(u, i);
+	}
+
+	r->uring = u;
+	r->engine = CLI_ENGINE_URING;
+
+	cli_uring_arm_wake(r);
+	io_uring_submit(&u->ring);
+
+	return 0;
+}
+
+void cli_uring_exit(cli_reactor *r)
+{
+	struct cli_uring *u = (struct cli_uring *)r->uring;
+	int i;
+
+	if (u != NULL) {
+		io_uring_free_buf_ring(&u->ring, u->br, CLI_URING_BUFFERS, 0);
+		io_uring_queue_exit(&u->ring);
+		for (i = 0; i < CLI_URING_BUFFERS; i++) { cli_buf_unref(u->bufs[i]); }
+		free(u);
+	}
+
+	r->uring = NULL;
+	r->engine = CLI_ENGINE_EPOLL;
+}
+
+/**
+ * Brings the set of armed multishot receives in line with the interfaces
+ * currently sharded onto this reactor.  Interfaces that are not sockets
+ * (serial lines) cannot take receives and get a one-shot poll instead.
+ * Registration happens on other threads, which only flag the interface and
+ * wake us, since the submission queue belongs to this thread alone.
+ */
+static void cli_uring_sync(cli_reactor *r)
+{
+	struct cli_uring *u = (struct cli_uring *)r->uring;
+	struct io_uring_sqe *sqe;
+	cli_ctx *ctx = r->ctx;
+	cli_if *iface;
+	int i, fd;
+
+	pthread_rwlock_rdlock(&ctx->iflock);
+	for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
+		iface = ctx->ifs[i];
+		fd = -1;
+
+		if ((iface != NULL) && (iface->header == 'i') &&
+			(iface->rxreg) && (iface->shard == r->id) &&
+			(iface->type & CLI_FD_TYPES)) {
+			fd = iface->rxdev.fd;
+		}
+
+		if ((u->armed[i] != -1) && (u->armed[i] != fd)) {
+			sqe = cli_uring_sqe(u);
+			io_uring_prep_cancel64(sqe,
+				CLI_URING_TAG(CLI_URING_RECV, i | (u->gen[i] << 8)), 0);
+			io_uring_sqe_set_data64(sqe, CLI_URING_TAG(CLI_URING_CANCEL, i));
+			u->armed[i] = -1;
+		}
+
+		if ((fd != -1) && (u->armed[i] == -1)) {
+			u->gen[i] = (u->gen[i] + 1) & 0xffffff;
+
+			// datagrams go through recvmsg to pick up their source address
+			sqe = cli_uring_sqe(u);
+			u->udp[i] = (iface->type == CLI_TYPE_UDP);
+			u->poll[i] = !(iface->type & CLI_IP_TYPES);
+			if (u->poll[i]) {
+				io_uring_prep_poll_add(sqe, fd, POLLIN);
+			} else if (u->udp[i]) {
+				io_uring_prep_recvmsg_multishot(sqe, fd, &u->msg, 0);
+			} else {
+				io_uring_prep_recv_multishot(sqe, fd, NULL, 0, 0);
+			}
+			if (!u->poll[i]) {
+				sqe->flags |= IOSQE_BUFFER_SELECT;
+				sqe->buf_group = 0;
+			}
+			io_uring_sqe_set_data64(sqe,
+				CLI_URING_TAG(CLI_URING_RECV, i | (u->gen[i] << 8)));
+			u->armed[i] = fd;
+		}
+	}
+	pthread_rwlock_unlock(&ctx->iflock);
+}
+
+/**
+ * Hands one received record held in provided buffer bid to the capture
+ * writer along with the buffer itself; the kernel gets a fresh one from the
+ * pool in its place.  If the overload policy cannot find a replacement the
+ * record is dropped and the kernel keeps the old buffer.
+ */
+static void cli_uring_rx(cli_reactor *r, unsigned int id, int fd,
+	unsigned int bid, char *buffer, unsigned int len, struct sockaddr_in *peer,
+	unsigned int flags)
+{
+	struct cli_uring *u = (struct cli_uring *)r->uring;
+	cli_ctx *ctx = r->ctx;
+	cli_if *iface;
+	cli_rec rec;
+	cli_buf *buf;
+
+	pthread_rwlock_rdlock(&ctx->iflock);
+	iface = ctx->ifs[id];
+
+	// the interface may have gone away while the record was in flight
+	if ((iface != NULL) && (iface->header == 'i') &&
+		(iface->rxreg) && (iface->rxdev.fd == fd)) {
+		memset(&rec, 0, sizeof(cli_rec));
+		rec.data = buffer;
+		rec.len = len;
+		if (peer != NULL) {
+			rec.peer = *peer;
+			rec.flags |= CLI_REC_PEER;
+		}
+		if (flags & MSG_TRUNC) { rec.flags |= CLI_REC_TRUNC; }
+
+		if ((buf = cli_reactor_buf(r, iface)) != NULL) {
+			rec.buf = u->bufs[bid];
+			u->bufs[bid] = buf;
+			cli_rx_push(ctx, iface, &rec, 1);
+		} else {
+			cli_rx_drop(iface, &rec);
+		}
+	}
+	pthread_rwlock_unlock(&ctx->iflock);
+
+	cli_uring_recycle(u, bid);
+}
+
+/**
+ * Reads what the polled interface id has for us once it is readable, as the
+ * epoll engine does, into a pool buffer of its own.  Read errors and hangups
+ * deactivate it.
+ */
+static void cli_uring_read(cli_reactor *r, unsigned int id, int fd, int mask)
+{
+	cli_ctx *ctx = r->ctx;
+	cli_if *iface;
+	cli_rec rec;
+	int ret;
+
+	pthread_rwlock_rdlock(&ctx->iflock);
+	iface = ctx->ifs[id];
+
+	if ((iface != NULL) && (iface->header == 'i') &&
+		(iface->rxreg) && (iface->rxdev.fd == fd)) {
+		memset(&rec, 0, sizeof(cli_rec));
+		rec.buf = cli_reactor_buf(r, iface);
+		rec.data = (rec.buf != NULL ? rec.buf->data : r->discard);
+		ret = read(fd, rec.data, iface->buffer_size);
+
+		if ((ret > 0) && (rec.buf != NULL)) {
+			rec.len = ret;
+			cli_rx_push(ctx, iface, &rec, 1);
+		} else if (ret > 0) {
+			rec.len = ret;
+			cli_rx_drop(iface, &rec);
+		} else {
+			cli_buf_unref(rec.buf);
+		}
+
+		if (((ret == -1) && (errno != EAGAIN) && (errno != EINTR)) ||
+			((ret <= 0) && (mask & (POLLHUP | POLLERR)))) {
+			iface->active = 0;
+			cli_reactor_remove(ctx, iface);
+		}
+	}
+	pthread_rwlock_unlock(&ctx->iflock);
+}
+
+/**
+ * Handles the final completion of a multishot receive, or of a poll.  Stream
+ * sockets that hit eof or an error are deactivated, everything else
+ * (typically ENOBUFS when all provided buffers are busy, or a poll that fired)
+ * is simply re-armed.
+ */
+static void cli_uring_recv_done(cli_reactor *r, unsigned int id, int res)
+{
+	struct cli_uring *u = (struct cli_uring *)r->uring;
+	cli_ctx *ctx = r->ctx;
+	cli_if *iface;
+
+	u->armed[id] = -1;
+
+	if ((res == -ENOBUFS) || (res == -ECANCELED)) { return; }
+
+	pthread_rwlock_rdlock(&ctx->iflock);
+	iface = ctx->ifs[id];
+	if ((iface != NULL) && (iface->rxreg) &&
+		((res < 0) || (iface->type == CLI_TYPE_TCP))) {
+		iface->active = 0;
+		cli_reactor_remove(ctx, iface);
+	}
+	pthread_rwlock_unlock(&ctx->iflock);
+}
+
+/**
+ * rx thread body for reactors running the io_uring engine.
+ */
+void *cli_uring_interrupt(void *pvr)
+{
+	cli_reactor *r = (cli_reactor *)pvr;
+	struct cli_uring *u = (struct cli_uring *)r->uring;
+	cli_ctx *ctx = r->ctx;
+	struct io_uring_cqe *cqe;
+	struct io_uring_recvmsg_out *o;
+	unsigned int head, count, tag, val, id, bid;
+	char *buffer;
+	uint64_t data;
+
+	cli_uring_sync(r);
+
+	while (ctx->state == CLI_NORMAL) {
+		io_uring_submit_and_wait(&u->ring, 1);
+
+		count = 0;
+		io_uring_for_each_cqe(&u->ring, head, cqe) {
+			data = io_uring_cqe_get_data64(cqe);
+			tag = data >> 32;
+			val = data & 0xffffffff;
+			count++;
+
+			switch (tag) {
+			case CLI_URING_RECV:
+				id = val & 0xff;
+
+				if ((u->poll[id]) && ((val >> 8) == u->gen[id]) &&
+					(cqe->res > 0)) {
+					cli_uring_read(r, id, u->armed[id], cqe->res);
+				}
+
+				if (cqe->flags & IORING_CQE_F_BUFFER) {
+					bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+					buffer = u->bufs[bid]->data;
+					o = NULL;
+
+					if (u->udp[id]) {
+						o = io_uring_recvmsg_validate(buffer, cqe->res, &u->msg);
+					}
+
+					if ((val >> 8) != u->gen[id]) {
+						cli_uring_recycle(u, bid);
+					} else if (o != NULL) {
+						cli_uring_rx(r, id, u->armed[id], bid,
+							io_uring_recvmsg_payload(o, &u->msg),
+							io_uring_recvmsg_payload_length(o, cqe->res, &u->msg),
+							(struct sockaddr_in *)io_uring_recvmsg_name(o), o->flags);
+					} else if ((!u->udp[id]) && (cqe->res > 0)) {
+						cli_uring_rx(r, id, u->armed[id], bid,
+							buffer, cqe->res, NULL, 0);
+					} else {
+						cli_uring_recycle(u, bid);
+					}
+				}
+
+				if ((!(cqe->flags & IORING_CQE_F_MORE)) &&
+					((val >> 8) == u->gen[id])) {
+					cli_uring_recv_done(r, id, cqe->res);
+					cli_uring_sync(r);
+				}
+				break;
+			case CLI_URING_WAKE:
+				cli_reactor_drain(r);
+				if (!(cqe->flags & IORING_CQE_F_MORE)) { cli_uring_arm_wake(r); }
+				cli_uring_sync(r);
+				break;
+			default:
+				break;
+			}
+		}
+		io_uring_cq_advance(&u->ring, count);
+	}
+
+	pthread_exit(NULL);
+}
+#endif
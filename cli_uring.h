@@ -0,0 +1,14 @@
+#pragma once
+
+#include "config.h"
+#include "clibase.h"
+
+#ifdef HAVE_LIBURING
+// provided buffers per reactor; each one holds a single record
+#define CLI_URING_BUFFERS	64
+#define CLI_URING_ENTRIES	256
+
+int cli_uring_init(cli_reactor *r);
+void cli_uring_exit(cli_reactor *r);
+void *cli_uring_interrupt(void *pvr);
+#endif
@@ -0,0 +1,299 @@
+/*
+ * cli_view.c - hex dump pager over captured records
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curses.h>
+#include <pthread.h>
+
+#include "clibase.h"
+#include "cli_store.h"
+#include "cli_seg.h"
+#include "cli_fmt.h"
+#include "cli_view.h"
+
+// bytes per row, and where the text column starts with d digits of offset:
+// the offset, then the bytes in hex in two groups of eight
+#define CLI_VIEW_COLS		16
+#define CLI_VIEW_TEXT(d)	((d) + 2 + (3 * CLI_VIEW_COLS) + 1)
+// a row with the widest offset there can be
+#define CLI_VIEW_ROW		(CLI_VIEW_TEXT(16) + CLI_VIEW_COLS + 2)
+
+/**
+ * Hex digits the offsets of a view of size bytes take, eight at least.
+ */
+static int cli_view_digits(unsigned long size)
+{
+	int d = 8;
+
+	while ((d < 16) && (size > 0) && ((size - 1) >> (4 * d))) { d++; }
+
+	return d;
+}
+
+/**
+ * Where the records of the view that seg holds end: one past the last.
+ */
+static unsigned int cli_view_end(cli_view *v, cli_seg *seg)
+{
+	unsigned int end = seg->first + seg->count;
+
+	return (end > v->to ? v->to : end);
+}
+
+/**
+ * Sets v up over the records from to to - 1 of iface, with rows rows on
+ * screen.  Their size is summed up a segment at a time.
+ */
+void cli_view_open(cli_view *v, cli_if *iface, unsigned int from,
+	unsigned int to, int rows)
+{
+	cli_seg *seg = NULL;
+	unsigned int rec, end;
+
+	memset(v, 0, sizeof(cli_view));
+	v->iface = iface;
+	v->from = from;
+	v->to = to;
+	v->rows = rows;
+
+	for (rec = from; rec < to; rec = end) {
+		if ((seg = cli_seg_walk(iface, seg, rec)) == NULL) {
+			end = rec + 1;
+			continue;
+		}
+		end = cli_view_end(v, seg);
+		v->size += cli_seg_data(seg, end) - cli_seg_data(seg, rec);
+	}
+	cli_seg_put(seg);
+}
+
+/**
+ * Finds the record holding byte off of the view and how far into it that
+ * byte is, leaving seg on the segment it is in.  Returns -1 past the end.
+ */
+static int cli_view_locate(cli_view *v, cli_seg **seg, unsigned long off,
+	unsigned int *rec, unsigned long *skip)
+{
+	unsigned int r = v->from, end, lo, hi, mid;
+	unsigned long base, span;
+
+	while (r < v->to) {
+		if ((*seg = cli_seg_walk(v->iface, *seg, r)) == NULL) {
+			r++;
+			continue;
+		}
+
+		end = cli_view_end(v, *seg);
+		base = cli_seg_data(*seg, r);
+		span = cli_seg_data(*seg, end) - base;
+		if (off >= span) {
+			off -= span;
+			r = end;
+			continue;
+		}
+
+		// the last record that starts at or before off
+		lo = r;
+		hi = end - 1;
+		while (lo < hi) {
+			mid = lo + ((hi - lo + 1) / 2);
+			if (cli_seg_data(*seg, mid) - base <= off) {
+				lo = mid;
+			} else {
+				hi = mid - 1;
+			}
+		}
+
+		*rec = lo;
+		*skip = off - (cli_seg_data(*seg, lo) - base);
+		return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * Reads up to len bytes of the view from off on into data, and the number of
+ * the record off is in into rec.  Returns how many bytes there were.
+ */
+unsigned long cli_view_read(cli_view *v, unsigned long off, unsigned char *data,
+	unsigned long len, unsigned int *rec)
+{
+	cli_seg *seg = NULL;
+	cli_rechdr rh;
+	unsigned int r;
+	unsigned long skip, got = 0;
+	int n;
+
+	*rec = v->from;
+	if (cli_view_locate(v, &seg, off, &r, &skip) == 0) {
+		for (*rec = r; (got < len) && (r < v->to); r++, skip = 0) {
+			if ((seg = cli_seg_walk(v->iface, seg, r)) == NULL) { continue; }
+			if ((n = cli_seg_part(seg, r, skip, (char *)data + got, len - got,
+				&rh)) > 0) {
+				got += n;
+			}
+		}
+	}
+	cli_seg_put(seg);
+
+	return got;
+}
+
+/**
+ * Draws the rows of the view from v->top on, and the status line below them.
+ * page holds the bytes of one screen.
+ */
+static void cli_view_draw(cli_view *v, WINDOW *win, unsigned char *page)
+{
+	char row[CLI_VIEW_ROW], status[CLI_DEFAULT_BUFFER];
+	unsigned long got, off;
+	unsigned int rec;
+	int y, n, k, w = getmaxx(win), d = cli_view_digits(v->size);
+
+	got = cli_view_read(v, v->top, page, v->rows * CLI_VIEW_COLS, &rec);
+
+	werase(win);
+	for (y = 0, off = 0; (y < v->rows) && (off < got); y++, off += CLI_VIEW_COLS) {
+		n = (got - off > CLI_VIEW_COLS ? CLI_VIEW_COLS : got - off);
+
+		k = snprintf(row, CLI_VIEW_ROW, "%0*lx  ", d, v->top + off);
+		k += cli_fmt_line(CLI_MODE_HEX, page + off, (n > 8 ? 8 : n), row + k);
+		row[k++] = ' ';
+		if (n > 8) {
+			k += cli_fmt_line(CLI_MODE_HEX, page + off + 8, n - 8, row + k);
+		}
+
+		// a short last row keeps the text in its column
+		memset(row + k, ' ', CLI_VIEW_TEXT(d) - k);
+		k = CLI_VIEW_TEXT(d);
+		row[k++] = '|';
+		cli_fmt_ascii(page + off, n, row + k);
+		k += n;
+		row[k++] = '|';
+
+		mvwaddnstr(win, y, 0, row, (k > w ? w : k));
+	}
+
+	k = snprintf(status, CLI_DEFAULT_BUFFER,
+		" if%02x %u..%u  record %u  %0*lx / %0*lx  q quit  space b page"
+		"  g G ends  o offset ", v->iface->id, v->from, v->to - 1, rec,
+		d, v->top, d, v->size);
+	if (k >= CLI_DEFAULT_BUFFER) { k = CLI_DEFAULT_BUFFER - 1; }
+	wattron(win, A_REVERSE);
+	mvwaddnstr(win, v->rows, 0, status, (k > w ? w : k));
+	wattroff(win, A_REVERSE);
+	wclrtoeol(win);
+
+	wrefresh(win);
+}
+
+/**
+ * Pages through the records from to to - 1 of iface as a hex dump until q is
+ * pressed.  Memory and work are bounded by the screen, whatever the size of
+ * the records.  Records that arrive meanwhile are not drawn.
+ */
+void cli_view_run(cli_ctx *ctx, cli_if *iface, unsigned int from,
+	unsigned int to)
+{
+	WINDOW *win;
+	cli_view v;
+	unsigned char *page, *tmp;
+	char input[CLI_DEFAULT_BUFFER], *end;
+	unsigned long last, off;
+	int c, done = 0;
+
+	if ((win = newwin(0, 0, 0, 0)) == NULL) { return; }
+	keypad(win, TRUE);
+
+	cli_view_open(&v, iface, from, to, (LINES > 1 ? LINES - 1 : 1));
+	if ((page = (unsigned char *)malloc(v.rows * CLI_VIEW_COLS)) == NULL) {
+		delwin(win);
+		return;
+	}
+
+	pthread_mutex_lock(&ctx->ui.mutex);
+	ctx->ui.paging = 1;
+	pthread_mutex_unlock(&ctx->ui.mutex);
+
+	while (!done) {
+		// the top of the last screen
+		last = (v.size + CLI_VIEW_COLS - 1) / CLI_VIEW_COLS;
+		last = (last > v.rows ? (last - v.rows) * CLI_VIEW_COLS : 0);
+		if (v.top > last) { v.top = last; }
+
+		cli_view_draw(&v, win, page);
+
+		switch ((c = wgetch(win))) {
+		case 'q':
+		case 27:
+			done = 1;
+			break;
+		case ' ':
+		case 'f':
+		case KEY_NPAGE:
+			v.top += v.rows * CLI_VIEW_COLS;
+			break;
+		case 'b':
+		case KEY_PPAGE:
+			off = v.rows * CLI_VIEW_COLS;
+			v.top = (v.top > off ? v.top - off : 0);
+			break;
+		case 'j':
+		case '\n':
+		case KEY_DOWN:
+			v.top += CLI_VIEW_COLS;
+			break;
+		case 'k':
+		case KEY_UP:
+			v.top = (v.top > CLI_VIEW_COLS ? v.top - CLI_VIEW_COLS : 0);
+			break;
+		case 'g':
+		case KEY_HOME:
+			v.top = 0;
+			break;
+		case 'G':
+		case KEY_END:
+			v.top = last;
+			break;
+		case 'o':
+			// the row holding a (hex) offset
+			mvwprintw(win, v.rows, 0, "offset: ");
+			wclrtoeol(win);
+			echo();
+			memset(input, 0, CLI_DEFAULT_BUFFER);
+			wgetnstr(win, input, CLI_DEFAULT_BUFFER - 1);
+			noecho();
+			off = strtoul(input, &end, 16);
+			if (end != input) { v.top = off - (off % CLI_VIEW_COLS); }
+			break;
+		case KEY_RESIZE:
+			wresize(win, LINES, COLS);
+			c = (LINES > 1 ? LINES - 1 : 1);
+			if ((tmp = (unsigned char *)realloc(page, c * CLI_VIEW_COLS)) != NULL) {
+				page = tmp;
+				v.rows = c;
+			}
+			break;
+		default: break;
+		}
+	}
+
+	free(page);
+	delwin(win);
+
+	pthread_mutex_lock(&ctx->ui.mutex);
+	ctx->ui.paging = 0;
+	pthread_mutex_unlock(&ctx->ui.mutex);
+
+	touchwin(stdscr);
+	refresh();
+}
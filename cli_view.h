@@ -0,0 +1,10 @@
+#pragma once
+
+#include "clibase.h"
+
+void cli_view_open(cli_view *v, cli_if *iface, unsigned int from,
+	unsigned int to, int rows);
+unsigned long cli_view_read(cli_view *v, unsigned long off, unsigned char *data,
+	unsigned long len, unsigned int *rec);
+void cli_view_run(cli_ctx *ctx, cli_if *iface, unsigned int from,
+	unsigned int to);
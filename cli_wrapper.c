@@ -17,6 +17,10 @@
 
 #include "cli.h"
 #include "clibase.h"
+#include "cli_pool.h"
+#include "cli_store.h"
+#include "cli_seg.h"
+#include "cli_cap.h"
 #include "config.h"
 
 #include <curses.h>
@@ -26,17 +30,29 @@
 #include <archive_entry.h>
 
 
+/**
+ * Adds one session file to the archive.  Capture files that are open are
+ * read through their store (st), which covers exactly the published data and
+ * does not disturb the capture writer.
+ */
 void cli_archive_entry(
 	cli_ctx *ctx,
 	const char *tmp,
 	unsigned int corefile,
+	cli_store *st,
 	struct archive *a,
 	struct archive_entry *e)
 {
 	struct stat s;
 	int fd, len;
-	static char path[CLI_DEFAULT_BUFFER];
-	static char buffer[CLI_MAX_BUFFER];
+	unsigned long off = 0;
+	char path[CLI_DEFAULT_BUFFER];
+	cli_buf *buf;
+
+	if ((buf = cli_buf_alloc(&ctx->pool)) == NULL) {
+		printw("Error: no buffer left to archive `%s'.\n", tmp);
+		return;
+	}
 
 	memset(path, 0, CLI_DEFAULT_BUFFER);
 	if (corefile) {
@@ -53,15 +69,30 @@ void cli_archive_entry(
 	archive_entry_copy_stat(e, &s);
 	archive_entry_set_perm(e, 0644);
 
-	archive_write_header(a, e);
+	if (st != NULL) {
+		s.st_size = cli_store_size(st);
+		archive_entry_set_size(e, s.st_size);
+		archive_write_header(a, e);
 
-	fd = open(path, O_RDONLY);
-	len = read(fd, buffer, CLI_MAX_BUFFER);
-	while (len > 0) {
-		archive_write_data(a, buffer, len);
-		len = read(fd, buffer, CLI_MAX_BUFFER);
+		while (off < s.st_size) {
+			len = cli_store_read(st, off, buf->data,
+				(s.st_size - off < CLI_MAX_BUFFER ? s.st_size - off : CLI_MAX_BUFFER));
+			archive_write_data(a, buf->data, len);
+			off += len;
+		}
+	} else {
+		archive_write_header(a, e);
+
+		fd = open(path, O_RDONLY);
+		len = read(fd, buf->data, CLI_MAX_BUFFER);
+		while (len > 0) {
+			archive_write_data(a, buf->data, len);
+			len = read(fd, buf->data, CLI_MAX_BUFFER);
+		}
+		close(fd);
 	}
-	close(fd);
+
+	cli_buf_unref(buf);
 }
 
 void cli_archive_write(cli_ctx *ctx, const char *savefile)
@@ -69,6 +100,8 @@ void cli_archive_write(cli_ctx *ctx, const char *savefile)
 	struct archive *a;
 	struct archive_entry *e;
 	char tmp[CLI_DEFAULT_BUFFER];
+	cli_seg **segs;
+	unsigned int j, n;
 	int i;
 
 	a = archive_write_new();
@@ -80,19 +113,46 @@ void cli_archive_write(cli_ctx *ctx, const char *savefile)
 	
 	memset(tmp, 0, CLI_DEFAULT_BUFFER);
 	sprintf(tmp, "ctx");
-	cli_archive_entry(ctx, tmp, 1, a, e);
+	cli_archive_entry(ctx, tmp, 1, NULL, a, e);
 
 	for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
-		if (ctx->ifs[i] != NULL) {
-			// if#-offset
+		if ((ctx->ifs[i] != NULL) && (ctx->ifs[i]->header == 'i')) {
+			// if#-header
 			memset(tmp, 0, CLI_DEFAULT_BUFFER);
-			sprintf(tmp, "if%02x-offset", ctx->ifs[i]->id);
-			cli_archive_entry(ctx, tmp, 0, a, e);
+			sprintf(tmp, "if%02x-header", ctx->ifs[i]->id);
+			cli_archive_entry(ctx, tmp, 0, ctx->ifs[i]->offset, a, e);
 
-			// if#-buffer
-			memset(tmp, 0, CLI_DEFAULT_BUFFER);
-			sprintf(tmp, "if%02x-buffer", ctx->ifs[i]->id);
-			cli_archive_entry(ctx, tmp, 0, a, e);
+			// if#-{offset,buffer,peer,time}.seq for every retained segment
+			// (zdata and block instead of buffer once it is compressed, and
+			// bloom where there is a search index), and
+			// if#-{offset,buffer} of a version 1 session
+			segs = cli_seg_snapshot(ctx->ifs[i], &n);
+			for (j = 0; j < n; j++) {
+				cli_seg_name(segs[j], "offset", tmp);
+				cli_archive_entry(ctx, tmp, 0, segs[j]->offset, a, e);
+				if (segs[j]->packed) {
+					cli_seg_name(segs[j], "zdata", tmp);
+					cli_archive_entry(ctx, tmp, 0, segs[j]->zdata, a, e);
+					cli_seg_name(segs[j], "block", tmp);
+					cli_archive_entry(ctx, tmp, 0, segs[j]->block, a, e);
+				} else {
+					cli_seg_name(segs[j], "buffer", tmp);
+					cli_archive_entry(ctx, tmp, 0, segs[j]->buffer, a, e);
+				}
+				if (segs[j]->peer != NULL) {
+					cli_seg_name(segs[j], "peer", tmp);
+					cli_archive_entry(ctx, tmp, 0, segs[j]->peer, a, e);
+				}
+				if (segs[j]->time != NULL) {
+					cli_seg_name(segs[j], "time", tmp);
+					cli_archive_entry(ctx, tmp, 0, segs[j]->time, a, e);
+				}
+				if (segs[j]->bloom != NULL) {
+					cli_seg_name(segs[j], "bloom", tmp);
+					cli_archive_entry(ctx, tmp, 0, segs[j]->bloom, a, e);
+				}
+			}
+			cli_seg_release(segs, n);
 		}
 	}
 	
@@ -119,13 +179,51 @@ int cli_archive_copydata(cli_ctx *ctx, struct archive *ar, struct archive *aw)
 	return (r == ARCHIVE_EOF ? ARCHIVE_OK : r);
 }
 
+/**
+ * Adds the interfaces a loaded archive brought along to the session manifest.
+ * Their segments are whatever the archive held, so the manifest leaves those
+ * for reloading to find.
+ */
+void cli_archive_manifest(cli_ctx *ctx, unsigned char *loaded)
+{
+	cli_manifestent ents[CLI_DEFAULT_BUFFER];
+	char tmp[CLI_DEFAULT_BUFFER];
+	int i, j, n;
+
+	sprintf(tmp, "%s/%08x", ctx->pwd, ctx->pid);
+
+	pthread_mutex_lock(&ctx->mflock);
+	if ((n = cli_cap_read_manifest(tmp, ents)) == -1) {
+		pthread_mutex_unlock(&ctx->mflock);
+		return;
+	}
+
+	for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
+		if (!loaded[i]) { continue; }
+
+		for (j = 0; (j < n) && (ents[j].id != i); j++);
+		if (j == CLI_DEFAULT_BUFFER) { break; }
+		if (j == n) { n++; }
+
+		memset(&ents[j], 0, sizeof(cli_manifestent));
+		ents[j].id = i;
+	}
+
+	cli_cap_write_manifest(tmp, ents, n);
+	pthread_mutex_unlock(&ctx->mflock);
+}
+
 void cli_archive_read(cli_ctx *ctx, const char *loadfile)
 {
 	struct archive *a, *ext;
 	struct archive_entry *e, *ctxe;
 	int flags;
-	int r;
+	int r, x;
 	char tmp[CLI_DEFAULT_BUFFER];
+	char kind[CLI_DEFAULT_BUFFER];
+	unsigned char loaded[CLI_DEFAULT_BUFFER];
+
+	memset(loaded, 0, CLI_DEFAULT_BUFFER);
 
 	flags = ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_PERM |
 		ARCHIVE_EXTRACT_ACL | ARCHIVE_EXTRACT_FFLAGS;
@@ -149,6 +247,12 @@ void cli_archive_read(cli_ctx *ctx, const char *loadfile)
 			} else {
 				printw("updating interface file %s... ", archive_entry_pathname(e));
 				refresh();
+
+				if ((sscanf(archive_entry_pathname(e), "if%02x-%s", &x, kind) == 2) &&
+					(x >= 0) && (x < CLI_DEFAULT_BUFFER) &&
+					((strcmp(kind, "header") == 0) || (strcmp(kind, "offset") == 0))) {
+					loaded[x] = 1;
+				}
 				
 				memset(tmp, 0, CLI_DEFAULT_BUFFER);
 				sprintf(tmp, "%s/%08x/%s",
@@ -171,6 +275,7 @@ void cli_archive_read(cli_ctx *ctx, const char *loadfile)
 	archive_read_finish(a);
 
 	if (r == ARCHIVE_EOF) {
+		cli_archive_manifest(ctx, loaded);
 		cli_ctx_reload(ctx, archive_entry_pathname(ctxe));
 	} else {
 		printw("Error: %s\n", archive_error_string(a));
@@ -8,9 +8,10 @@
 #include <archive_entry.h>
 
 void cli_archive_write(cli_ctx *ctx, const char *savefile);
+void cli_archive_manifest(cli_ctx *ctx, unsigned char *loaded);
 void cli_archive_read(cli_ctx *ctx, const char *loadfile);
 void cli_archive_entry(
-	cli_ctx *ctx, const char *tmp, unsigned int corefile,
+	cli_ctx *ctx, const char *tmp, unsigned int corefile, cli_store *st,
 	struct archive *a, struct archive_entry *e);
 #endif
 
@@ -0,0 +1,279 @@
+/*
+ * cli_writer.c - capture writer draining the per-interface rx rings
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/eventfd.h>
+
+#include "config.h"
+
+#include "clibase.h"
+#include "cli.h"
+#include "cli_ring.h"
+#include "cli_pool.h"
+#include "cli_flush.h"
+#include "cli_cap.h"
+#include "cli_inflate.h"
+#include "cli_writer.h"
+
+/**
+ * Wakes the capture writer if it is (about to be) asleep.  Costs a syscall
+ * only when the writer has run out of work.
+ */
+void cli_writer_kick(cli_ctx *ctx)
+{
+	uint64_t one = 1;
+
+	// pairs with the fence in cli_writer_interrupt: either we see the writer
+	// sleeping or it sees our records
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ctx->writer.sleeping, __ATOMIC_RELAXED)) {
+		write(ctx->writer.evfd, &one, sizeof(uint64_t));
+	}
+}
+
+/**
+ * Returns the writer's progress count.  Read it before trying the ring or
+ * pool and hand it to cli_writer_wait if that fails.
+ */
+unsigned long cli_writer_gen(cli_ctx *ctx)
+{
+	return __atomic_load_n(&ctx->writer.passes, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Blocks until the writer has released records since gen was read, freeing
+ * ring slots and pool buffers.  The writer outlives the rx threads, so a full
+ * ring or an exhausted pool always gets drained eventually.
+ */
+void cli_writer_wait(cli_ctx *ctx, unsigned long gen)
+{
+	cli_writer *w = &ctx->writer;
+
+	if (w->evfd == -1) { return; }
+
+	pthread_mutex_lock(&w->lock);
+	__atomic_add_fetch(&w->waiters, 1, __ATOMIC_SEQ_CST);
+	cli_writer_kick(ctx);
+
+	while (__atomic_load_n(&w->passes, __ATOMIC_SEQ_CST) == gen) {
+		pthread_cond_wait(&w->progress, &w->lock);
+	}
+
+	__atomic_sub_fetch(&w->waiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * Publishes writer progress and wakes blocked producers, if there are any.
+ */
+static void cli_writer_progress(cli_writer *w)
+{
+	// pairs with cli_writer_wait: either the waiter sees the new count or
+	// we see the waiter
+	__atomic_add_fetch(&w->passes, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&w->waiters, __ATOMIC_SEQ_CST) == 0) { return; }
+
+	pthread_mutex_lock(&w->lock);
+	pthread_cond_broadcast(&w->progress);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * Accounts for a record lost to the overload policy and releases its buffer.
+ */
+void cli_rx_drop(cli_if *iface, cli_rec *rec)
+{
+	__atomic_add_fetch(&iface->rx_dropped, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&iface->rx_dropped_bytes, rec->len, __ATOMIC_RELAXED);
+
+	cli_buf_unref(rec->buf);
+}
+
+/**
+ * rx hot path: queues n records, along with their buffer references, for the
+ * capture writer.  Never touches the capture files or the screen.  When the
+ * ring is full, iface->overload decides whether the rx thread waits for the
+ * writer to make room, drops the new record or sheds the oldest queued one.
+ * Must only be called by the rx thread owning iface.
+ */
+void cli_rx_push(cli_ctx *ctx, cli_if *iface, cli_rec *recs, unsigned int n)
+{
+	unsigned int i;
+	unsigned long now = cli_cap_now();
+	unsigned long gen;
+	cli_rec old;
+
+	// records are timed as they arrive, not as they are written
+	for (i = 0; i < n; i++) {
+		if (recs[i].ts == 0) { recs[i].ts = now; }
+	}
+
+	// no writer thread to hand off to, commit in place
+	if ((ctx->writer.evfd == -1) || (iface->rxq == NULL)) {
+		cli_inflate_batch(ctx, iface, recs, n);
+		for (i = 0; i < n; i++) { cli_buf_unref(recs[i].buf); }
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		gen = cli_writer_gen(ctx);
+		while (cli_ring_push(iface->rxq, &recs[i]) == -1) {
+			if (iface->overload == CLI_OVERLOAD_DROP_NEWEST) {
+				cli_rx_drop(iface, &recs[i]);
+				break;
+			}
+
+			if ((iface->overload == CLI_OVERLOAD_DROP_OLDEST) &&
+				(cli_ring_take(iface->rxq, &old, 1) == 1)) {
+				cli_rx_drop(iface, &old);
+				continue;
+			}
+
+			cli_writer_wait(ctx, gen);
+			gen = cli_writer_gen(ctx);
+		}
+	}
+
+	cli_writer_kick(ctx);
+}
+
+/**
+ * Commits everything currently queued on iface, CLI_RX_BATCH records at a
+ * time.  Returns the number of records written.
+ */
+static unsigned int cli_writer_drain(cli_ctx *ctx, cli_if *iface)
+{
+	cli_rec recs[CLI_RX_BATCH];
+	unsigned int i, n, total = 0;
+
+	while ((n = cli_ring_take(iface->rxq, recs, CLI_RX_BATCH)) > 0) {
+		cli_inflate_batch(ctx, iface, recs, n);
+
+		for (i = 0; i < n; i++) { cli_buf_unref(recs[i].buf); }
+
+		cli_flusher_note(ctx, iface);
+
+		total += n;
+	}
+
+	if (total > 0) { cli_writer_progress(&ctx->writer); }
+
+	return total;
+}
+
+static unsigned int cli_writer_pass(cli_ctx *ctx)
+{
+	unsigned int i, work = 0;
+	cli_if *iface;
+
+	pthread_rwlock_rdlock(&ctx->iflock);
+	for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
+		iface = ctx->ifs[i];
+		if ((iface != NULL) && (iface->header == 'i') && (iface->rxq != NULL)) {
+			work += cli_writer_drain(ctx, iface);
+		}
+	}
+	pthread_rwlock_unlock(&ctx->iflock);
+
+	return work;
+}
+
+static int cli_writer_pending(cli_ctx *ctx)
+{
+	unsigned int i;
+	int ret = 0;
+	cli_if *iface;
+
+	pthread_rwlock_rdlock(&ctx->iflock);
+	for (i = 0; (i < CLI_DEFAULT_BUFFER) && (!ret); i++) {
+		iface = ctx->ifs[i];
+		if ((iface != NULL) && (iface->header == 'i') && (iface->rxq != NULL)) {
+			ret = (cli_ring_avail(iface->rxq) > 0);
+		}
+	}
+	pthread_rwlock_unlock(&ctx->iflock);
+
+	return ret;
+}
+
+/**
+ * Persistence stage: drains the rx rings to the capture files and performs
+ * display and exchange forwarding, so rx threads never wait on the disk or
+ * on curses.  Keeps going after a stop request until the rings are empty.
+ */
+void *cli_writer_interrupt(void *pvctx)
+{
+	cli_ctx *ctx = (cli_ctx *)pvctx;
+	cli_writer *w = &ctx->writer;
+	uint64_t n;
+
+	while (1) {
+		if (cli_writer_pass(ctx) > 0) { continue; }
+		if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) { break; }
+
+		__atomic_store_n(&w->sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		if ((!cli_writer_pending(ctx)) &&
+			(!__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE))) {
+			read(w->evfd, &n, sizeof(uint64_t));
+		}
+
+		__atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+	}
+
+	pthread_exit(NULL);
+}
+
+int cli_writer_start(cli_ctx *ctx)
+{
+	cli_writer *w = &ctx->writer;
+
+	w->sleeping = 0;
+	w->stop = 0;
+	w->passes = 0;
+	w->waiters = 0;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->progress, NULL);
+
+	w->evfd = eventfd(0, EFD_CLOEXEC);
+	if (w->evfd == -1) { return -1; }
+
+	if (pthread_create(&w->thread, NULL, cli_writer_interrupt, (void *)ctx) != 0) {
+		close(w->evfd);
+		w->evfd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Flushes whatever is still queued and ends the writer.  The rx threads must
+ * already be stopped.
+ */
+void cli_writer_stop(cli_ctx *ctx)
+{
+	cli_writer *w = &ctx->writer;
+	uint64_t one = 1;
+
+	if (w->evfd == -1) { return; }
+
+	__atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+	write(w->evfd, &one, sizeof(uint64_t));
+
+	pthread_join(w->thread, NULL);
+	close(w->evfd);
+	w->evfd = -1;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "clibase.h"
+
+int cli_writer_start(cli_ctx *ctx);
+void cli_writer_stop(cli_ctx *ctx);
+void cli_writer_kick(cli_ctx *ctx);
+unsigned long cli_writer_gen(cli_ctx *ctx);
+void cli_writer_wait(cli_ctx *ctx, unsigned long gen);
+
+void cli_rx_drop(cli_if *iface, cli_rec *rec);
+void cli_rx_push(cli_ctx *ctx, cli_if *iface, cli_rec *recs, unsigned int n);
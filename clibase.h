@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -17,12 +18,62 @@
 #define CLI_MIN_BUFFER		8
 #define CLI_DEFAULT_BUFFER	256
 
+#define CLI_MAX_REACTORS	16
+
+// most datagrams drained per wakeup on udp interfaces
+#define CLI_RX_BATCH		32
+
+// per-interface rx ring between the rx threads and the capture writer,
+// must be a power of two
+#define CLI_RING_SLOTS		1024
+
+// rx buffer pools grow a slab at a time up to a fixed number of buffers
+#define CLI_POOL_SLAB		32
+#define CLI_POOL_MAX		1024
+
+// capture files are mapped a chunk at a time, and grown on disk a step at a
+// time ahead of the writer
+#define CLI_STORE_CHUNK		(1UL << 24)
+#define CLI_STORE_CHUNKS	4096
+#define CLI_STORE_STEP		(1UL << 20)
+
+// captures roll over to a new segment at this size by default; a segment
+// must fit the chunks its buffer store can map
+#define CLI_SEG_BYTES		(64UL << 20)
+#define CLI_SEG_MAX_BYTES	(32UL << 30)
+
+// sealed segments are compressed in blocks of about this many bytes, cut at
+// record boundaries
+#define CLI_BLOCK_BYTES		(64UL << 10)
+
+// a time index entry is kept for every this many records of a segment
+#define CLI_TIME_STRIDE		64
+
+// a search index filter covers the records of about this many data bytes
+#define CLI_BLOOM_BYTES		(1UL << 20)
+#define CLI_BLOOM_BITS		(1U << 18)
+
+// on-disk capture format; version 1 sessions are only read
+#define CLI_CAP_MAGIC		0x32494c43	// "CLI2"
+#define CLI_CAP_VERSION		2
+#define CLI_CAP_MANIFEST	"manifest"
+
+// direction of a captured record
+#define CLI_DIR_RX		0
+#define CLI_DIR_TX		1
+
+// record flags
+#define CLI_REC_PEER	0x01	// source address kept in the peer file
+#define CLI_REC_TRUNC	0x02	// datagram was cut to the buffer size
+#define CLI_REC_RAW		0x04	// kept as received, zlib could not inflate it
+
 #define CLI_FLAG_ECHO	0x01
 #define CLI_FLAG_ASYNC	0x02
 #define CLI_FLAG_SILENT 0x04
 #define CLI_FLAG_ALF	0x08
 #define CLI_FLAG_ACR	0x10
 #define CLI_FLAG_AS		0x20 
+#define CLI_FLAG_RAW	0x40	// file interfaces write tx as is, not in rxmode
 
 typedef enum {
 	CLI_TYPE_TCP		= 0x01,
@@ -49,23 +100,464 @@ typedef enum {
 	CLI_MODE_Z
 } cli_if_mode;
 
-typedef struct __cli_if
+// when captured records are forced to disk
+typedef enum {
+	CLI_DURABLE_NONE,
+	CLI_DURABLE_PERIODIC,
+	CLI_DURABLE_RECORD
+} cli_durable_mode;
+
+// what an rx thread does when the capture writer falls behind
+typedef enum {
+	CLI_OVERLOAD_BLOCK,
+	CLI_OVERLOAD_DROP_NEWEST,
+	CLI_OVERLOAD_DROP_OLDEST
+} cli_overload;
+
+// search index kept for an interface's capture
+typedef enum {
+	CLI_INDEX_NONE,
+	CLI_INDEX_BLOOM
+} cli_index;
+
+/**
+ * Fixed size, reference counted rx buffer.  Buffers are carved out of slabs
+ * owned by a cli_pool and go back to it when the last reference is dropped.
+ */
+typedef struct __cli_buf
+{
+	struct __cli_pool *pool;
+	struct __cli_buf *next;
+	int ref;
+	char data[CLI_MAX_BUFFER];
+} cli_buf;
+
+typedef struct __cli_slab
+{
+	struct __cli_slab *next;
+	cli_buf bufs[CLI_POOL_SLAB];
+} cli_slab;
+
+typedef struct __cli_pool
+{
+	char name[16];
+	pthread_mutex_t lock;
+
+	cli_buf *free;
+	cli_slab *slabs;
+
+	unsigned int total;
+	unsigned int inuse;
+	unsigned int hwm;
+	unsigned int max;
+
+	unsigned long allocs;
+	unsigned long fails;
+} cli_pool;
+
+/**
+ * A record as handed between rx, capture, display and forwarding.  When buf
+ * is set the record owns one reference to it and data points inside it.
+ */
+typedef struct __cli_rec
+{
+	char *data;
+	unsigned int len;
+	struct sockaddr_in peer;
+	cli_buf *buf;
+
+	// nanoseconds since the epoch, set when the record is queued
+	unsigned long ts;
+	unsigned char dir;
+	unsigned char flags;
+} cli_rec;
+
+/**
+ * Single-producer/single-consumer record queue.  Records move through it by
+ * value, together with the buffer reference they hold.  Producer and
+ * consumer fields live on separate cache lines.  The producer may also take
+ * records off the head to shed the oldest ones.
+ */
+typedef struct __cli_ring
+{
+	unsigned int size;
+	cli_rec *slots;
+
+	// producer side
+	char pad0[64];
+	unsigned long tail;
+	unsigned long head_cache;
+
+	// consumer side
+	char pad1[64];
+	unsigned long head;
+	char pad2[64];
+} cli_ring;
+
+/**
+ * Append-only capture file.  The writer copies records into mmap'd chunks,
+ * growing the file ahead of it, and then publishes the new tail; readers
+ * copy from below the tail without any file position or lock.
+ */
+typedef struct __cli_store
+{
+	int fd;
+	int flags;
+
+	char *chunk[CLI_STORE_CHUNKS];
+	unsigned int nchunks;
+
+	unsigned long tail;
+	unsigned long synced;
+	// length of the file, published or not
+	unsigned long size;
+} cli_store;
+
+/**
+ * Interface header, the whole of if%02x-header.  Only settings are kept;
+ * the rest of the interface is rebuilt when a session is reloaded.  dev holds
+ * the socket address or device name.
+ */
+typedef struct __cli_ifhdr
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;
+
+	uint32_t id;
+	uint32_t type;
+	uint32_t rxmode;
+	uint32_t txmode;
+	uint32_t flags;
+	uint32_t buffer_size;
+	uint32_t rx_batch;
+	uint32_t overload;
+	uint32_t compress;
+
+	uint32_t durable_mode;
+	uint32_t durable_ms;
+	uint32_t durable_records;
+	uint32_t rx_count;
+	uint64_t rx_size;
+
+	uint64_t rotate_bytes;
+	uint64_t rotate_secs;
+	uint64_t retain_bytes;
+	uint64_t retain_secs;
+
+	char dev[CLI_DEFAULT_BUFFER];
+
+	// settings added since, 0 in older headers
+	uint32_t index;
+	uint32_t reserved;
+} cli_ifhdr;
+
+/**
+ * Session manifest, the `manifest' file of a session directory: the
+ * interfaces there are, so that reloading the session needs no directory
+ * scan.  count entries follow.
+ */
+typedef struct __cli_manifest
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;
+
+	uint32_t count;
+	uint32_t reserved;
+} cli_manifest;
+
+/**
+ * Manifest entry: an interface and the sequence numbers of its segments,
+ * first to next - 1, when the manifest was written.  Segments rotated in
+ * since follow on from next; next is 0 when they are not known.
+ */
+typedef struct __cli_manifestent
+{
+	uint32_t id;
+	uint32_t first;
+	uint32_t next;
+	uint32_t reserved;
+} cli_manifestent;
+
+/**
+ * Header at the start of each segment's offset file.  It is followed by one
+ * 64 bit entry per record giving the position of the record in the buffer
+ * file.
+ */
+typedef struct __cli_seghdr
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;
+
+	uint32_t seq;
+	uint32_t first;
+	int64_t created;
+} cli_seghdr;
+
+/**
+ * Header in front of every record in a segment's buffer file.
+ */
+typedef struct __cli_rechdr
+{
+	uint64_t ts;
+	uint32_t len;
+	uint8_t dir;
+	uint8_t flags;
+	uint16_t reserved;
+} cli_rechdr;
+
+/**
+ * Sparse time index entry: the timestamp of record rec.  A segment's time
+ * file holds one for every CLI_TIME_STRIDE records, in record order.
+ */
+typedef struct __cli_timeent
+{
+	uint64_t ts;
+	uint32_t rec;
+	uint32_t reserved;
+} cli_timeent;
+
+/**
+ * Search index entry of a segment: a Bloom filter of the byte trigrams in the
+ * data of nrec records, starting with record rec of the segment.  The
+ * CLI_BLOOM_BITS / 8 bytes of the filter follow.
+ */
+typedef struct __cli_bloomhdr
+{
+	uint32_t rec;
+	uint32_t nrec;
+} cli_bloomhdr;
+
+/**
+ * Block index entry of a compressed segment: rawlen bytes of the buffer file
+ * from raw on are compressed to zlen bytes at zoff in the zdata file.
+ */
+typedef struct __cli_blockent
+{
+	uint64_t raw;
+	uint64_t zoff;
+	uint32_t rawlen;
+	uint32_t zlen;
+} cli_blockent;
+
+/**
+ * Version 1 interface header: the raw cli_if of the time, written at the
+ * start of if%02x-offset and followed by 32 bit end offsets of the records
+ * in if%02x-buffer.  Pointers are meaningless on disk.
+ */
+typedef struct __cli_if_v1
 {
 	char header;
 	int id;
-	 
+
 	unsigned int rx;
 	unsigned int rx_count;
 	unsigned int rx_size;
 	unsigned int rx_last;
 	unsigned int rx_offsetpos;
 	unsigned int rx_bufferpos;
+
+	void *offset;
+	void *buffer;
+
+	unsigned int buffer_size;
+	unsigned int read_size;
+
+	cli_if_type type;
+	cli_if_mode rxmode, txmode;
+
+	void *link;
+	int active;
+	unsigned int flags;
+
+	void *rxdev;
+	unsigned int rxopen;
+
+	union {
+		struct sockaddr_in sock;
+		char devname[CLI_DEFAULT_BUFFER];
+	};
+} cli_if_v1;
+
+/**
+ * One capture segment: offset, buffer, peer and time index files holding
+ * records first to first + count - 1.  Only the newest segment of an
+ * interface is appended to; older ones are sealed and stay mapped until
+ * retention removes them.  Readers hold a reference while they use one.  A
+ * version 1 session shows up as a single sealed segment without peer or time
+ * files; its offset entries start at base.
+ */
+typedef struct __cli_seg
+{
+	unsigned int version;
+	unsigned int base;
+	unsigned int seq;
+	unsigned int first;
+	unsigned int count;
+	unsigned long bytes;
+	long created;
+	long sealed;
+
+	int ref;
+	int dead;
+	// opened from a session another process may be capturing into
+	int rdonly;
+
+	cli_store *offset;
+	cli_store *buffer;
+	cli_store *peer;
+	cli_store *time;
+
+	// compressed copy of the buffer file, built in the background once the
+	// segment is sealed; packed once it has taken the buffer file's place
+	int packed;
+	cli_store *zdata;
+	cli_store *block;
+	unsigned long zraw;
+	unsigned int zrec;
+
+	// the last block a reader inflated
+	pthread_mutex_t zlock;
+	char *zcache;
+	long zcached;
+
+	// search index, and the filter being built for its last records
+	cli_store *bloom;
+	char *bits;
+	unsigned int brec, bnrec;
+	unsigned long bbytes;
+
+	char dir[CLI_DEFAULT_BUFFER];
+	int id;
+} cli_seg;
+
+/**
+ * Durability policy of an interface and statistics of the group commits made
+ * for it.  Periodic commits happen every ms milliseconds or every records
+ * records, whichever comes first (0 disables either limit).
+ */
+typedef struct __cli_durable
+{
+	cli_durable_mode mode;
+	unsigned int ms;
+	unsigned int records;
+
+	// records known to be on disk, and when that was last brought up to date
+	unsigned int synced;
+	unsigned long last;
+
+	unsigned long commits;
+	unsigned long batch_total;
+	unsigned long batch_max;
+	unsigned long usec_total;
+	unsigned long usec_max;
+} cli_durable;
+
+// part of a capture a search worker scans, see cli_search.c
+typedef struct __cli_scan
+{
+	cli_seg *seg;
+	unsigned long from, to;	// bytes, or blocks of a compressed segment
+	unsigned long end;		// end of the last published record
+	unsigned int n;			// records published
+} cli_scan;
+
+typedef struct __cli_query
+{
+	char pat[CLI_MAX_BUFFER];
+	unsigned int len;
+
+	cli_scan *scans;
+	unsigned int nscans;
+	unsigned int next;
+} cli_query;
+
+typedef struct __cli_searcher
+{
+	cli_query *query;
+	pthread_t thread;
+
+	unsigned int *hits;
+	unsigned int nhits;
+	unsigned long bytes;
+} cli_searcher;
+
+// streaming inflate of a CLI_MODE_Z interface
+typedef struct __cli_zstat
+{
+	unsigned long in;		// compressed bytes received
+	unsigned long out;		// bytes inflated from them
+	unsigned long nsec;		// time spent in inflate
+	unsigned int streams;	// streams that ended
+	unsigned int errors;	// input that was no zlib or gzip stream
+} cli_zstat;
+
+// pcapng export of an interface's records, see cli_pcap.c
+typedef struct __cli_pcap
+{
+	int fd;
+	struct __cli_if *iface;
+	cli_seg *seg;			// the segment the export is in
+
+	struct sockaddr_in local, remote;
+	uint8_t proto;
+	uint32_t seq[2];		// tcp sequence numbers, by direction
+	uint16_t ipid;
+
+	char *buf;				// blocks not written out yet
+	unsigned long len;
+	int err;
+
+	unsigned long recs;
+	unsigned long bytes;
+} cli_pcap;
+
+typedef struct __cli_if
+{
+	char header;
+	int id;
+	 
+	unsigned int rx;
+	unsigned int rx_count;
+	unsigned long rx_size;
+	unsigned int rx_last;
+	unsigned long rx_offsetpos;
+	unsigned long rx_bufferpos;
 	
-	FILE *offset;
-	FILE *buffer;
+	// interface header; records live in the segments, oldest first
+	cli_store *offset;
+	cli_seg **segs;
+	unsigned int nsegs;
+	unsigned int segcap;
+	unsigned int seq;
+	unsigned int rx_first;
+
+	// rollover and retention limits, 0 for none
+	unsigned long rotate_bytes;
+	unsigned long rotate_secs;
+	unsigned long retain_bytes;
+	unsigned long retain_secs;
+
+	// zlib level sealed segments are compressed with, 0 for none
+	unsigned int compress;
+
+	// search index, and what building it has cost
+	cli_index index;
+	unsigned long index_nsec;
+	unsigned long index_bytes;
 
 	unsigned int buffer_size;
 	unsigned int read_size;
+	unsigned int rx_batch;
+
+	// records (and their bytes) lost to the overload policy
+	cli_overload overload;
+	unsigned long rx_dropped;
+	unsigned long rx_dropped_bytes;
+
+	cli_durable durable;
 
 	cli_if_type type;
 	cli_if_mode rxmode, txmode;
@@ -80,6 +572,28 @@ typedef struct __cli_if
 		void *ptr;
 	} rxdev;
 	unsigned int rxopen;
+	unsigned int rxreg;
+	unsigned int shard;
+
+	// serializes capture (offset/buffer) updates between the capture writer
+	// and the command line
+	pthread_mutex_t lock;
+	// held by the replay thread while it writes to rxdev.fd, and by the
+	// command line while it closes or swaps that descriptor
+	pthread_mutex_t txlock;
+
+	// records read by the rx thread, waiting for the capture writer
+	cli_ring *rxq;
+
+	// records the last `rx /pattern/' found, and the one rx is on
+	unsigned int *hits;
+	unsigned int nhits;
+	unsigned int hit;
+
+	// inflate state kept across reads in rxmode zlib, see cli_inflate.c
+	void *zin;
+	char *zout;
+	cli_zstat zstat;
 
 	union {
 		struct sockaddr_in sock;
@@ -101,6 +615,20 @@ struct input_key {
 	struct input_key *n, *p;
 };
 
+/**
+ * Pager over the data of records from to to - 1 of an interface, read as one
+ * stream of size bytes.  top is the offset of the first of the rows shown;
+ * only those are ever read and formatted.
+ */
+typedef struct __cli_view
+{
+	cli_if *iface;
+	unsigned int from, to;
+	unsigned long size;
+	unsigned long top;
+	int rows;
+} cli_view;
+
 typedef struct __cli_ui {
 	struct input_key *first;
 	struct input_key *cur;
@@ -117,9 +645,95 @@ typedef struct __cli_ui {
 	unsigned int hsize;
 
 	unsigned int irq;
+	// records arriving are not drawn over the pager
+	int paging;
 	pthread_mutex_t mutex;
 } cli_ui;
 
+typedef enum {
+	CLI_ENGINE_EPOLL,
+	CLI_ENGINE_URING
+} cli_engine;
+
+typedef struct __cli_reactor
+{
+	int id;
+	int epfd;
+	int evfd;
+	unsigned int nifs;
+
+	cli_engine engine;
+	void *uring;
+
+	pthread_t thread;
+	struct __cli_ctx *ctx;
+
+	// rx buffers for this thread's interfaces, plus somewhere to receive
+	// data that the overload policy throws away
+	cli_pool pool;
+	char *discard;
+
+	// per-thread udp batch state, CLI_RX_BATCH records whose buffers are
+	// allocated as they are needed
+	struct mmsghdr *msgs;
+	struct iovec *iov;
+	cli_rec *recs;
+} cli_reactor;
+
+typedef struct __cli_writer
+{
+	int evfd;
+	int sleeping;
+	int stop;
+	pthread_t thread;
+
+	// producers blocked on a full ring or pool sleep on progress until the
+	// writer has released records, see cli_writer_wait
+	pthread_mutex_t lock;
+	pthread_cond_t progress;
+	unsigned long passes;
+	int waiters;
+} cli_writer;
+
+typedef struct __cli_flusher
+{
+	int running;
+	int stop;
+	pthread_t thread;
+
+	// wake is signalled to ask for commits, done once a pass has finished
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+} cli_flusher;
+
+/**
+ * Records from..to - 1 of src sent out of dst by a thread of their own,
+ * paced by their timestamps at speed thousandths of the recorded rate, or
+ * as fast as they go with speed 0.  The counts are kept by the thread.
+ */
+typedef struct __cli_replay
+{
+	int running;
+	int stop;
+	int joined;
+	int wake;
+	// paces the records out, unless they go as fast as possible
+	int timer;
+	pthread_t thread;
+	struct __cli_ctx *ctx;
+
+	cli_if *src, *dst;
+	unsigned int from, to, speed;
+
+	// start is on the monotonic clock, in ns; usec is set once it is over
+	unsigned long start;
+	unsigned int sent;
+	unsigned long bytes, usec;
+	// how far behind their schedule records went out, in ns
+	unsigned long late, late_max;
+} cli_replay;
+
 typedef struct __cli_ctx
 {
 	unsigned int state;
@@ -145,8 +759,23 @@ typedef struct __cli_ctx
 
 	int ins;
 	char cr, lf;
-	pthread_t thread;
-	pthread_mutex_t mutex;
+
+	// guards ctx->ifs; rx threads hold it shared while handling an interface
+	pthread_rwlock_t iflock;
+	// serializes rewriting the session manifest, taken after iflock
+	pthread_mutex_t mflock;
+
+	cli_reactor reactor[CLI_MAX_REACTORS];
+	unsigned int nreactors;
+	cli_engine engine;
+
+	cli_writer writer;
+	cli_flusher flusher;
+	cli_replay replay;
+
+	// buffers for the command line thread
+	cli_pool pool;
+
 	cli_ui ui;
 } cli_ctx;
 
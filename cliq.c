@@ -0,0 +1,620 @@
+/*
+ * cliq.c - headless queries over saved or running capture sessions
+ * (C) 2010-2011 Stephen Schweizer <schweizer@alumni.cmu.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <pwd.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "config.h"
+
+#include "clibase.h"
+#include "cli_store.h"
+#include "cli_seg.h"
+#include "cli_cap.h"
+#include "cli_search.h"
+#include "cli_pcap.h"
+#include "cli_fmt.h"
+
+#if HAVE_LIBARCHIVE
+#include <archive.h>
+#include <archive_entry.h>
+#endif
+
+#define CLIQ_COUNT	0x01
+#define CLIQ_LIST	0x02
+#define CLIQ_BARE	0x04
+
+static const char *cliq_name = "cliq";
+
+// -w: records go to a pcapng file instead
+static cli_pcap *cliq_pcap = NULL;
+
+static void cliq_usage(void)
+{
+	fprintf(stderr,
+		"usage: %s [-i if] [-m ascii|hex|octal|binary] [-c | -l] [-n]\n"
+		"            [-w file.pcapng] session query...\n"
+		"  session    a session directory, the name of one under /tmp/cli-$USER\n"
+		"             (its pid, or latest) or a saved .tgz\n"
+		"  -i if      the interface to query, as for `cd' (default: all for ?,\n"
+		"             the first one that captured anything otherwise)\n"
+		"  -m mode    how to print records (default: the interface's rxmode)\n"
+		"  -c         only count the records a query selects\n"
+		"  -l         only list their record numbers\n"
+		"  -n         print records without their number, time and source\n"
+		"  -w file    write the records to file (- for stdout) as pcapng, for\n"
+		"             tcp and udp interfaces\n"
+		"queries, run in order:\n"
+		"  ?          records, bytes and time span\n"
+		"  a..b       records a to b: a number, ^ (first), $ (last) or\n"
+		"             @time as in `rx @' (the first record from then on)\n"
+		"  a          record a alone\n"
+		"  /text/     records holding text, with the escapes of `rx /'\n"
+		"  x/hex/     records holding the bytes\n",
+		cliq_name);
+}
+
+/**
+ * Prints len bytes of a record in the given mode, the way `rx' shows them.
+ * Returns whether that ended a line.
+ */
+static int cliq_print_format_mode(FILE *fp, cli_if_mode mode,
+	const unsigned char *buffer, size_t len)
+{
+	char line[CLI_FMT_LINE];
+	size_t i, n, k, w = cli_fmt_width(mode);
+	int nl = 0;
+
+	for (i = 0; i < len; i += n) {
+		n = (len - i > w ? w : len - i);
+		if ((k = cli_fmt_line(mode, buffer + i, n, line)) > 0) {
+			fwrite(line, 1, k, fp);
+			nl = (line[k - 1] == '\n');
+		}
+	}
+
+	return nl;
+}
+
+static void cliq_print_time(FILE *fp, unsigned long ts)
+{
+	time_t t = ts / 1000000000UL;
+	struct tm tm;
+	char tmp[CLI_DEFAULT_BUFFER];
+
+	localtime_r(&t, &tm);
+	strftime(tmp, CLI_DEFAULT_BUFFER, "%Y-%m-%d %H:%M:%S", &tm);
+	fprintf(fp, "%s.%06lu", tmp, (ts % 1000000000UL) / 1000);
+}
+
+/**
+ * Prints record rec of seg, read into buf (CLI_MAX_BUFFER bytes), on a line
+ * of its own.  Returns -1 once stdout is gone.
+ */
+static int cliq_print_rec(cli_seg *seg, unsigned int rec, int mode,
+	int flags, char *buf)
+{
+	char addr[INET_ADDRSTRLEN];
+	struct sockaddr_in peer;
+	cli_rechdr rh;
+	int len;
+
+	// records retention has already removed are passed over
+	if (seg == NULL) { return 0; }
+
+	if (flags & CLIQ_LIST) {
+		printf("%u\n", rec);
+		return (ferror(stdout) ? -1 : 0);
+	}
+
+	if ((len = cli_seg_copy(seg, rec, buf, CLI_MAX_BUFFER, &rh, &peer)) < 0) {
+		return 0;
+	}
+
+	if (!(flags & CLIQ_BARE)) {
+		printf("%u ", rec);
+		if (rh.ts != 0) {
+			cliq_print_time(stdout, rh.ts);
+			putchar(' ');
+		}
+		if (rh.dir == CLI_DIR_TX) { printf("[tx] "); }
+		if (peer.sin_family == AF_INET) {
+			inet_ntop(AF_INET, &peer.sin_addr, addr, INET_ADDRSTRLEN);
+			printf("[%s:%d] ", addr, ntohs(peer.sin_port));
+		}
+	}
+
+	// compressed input that did not inflate was kept as is; one record
+	// per line, even where it ends in a newline of its own
+	if (!cliq_print_format_mode(stdout,
+		(rh.flags & CLI_REC_RAW ? CLI_MODE_HEX : (cli_if_mode)mode),
+		(unsigned char *)buf, len)) {
+		putchar('\n');
+	}
+
+	return (ferror(stdout) ? -1 : 0);
+}
+
+/**
+ * Passes record rec on: to the pcapng export if there is one, or printed.
+ * *seg follows the records along, a segment at a time in memory.
+ */
+static int cliq_emit(cli_if *iface, cli_seg **seg, unsigned int rec,
+	int mode, int flags, char *buf)
+{
+	if (cliq_pcap != NULL) { return cli_pcap_write(cliq_pcap, rec); }
+
+	*seg = cli_seg_walk(iface, *seg, rec);
+	return cliq_print_rec(*seg, rec, mode, flags, buf);
+}
+
+/**
+ * Prints the records of a range (see cli_cap_parse_range), one at a time.
+ * Records retention has removed are neither printed nor counted.
+ */
+static int cliq_range(cli_if *iface, const char *arg, int mode, int flags,
+	char *buf)
+{
+	unsigned int from, to, rec, last, n = 0;
+	cli_seg *seg = NULL;
+	int ret = 0;
+
+	if (cli_cap_parse_range(iface, arg, &from, &to) == -1) { return -1; }
+
+	for (rec = from; rec < to; rec++) {
+		if (flags & CLIQ_COUNT) {
+			// a segment at a time
+			if ((seg = cli_seg_walk(iface, seg, rec)) == NULL) { continue; }
+			last = seg->first + seg->count;
+			if (last > to) { last = to; }
+			n += last - rec;
+			rec = last - 1;
+		} else if (cliq_emit(iface, &seg, rec, mode, flags, buf) == -1) {
+			ret = -2;
+			break;
+		}
+	}
+
+	if (flags & CLIQ_COUNT) { printf("%u\n", n); }
+
+	cli_seg_drop(seg);
+	cli_seg_put(seg);
+
+	return ret;
+}
+
+static int cliq_search(cli_if *iface, const char *arg, int mode, int flags,
+	char *buf)
+{
+	unsigned long bytes, skipped, usec;
+	cli_seg *seg = NULL;
+	unsigned int i;
+	int x, ret = 0;
+
+	if ((x = cli_search(iface, arg, &bytes, &skipped, &usec)) < 0) {
+		return -1;
+	}
+
+	if (flags & CLIQ_COUNT) {
+		printf("%d\n", x);
+	} else {
+		for (i = 0; (i < iface->nhits) && (ret == 0); i++) {
+			if (cliq_emit(iface, &seg, iface->hits[i], mode, flags, buf) == -1) {
+				ret = -2;
+			}
+		}
+		cli_seg_drop(seg);
+		cli_seg_put(seg);
+	}
+
+	fprintf(stderr, "%s: if%02x: %d hit(s) in %lu byte(s), %lu.%03lus",
+		cliq_name, iface->id, x, bytes, usec / 1000000, (usec / 1000) % 1000);
+	if (skipped > 0) {
+		fprintf(stderr, ", %lu byte(s) ruled out by index", skipped);
+	}
+	fprintf(stderr, "\n");
+
+	return ret;
+}
+
+static void cliq_info(cli_if *iface)
+{
+	cli_seg **segs;
+	cli_rechdr rh;
+	unsigned long raw = 0, disk = 0;
+	unsigned int i, n;
+
+	segs = cli_seg_snapshot(iface, &n);
+	for (i = 0; i < n; i++) {
+		raw += segs[i]->bytes;
+		disk += cli_seg_size(segs[i]);
+	}
+	cli_seg_release(segs, n);
+
+	printf("if%02x  %u record(s)  %lu byte(s), %lu on disk  %u segment(s)\n",
+		iface->id, iface->rx_count - iface->rx_first, raw, disk, n);
+
+	if (iface->rx_count > iface->rx_first) {
+		printf("      records %u..%u\n", iface->rx_first, iface->rx_count - 1);
+		if ((cli_seg_read(iface, iface->rx_first, NULL, 0, &rh, NULL) >= 0) &&
+			(rh.ts != 0)) {
+			printf("      from ");
+			cliq_print_time(stdout, rh.ts);
+			if ((cli_seg_read(iface, iface->rx_count - 1, NULL, 0, &rh, NULL) >= 0) &&
+				(rh.ts != 0)) {
+				printf(" to ");
+				cliq_print_time(stdout, rh.ts);
+			}
+			printf("\n");
+		}
+	}
+}
+
+/**
+ * Loads interface x from the header file in dir, and its segments read only.
+ */
+static cli_if *cliq_load_if(const char *dir, const char *file, int x)
+{
+	char path[CLI_DEFAULT_BUFFER];
+	cli_if *iface;
+
+	iface = (cli_if *)malloc(sizeof(cli_if));
+	if (iface == NULL) { return NULL; }
+	memset(iface, 0, sizeof(cli_if));
+	pthread_mutex_init(&iface->lock, NULL);
+
+	if ((snprintf(path, CLI_DEFAULT_BUFFER, "%s/%s", dir, file) >=
+		CLI_DEFAULT_BUFFER) || (cli_cap_read_if(iface, path) == -1)) {
+		fprintf(stderr, "%s: `%s' is not an interface header\n", cliq_name, path);
+		pthread_mutex_destroy(&iface->lock);
+		free(iface);
+		return NULL;
+	}
+	iface->id = x;
+
+	if (cli_seg_load(iface, dir, CLI_STORE_RDONLY) == -1) {
+		fprintf(stderr, "%s: cannot read the segments of if%02x\n", cliq_name, x);
+	}
+
+	return iface;
+}
+
+/**
+ * Loads every interface of the session in dir: from if%02x-header, or the
+ * if%02x-offset of a version 1 session.  Returns how many there are.
+ */
+static int cliq_load(const char *dir, cli_if **ifs)
+{
+	DIR *d;
+	struct dirent *dp;
+	char kind[CLI_DEFAULT_BUFFER];
+	char v1[CLI_DEFAULT_BUFFER];
+	int x, n = 0;
+
+	if ((d = opendir(dir)) == NULL) { return -1; }
+
+	while ((dp = readdir(d)) != NULL) {
+		if ((sscanf(dp->d_name, "if%02x-%s", &x, kind) != 2) ||
+			(x < 0) || (x >= CLI_DEFAULT_BUFFER) || (ifs[x] != NULL)) {
+			continue;
+		}
+
+		if (strcmp(kind, "header") == 0) {
+			ifs[x] = cliq_load_if(dir, dp->d_name, x);
+		} else if (strcmp(kind, "offset") == 0) {
+			// a version 1 session, unless it was reloaded since
+			if ((snprintf(v1, CLI_DEFAULT_BUFFER, "%s/if%02x-header", dir, x) >=
+				CLI_DEFAULT_BUFFER) || (access(v1, F_OK) == 0)) {
+				continue;
+			}
+			ifs[x] = cliq_load_if(dir, dp->d_name, x);
+		}
+
+		if (ifs[x] != NULL) { n++; }
+	}
+	closedir(d);
+
+	return n;
+}
+
+#if HAVE_LIBARCHIVE
+/**
+ * Unpacks the interface files of a saved session into dir, each streamed
+ * through buf (CLI_MAX_BUFFER bytes).
+ */
+static int cliq_unpack(const char *file, const char *dir, char *buf)
+{
+	struct archive *a;
+	struct archive_entry *e;
+	char path[CLI_DEFAULT_BUFFER];
+	const char *name;
+	ssize_t len;
+	int fd, r, ret = 0;
+
+	a = archive_read_new();
+	archive_read_support_format_tar(a);
+	archive_read_support_compression_gzip(a);
+
+	if ((r = archive_read_open_filename(a, file, 16384)) == ARCHIVE_OK) {
+		while ((r = archive_read_next_header(a, &e)) == ARCHIVE_OK) {
+			name = archive_entry_pathname(e);
+			if ((strncmp(name, "if", 2) != 0) || (strchr(name, '/') != NULL)) {
+				archive_read_data_skip(a);
+				continue;
+			}
+
+			if ((snprintf(path, CLI_DEFAULT_BUFFER, "%s/%s", dir, name) >=
+				CLI_DEFAULT_BUFFER) ||
+				((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1)) {
+				ret = -1;
+				break;
+			}
+			while ((len = archive_read_data(a, buf, CLI_MAX_BUFFER)) > 0) {
+				if (write(fd, buf, len) != len) {
+					len = -1;
+					break;
+				}
+			}
+			close(fd);
+			if (len < 0) {
+				ret = -1;
+				break;
+			}
+		}
+	}
+
+	if ((r != ARCHIVE_EOF) || (ret == -1)) {
+		fprintf(stderr, "%s: %s: %s\n", cliq_name, file,
+			(r != ARCHIVE_EOF ? archive_error_string(a) : "cannot unpack"));
+		ret = -1;
+	}
+
+	archive_read_close(a);
+	archive_read_finish(a);
+
+	return ret;
+}
+#endif
+
+static void cliq_unlink_dir(const char *dir)
+{
+	DIR *d;
+	struct dirent *dp;
+	char path[CLI_DEFAULT_BUFFER];
+
+	if ((d = opendir(dir)) != NULL) {
+		while ((dp = readdir(d)) != NULL) {
+			if ((dp->d_name[0] == '.') ||
+				(snprintf(path, CLI_DEFAULT_BUFFER, "%s/%s", dir, dp->d_name) >=
+				CLI_DEFAULT_BUFFER)) {
+				continue;
+			}
+			unlink(path);
+		}
+		closedir(d);
+	}
+	rmdir(dir);
+}
+
+/**
+ * Finds the session directory that arg names: a directory, a session under
+ * /tmp/cli-$USER, or a saved .tgz, which is unpacked into tmp first.
+ */
+static int cliq_session(const char *arg, char *dir, char *tmp, char *buf)
+{
+	struct passwd *pw;
+	struct stat st;
+
+	if (strlen(arg) >= CLI_DEFAULT_BUFFER - sizeof("/if00-header")) {
+		fprintf(stderr, "%s: session name too long `%s'\n", cliq_name, arg);
+		return -1;
+	}
+
+	if ((stat(arg, &st) == 0) && (S_ISDIR(st.st_mode))) {
+		snprintf(dir, CLI_DEFAULT_BUFFER, "%s", arg);
+		return 0;
+	}
+
+	if ((stat(arg, &st) == 0) && (S_ISREG(st.st_mode))) {
+#if HAVE_LIBARCHIVE
+		strcpy(tmp, "/tmp/cliq.XXXXXX");
+		if (mkdtemp(tmp) == NULL) {
+			tmp[0] = 0;
+			return -1;
+		}
+		strcpy(dir, tmp);
+		return cliq_unpack(arg, dir, buf);
+#else
+		(void)tmp;
+		(void)buf;
+		fprintf(stderr, "%s: built without libarchive, cannot open `%s'\n",
+			cliq_name, arg);
+		return -1;
+#endif
+	}
+
+	if ((pw = getpwuid(getuid())) != NULL) {
+		if ((snprintf(dir, CLI_DEFAULT_BUFFER, "/tmp/cli-%s/%s", pw->pw_name,
+			arg) < CLI_DEFAULT_BUFFER) &&
+			(stat(dir, &st) == 0) && (S_ISDIR(st.st_mode))) {
+			return 0;
+		}
+	}
+
+	fprintf(stderr, "%s: no session `%s'\n", cliq_name, arg);
+	return -1;
+}
+
+static void cliq_free(cli_if **ifs)
+{
+	int i;
+
+	for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
+		if (ifs[i] == NULL) { continue; }
+		cli_search_free(ifs[i]);
+		cli_seg_free_all(ifs[i]);
+		pthread_mutex_destroy(&ifs[i]->lock);
+		free(ifs[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static cli_if *ifs[CLI_DEFAULT_BUFFER];
+	char dir[CLI_DEFAULT_BUFFER], tmp[CLI_DEFAULT_BUFFER];
+	const char *wfile = NULL;
+	char *buf;
+	cli_if *iface = NULL;
+	int c, i, sel = -1, mode = -1, flags = 0, ret = 0, r, fd = -1;
+
+	cliq_name = argv[0];
+
+	while ((c = getopt(argc, argv, "i:m:clnw:")) != -1) {
+		switch (c) {
+		case 'i':
+			sel = atoi(optarg);
+			if ((sel < 0) || (sel >= CLI_DEFAULT_BUFFER)) {
+				fprintf(stderr, "%s: no interface `%s'\n", argv[0], optarg);
+				return 1;
+			}
+			break;
+		case 'm':
+			switch (optarg[0]) {
+			case 'a': case 'p': case 't': mode = CLI_MODE_PLAINTEXT; break;
+			case 'h': case 'x': mode = CLI_MODE_HEX; break;
+			case 'o': mode = CLI_MODE_OCTAL; break;
+			case 'b': mode = CLI_MODE_BINARY; break;
+			default:
+				fprintf(stderr, "%s: unknown mode `%s'\n", argv[0], optarg);
+				return 1;
+			}
+			break;
+		case 'c': flags |= CLIQ_COUNT; break;
+		case 'l': flags |= CLIQ_LIST; break;
+		case 'n': flags |= CLIQ_BARE; break;
+		case 'w': wfile = optarg; break;
+		default:
+			cliq_usage();
+			return 1;
+		}
+	}
+
+	if (argc - optind < 2) {
+		cliq_usage();
+		return 1;
+	}
+
+	// a reader that has gone away ends the queries
+	signal(SIGPIPE, SIG_IGN);
+
+	// records are streamed through one buffer
+	if ((buf = (char *)malloc(CLI_MAX_BUFFER)) == NULL) { return 1; }
+	tmp[0] = 0;
+
+	if (cliq_session(argv[optind], dir, tmp, buf) == -1) {
+		ret = 1;
+		goto done;
+	}
+	if (cliq_load(dir, ifs) <= 0) {
+		fprintf(stderr, "%s: no interfaces in `%s'\n", argv[0], argv[optind]);
+		ret = 1;
+		goto done;
+	}
+
+	if (sel >= 0) {
+		if ((iface = ifs[sel]) == NULL) {
+			fprintf(stderr, "%s: no interface %d in `%s'\n", argv[0], sel,
+				argv[optind]);
+			ret = 1;
+			goto done;
+		}
+	} else {
+		// the first that captured anything
+		for (i = 0; i < CLI_DEFAULT_BUFFER; i++) {
+			if (ifs[i] == NULL) { continue; }
+			if (iface == NULL) { iface = ifs[i]; }
+			if (ifs[i]->rx_count > ifs[i]->rx_first) {
+				iface = ifs[i];
+				break;
+			}
+		}
+	}
+
+	if (wfile != NULL) {
+		fd = (strcmp(wfile, "-") == 0 ? STDOUT_FILENO :
+			open(wfile, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+		if (fd == -1) {
+			fprintf(stderr, "%s: %s: %s\n", argv[0], wfile, strerror(errno));
+			ret = 1;
+			goto done;
+		}
+		if ((cliq_pcap = cli_pcap_open(iface, fd, NULL)) == NULL) {
+			fprintf(stderr, "%s: only tcp and udp interfaces can be exported\n",
+				argv[0]);
+			ret = 1;
+			goto done;
+		}
+	}
+
+	for (i = optind + 1; (i < argc) && (ret == 0); i++) {
+		if (strcmp(argv[i], "?") == 0) {
+			if (sel >= 0) {
+				cliq_info(iface);
+			} else {
+				for (c = 0; c < CLI_DEFAULT_BUFFER; c++) {
+					if (ifs[c] != NULL) { cliq_info(ifs[c]); }
+				}
+			}
+			continue;
+		}
+
+		c = (mode >= 0 ? mode : (int)iface->rxmode);
+		if ((argv[i][0] == '/') || ((argv[i][0] == 'x') && (argv[i][1] == '/'))) {
+			r = cliq_search(iface, argv[i], c, flags, buf);
+		} else {
+			r = cliq_range(iface, argv[i], c, flags, buf);
+		}
+
+		if (r == -1) {
+			fprintf(stderr, "%s: cannot make sense of query `%s'\n", argv[0],
+				argv[i]);
+			ret = 1;
+		} else if (r == -2) {
+			ret = 1;
+		}
+	}
+
+	if (fflush(stdout) != 0) { ret = 1; }
+
+done:
+	if ((cliq_pcap != NULL) && (cli_pcap_close(cliq_pcap) == -1)) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], wfile, strerror(errno));
+		ret = 1;
+	}
+	if ((fd != -1) && (fd != STDOUT_FILENO)) { close(fd); }
+	cliq_free(ifs);
+	if (tmp[0] != 0) { cliq_unlink_dir(tmp); }
+	free(buf);
+
+	return ret;
+}